@@ -0,0 +1,39 @@
+#include "bench.h"
+#include <stddef.h>
+
+// 🔹 Reemplaza malloc/calloc/realloc de glibc para contar las reservas, también las de cJSON.
+// El benchmark corre en un solo hilo, así que los contadores no necesitan ser atómicos.
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t n, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+
+uint64_t bench_allocs = 0;
+uint64_t bench_alloc_bytes = 0;
+
+void *malloc(size_t size)
+{
+    bench_allocs++;
+    bench_alloc_bytes += size;
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t n, size_t size)
+{
+    bench_allocs++;
+    bench_alloc_bytes += n * size;
+    return __libc_calloc(n, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    bench_allocs++;
+    bench_alloc_bytes += size;
+    return __libc_realloc(ptr, size);
+}
+
+void free(void *ptr)
+{
+    __libc_free(ptr);
+}
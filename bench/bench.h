@@ -0,0 +1,26 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdint.h>
+#include <libwebsockets.h>
+
+// Capa falsa de libwebsockets para el benchmark (lws_stub.c): las conexiones son structs en
+// memoria, lws_write solo cuenta bytes y lws_callback_on_writable anota la conexión en una
+// lista que el benchmark vacía como lo haría el bucle de servicio con SERVER_WRITEABLE.
+
+// Conexión con user como datos de sesión, en el subprotocolo JSON o binario
+struct lws *bench_wsi_new(void *user, int binary);
+void bench_wsi_free(struct lws *wsi);
+
+// Próxima conexión que pidió WRITEABLE, o NULL si no queda ninguna
+struct lws *bench_next_writable(void);
+
+// Acumulados de lws_write
+extern uint64_t bench_bytes_written;
+extern uint64_t bench_writes;
+
+// Reservas de memoria del proceso (alloc_count.c): malloc, calloc y realloc
+extern uint64_t bench_allocs;
+extern uint64_t bench_alloc_bytes;
+
+#endif
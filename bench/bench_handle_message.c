@@ -0,0 +1,222 @@
+#include "bench.h"
+#include "server.h"
+#include "msgpack.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Microbenchmark de handle_message por tipo de mensaje y tamaño del registro de usuarios.
+// Cada operación es handle_message con un frame ya armado más el vaciado de las colas que
+// generó (lo que harían los SERVER_WRITEABLE): decodificación, búsquedas, serialización y
+// reparto. Informa ns/op, reservas de memoria/op y bytes escritos/op.
+
+#define BENCH_MAX_USERS 10000
+#define BENCH_WARMUP_OPS 3
+#define BENCH_MIN_OPS 20
+#define BENCH_MAX_OPS 1000000
+#define BENCH_MS 200 // Tiempo mínimo medido por caso (CHAT_BENCH_MS)
+#define BENCH_ROOM "sala"
+#define BENCH_CASES 9
+
+typedef struct
+{
+    struct lws *wsi;
+    SessionData pss;
+} BenchConn;
+
+static BenchConn conns[BENCH_MAX_USERS];
+static BenchConn spare; // Conexión sin registrar para medir register
+static int registered = 0;
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+// Lo que hace LWS_CALLBACK_ESTABLISHED
+static int conn_open(BenchConn *c, int binary)
+{
+    memset(&c->pss, 0, sizeof(c->pss));
+    send_queue_init(&c->pss.queue);
+    c->pss.shard = 0;
+    c->pss.shard_pos = -1;
+    c->wsi = bench_wsi_new(&c->pss, binary);
+    return c->wsi ? 0 : -1;
+}
+
+// Lo que haría el bucle de servicio: un frame por WRITEABLE hasta vaciar las colas
+static void drain_writable(void)
+{
+    struct lws *wsi;
+    while ((wsi = bench_next_writable()) != NULL)
+    {
+        SessionData *pss = (SessionData *)lws_wsi_user(wsi);
+        send_queue_write_next(&pss->queue, wsi);
+    }
+}
+
+// Manda json desde c, en MessagePack si la conexión es binaria
+static void deliver(BenchConn *c, const char *json)
+{
+    char buf[256];
+    long len = wsi_is_binary(c->wsi) ? json_to_msgpack(json, strlen(json), (unsigned char *)buf, sizeof(buf))
+                                     : snprintf(buf, sizeof(buf), "%s", json);
+    if (len <= 0)
+        return;
+    handle_message(buf, (size_t)len, c->wsi);
+    drain_writable();
+}
+
+// Agrega usuarios hasta tener count; todos en la sala BENCH_ROOM. La conexión 1 usa el
+// subprotocolo binario para que el reparto incluya una transcodificación.
+static int grow_roster(int count)
+{
+    char name[32], msg[128];
+    for (; registered < count; registered++)
+    {
+        BenchConn *c = &conns[registered];
+        if (conn_open(c, registered == 1) < 0)
+            return -1;
+        snprintf(name, sizeof(name), "u%d", registered);
+        if (add_user(name, c->wsi) != 1)
+            return -1;
+        snprintf(msg, sizeof(msg), "{\"type\":\"join\",\"sender\":\"%s\",\"content\":\"" BENCH_ROOM "\"}", name);
+        deliver(c, msg);
+    }
+    return 0;
+}
+
+typedef struct
+{
+    const char *name;
+    int sender;       // Índice en conns, o -1 para la conexión sin registrar
+    char msgs[2][256]; // Se alternan (p. ej. ACTIVO/OCUPADO); el segundo vacío = siempre el primero
+    size_t lens[2];
+} BenchCase;
+
+static void set_json(BenchCase *c, int i, const char *json)
+{
+    c->lens[i] = (size_t)snprintf(c->msgs[i], sizeof(c->msgs[i]), "%s", json);
+}
+
+static void set_binary(BenchCase *c, const char *json)
+{
+    long n = json_to_msgpack(json, strlen(json), (unsigned char *)c->msgs[0], sizeof(c->msgs[0]));
+    c->lens[0] = n > 0 ? (size_t)n : 0;
+}
+
+static int build_cases(BenchCase *cases, int users)
+{
+    char json[256];
+    int n = 0;
+    memset(cases, 0, BENCH_CASES * sizeof(BenchCase));
+
+    cases[n] = (BenchCase){.name = "register", .sender = -1};
+    set_json(&cases[n++], 0, "{\"type\":\"register\",\"sender\":\"nuevo\"}");
+
+    cases[n] = (BenchCase){.name = "broadcast", .sender = 0};
+    set_json(&cases[n++], 0, "{\"type\":\"broadcast\",\"sender\":\"u0\",\"content\":\"hola a todos\"}");
+
+    cases[n] = (BenchCase){.name = "broadcast/bin", .sender = 1};
+    set_binary(&cases[n++], "{\"type\":\"broadcast\",\"sender\":\"u1\",\"content\":\"hola a todos\"}");
+
+    cases[n] = (BenchCase){.name = "private", .sender = 0};
+    snprintf(json, sizeof(json), "{\"type\":\"private\",\"sender\":\"u0\",\"target\":\"u%d\",\"content\":\"hola\"}",
+             users - 1);
+    set_json(&cases[n++], 0, json);
+
+    cases[n] = (BenchCase){.name = "list_users", .sender = 0};
+    set_json(&cases[n++], 0, "{\"type\":\"list_users\",\"sender\":\"u0\"}");
+
+    cases[n] = (BenchCase){.name = "user_info", .sender = 0};
+    snprintf(json, sizeof(json), "{\"type\":\"user_info\",\"sender\":\"u0\",\"target\":\"u%d\"}", users / 2);
+    set_json(&cases[n++], 0, json);
+
+    cases[n] = (BenchCase){.name = "change_status", .sender = 0};
+    set_json(&cases[n], 0, "{\"type\":\"change_status\",\"sender\":\"u0\",\"content\":\"OCUPADO\"}");
+    set_json(&cases[n++], 1, "{\"type\":\"change_status\",\"sender\":\"u0\",\"content\":\"ACTIVO\"}");
+
+    cases[n] = (BenchCase){.name = "room_message", .sender = 0};
+    set_json(&cases[n++], 0,
+             "{\"type\":\"room_message\",\"sender\":\"u0\",\"target\":\"" BENCH_ROOM "\",\"content\":\"hola sala\"}");
+
+    cases[n] = (BenchCase){.name = "invalid", .sender = 0};
+    set_json(&cases[n++], 0, "{\"type\":\"broadcast\",\"sender\":");
+    return n;
+}
+
+static void run_case(const BenchCase *bc, int users, uint64_t min_ns)
+{
+    BenchConn *c = bc->sender < 0 ? &spare : &conns[bc->sender];
+    char buf[256];
+    uint64_t ns = 0, allocs = 0, bytes = 0, writes = 0;
+    long ops = 0;
+
+    for (long i = 0; i < BENCH_MAX_OPS; i++)
+    {
+        int which = bc->lens[1] ? (int)(i & 1) : 0;
+        memcpy(buf, bc->msgs[which], bc->lens[which]); // handle_message decodifica en el lugar
+        buf[bc->lens[which]] = '\0';
+
+        uint64_t a0 = bench_allocs, b0 = bench_bytes_written, w0 = bench_writes;
+        uint64_t t0 = now_ns();
+        handle_message(buf, bc->lens[which], c->wsi);
+        drain_writable();
+        uint64_t t1 = now_ns();
+
+        if (i >= BENCH_WARMUP_OPS)
+        {
+            ns += t1 - t0;
+            allocs += bench_allocs - a0;
+            bytes += bench_bytes_written - b0;
+            writes += bench_writes - w0;
+            ops++;
+        }
+
+        // Fuera de la medición: el registro se deshace para repetirlo con el mismo tamaño
+        if (bc->sender < 0)
+        {
+            remove_user(c->wsi);
+            send_queue_destroy(&c->pss.queue);
+            send_queue_init(&c->pss.queue);
+        }
+        if (ops >= BENCH_MIN_OPS && ns >= min_ns)
+            break;
+    }
+
+    printf("%-14s %6d %12.0f %10.2f %12.0f %10.2f\n", bc->name, users, (double)ns / ops, (double)allocs / ops,
+           (double)bytes / ops, (double)writes / ops);
+}
+
+int main(int argc, char *argv[])
+{
+    static const int sizes[] = {10, 1000, 10000};
+    uint64_t min_ns = (uint64_t)env_int("CHAT_BENCH_MS", BENCH_MS, 1, 60000) * 1000000ull;
+
+    log_level = LOG_LEVEL_OFF;
+    memset(&rate_config, 0, sizeof(rate_config)); // Sin límites: se mide el manejador
+    metrics_init();
+    idle_timers_init();
+    shards_init(NULL, 1);
+    shard_bind_thread(0);
+    if (conn_open(&spare, 0) < 0)
+        return 1;
+
+    printf("%-14s %6s %12s %10s %12s %10s\n", "tipo", "users", "ns/op", "allocs/op", "bytes/op", "writes/op");
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+    {
+        if (grow_roster(sizes[s]) < 0)
+        {
+            fprintf(stderr, "No se pudo armar un registro de %d usuarios\n", sizes[s]);
+            return 1;
+        }
+        BenchCase cases[BENCH_CASES];
+        int count = build_cases(cases, sizes[s]);
+        for (int i = 0; i < count; i++)
+            run_case(&cases[i], sizes[s], min_ns);
+    }
+    return 0;
+}
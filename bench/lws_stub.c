@@ -0,0 +1,107 @@
+#include "bench.h"
+#include "msg_types.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+// En libwebsockets struct lws es opaca: acá se define con lo mínimo que usa el servidor
+struct lws
+{
+    void *user;
+    const struct lws_protocols *protocol;
+    int writable; // Ya está en la lista de WRITEABLE pendientes
+    struct lws *next_writable;
+};
+
+uint64_t bench_bytes_written = 0;
+uint64_t bench_writes = 0;
+
+static const struct lws_protocols bench_protocols[] = {
+    {CHAT_PROTOCOL, NULL, 0, 4096, CHAT_PROTOCOL_ID_JSON, NULL, 0},
+    {CHAT_PROTOCOL_BIN, NULL, 0, 4096, CHAT_PROTOCOL_ID_BIN, NULL, 0},
+};
+
+// FIFO de conexiones con WRITEABLE pedido
+static struct lws *writable_head = NULL;
+static struct lws *writable_tail = NULL;
+
+struct lws *bench_wsi_new(void *user, int binary)
+{
+    struct lws *wsi = calloc(1, sizeof(struct lws));
+    if (!wsi)
+        return NULL;
+    wsi->user = user;
+    wsi->protocol = &bench_protocols[binary ? 1 : 0];
+    return wsi;
+}
+
+void bench_wsi_free(struct lws *wsi)
+{
+    free(wsi);
+}
+
+struct lws *bench_next_writable(void)
+{
+    struct lws *wsi = writable_head;
+    if (!wsi)
+        return NULL;
+    writable_head = wsi->next_writable;
+    if (!writable_head)
+        writable_tail = NULL;
+    wsi->next_writable = NULL;
+    wsi->writable = 0;
+    return wsi;
+}
+
+int lws_write(struct lws *wsi, unsigned char *buf, size_t len, enum lws_write_protocol protocol)
+{
+    bench_bytes_written += len;
+    bench_writes++;
+    return (int)len;
+}
+
+int lws_callback_on_writable(struct lws *wsi)
+{
+    if (wsi->writable)
+        return 1;
+    wsi->writable = 1;
+    if (writable_tail)
+        writable_tail->next_writable = wsi;
+    else
+        writable_head = wsi;
+    writable_tail = wsi;
+    return 1;
+}
+
+void *lws_wsi_user(struct lws *wsi)
+{
+    return wsi->user;
+}
+
+const struct lws_protocols *lws_get_protocol(struct lws *wsi)
+{
+    return wsi->protocol;
+}
+
+const char *lws_get_peer_simple(struct lws *wsi, char *name, size_t namelen)
+{
+    snprintf(name, namelen, "127.0.0.1");
+    return name;
+}
+
+void lws_cancel_service(struct lws_context *context)
+{
+}
+
+void lws_set_timeout(struct lws *wsi, enum pending_timeout reason, int secs)
+{
+}
+
+int lws_is_final_fragment(struct lws *wsi)
+{
+    return 1;
+}
+
+size_t lws_remaining_packet_payload(struct lws *wsi)
+{
+    return 0;
+}
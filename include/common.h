@@ -0,0 +1,31 @@
+#ifndef COMMON_H
+#define COMMON_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Utilidades compartidas por el servidor y el cliente
+
+// Tamaño de un timestamp ISO 8601 "YYYY-MM-DDTHH:MM:SS" incluyendo el '\0'
+#define TIMESTAMP_SIZE 20
+
+// Copia en buf (al menos TIMESTAMP_SIZE bytes) el timestamp local del segundo actual.
+// El texto se formatea una sola vez por segundo y se comparte entre hilos; la llamada
+// normal es solo una lectura atómica y una copia de 20 bytes.
+void timestamp_now(char *buf);
+
+// Milisegundos de un reloj monótono (no retrocede con cambios de hora del sistema)
+uint64_t monotonic_ms(void);
+
+// Milisegundos desde la época Unix (reloj de pared, para datos que sobreviven al proceso)
+uint64_t realtime_ms(void);
+
+// Hash FNV-1a de 32 bits de len bytes, o de una cadena terminada en '\0'
+uint32_t fnv1a(const void *data, size_t len);
+uint32_t fnv1a_str(const char *s);
+
+// Entero de la variable de entorno name dentro de [min, max]. Si no está definida devuelve
+// fallback; si es inválida avisa por stderr y también devuelve fallback.
+int env_int(const char *name, int fallback, int min, int max);
+
+#endif // COMMON_H
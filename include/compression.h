@@ -0,0 +1,60 @@
+#ifndef COMPRESSION_H
+#define COMPRESSION_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <libwebsockets.h>
+
+// permessage-deflate (RFC 7692) para el cliente y el servidor, con la política configurable
+// por variables de entorno:
+//   CHAT_DEFLATE            0 para desactivar la extensión (activa por defecto)
+//   CHAT_DEFLATE_LEVEL      nivel de zlib, 0-9 (más alto = menos bytes, más CPU)
+//   CHAT_DEFLATE_WINDOW     bits de ventana, 9-15 (más bajo = menos memoria y menos compresión).
+//                           La pide el cliente en su oferta para ambos sentidos y el servidor la respeta.
+//   CHAT_DEFLATE_THRESHOLD  mensajes de menos bytes se envían sin comprimir
+
+typedef struct
+{
+    int enabled;
+    int level;
+    int window_bits;
+    size_t threshold;
+} DeflateConfig;
+
+// Bytes antes y después de comprimir en una conexión
+typedef struct
+{
+    uint64_t raw_bytes;  // Payload entregado a lws_write
+    uint64_t wire_bytes; // Payload que salió (comprimido o no)
+    uint64_t messages;
+    uint64_t compressed_messages;
+} DeflateStats;
+
+extern DeflateConfig deflate_config;
+
+// Lee la configuración del entorno. Llamar antes de crear el contexto.
+void deflate_config_load(void);
+
+// Lista para lws_context_creation_info.extensions (NULL si está desactivada)
+const struct lws_extension *deflate_extensions(void);
+
+// Aplica el nivel de compresión a una conexión recién establecida, antes de su primer envío.
+void deflate_apply(struct lws *wsi);
+
+// Indica dónde acumular las estadísticas de cada conexión (NULL = no se cuentan)
+typedef DeflateStats *(*deflate_stats_fn)(struct lws *wsi);
+void deflate_set_stats_hook(deflate_stats_fn fn);
+
+// Además, cada mensaje saliente se informa aquí (para totales del proceso; NULL = nada).
+// Las continuaciones de un mensaje grande llegan con raw_bytes == 0; compressed indica que
+// el mensaje pasó por el compresor.
+typedef void (*deflate_totals_fn)(uint64_t raw_bytes, uint64_t wire_bytes, int compressed);
+void deflate_set_totals_hook(deflate_totals_fn fn);
+
+// Tamaño en el cable respecto del original (1.0 = sin ahorro)
+static inline double deflate_ratio(const DeflateStats *s)
+{
+    return s->raw_bytes ? (double)s->wire_bytes / (double)s->raw_bytes : 1.0;
+}
+
+#endif // COMPRESSION_H
@@ -0,0 +1,73 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+// Histograma log-lineal al estilo HDR: cada potencia de 2 se divide en HIST_SUB partes
+// iguales, así que cualquier valor se guarda con un error relativo menor a 1/HIST_SUB
+// (12,5%) sin importar la escala, de nanosegundos a minutos, en un arreglo fijo.
+// Registrar es calcular un índice y sumar uno: lo escribe un único hilo (sin instrucciones
+// atómicas de lectura-modificación) y cualquier otro puede leerlo en cualquier momento.
+#define HIST_SUB_BITS 3
+#define HIST_SUB (1 << HIST_SUB_BITS)
+#define HIST_MAX_EXP 40 // Valores de hasta 2^41 - 1; los mayores caen en el último bucket
+#define HIST_BUCKETS (HIST_SUB + (HIST_MAX_EXP - HIST_SUB_BITS + 1) * HIST_SUB)
+
+typedef struct
+{
+    atomic_ulong counts[HIST_BUCKETS];
+    atomic_ulong count;
+    atomic_ulong sum;
+    atomic_ulong max;
+} Histogram;
+
+// Copia de uno o varios histogramas sumados, para calcular percentiles
+typedef struct
+{
+    uint64_t counts[HIST_BUCKETS];
+    uint64_t count;
+    uint64_t sum;
+    uint64_t max;
+} HistogramSnapshot;
+
+static inline int hist_index(uint64_t v)
+{
+    if (v < HIST_SUB)
+        return (int)v;
+    int e = 63 - __builtin_clzll(v);
+    if (e > HIST_MAX_EXP)
+        return HIST_BUCKETS - 1;
+    return HIST_SUB + (e - HIST_SUB_BITS) * HIST_SUB + (int)((v >> (e - HIST_SUB_BITS)) & (HIST_SUB - 1));
+}
+
+// Suma sin atómicos de lectura-modificación: solo válido con un único escritor
+static inline void hist_add(atomic_ulong *c, unsigned long v)
+{
+    atomic_store_explicit(c, atomic_load_explicit(c, memory_order_relaxed) + v, memory_order_relaxed);
+}
+
+// Registra v; solo desde el hilo dueño del histograma
+static inline void hist_record(Histogram *h, uint64_t v)
+{
+    hist_add(&h->counts[hist_index(v)], 1);
+    hist_add(&h->count, 1);
+    hist_add(&h->sum, (unsigned long)v);
+    if (v > atomic_load_explicit(&h->max, memory_order_relaxed))
+        atomic_store_explicit(&h->max, (unsigned long)v, memory_order_relaxed);
+}
+
+// Mayor valor que cae en el bucket i
+uint64_t hist_bucket_upper(int i);
+
+// Suma h a snap (que debe empezar en cero)
+void hist_accumulate(HistogramSnapshot *snap, const Histogram *h);
+
+// Valor por debajo del cual queda la fracción q (0-1) de las muestras; 0 si no hay muestras.
+// Es el límite superior de su bucket, acotado por el máximo visto.
+uint64_t hist_quantile(const HistogramSnapshot *snap, double q);
+
+// Muestras con valor menor a 2^e (exacto: los buckets no cruzan potencias de 2)
+uint64_t hist_count_below_pow2(const HistogramSnapshot *snap, int e);
+
+#endif // HISTOGRAM_H
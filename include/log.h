@@ -0,0 +1,70 @@
+#ifndef LOG_H
+#define LOG_H
+
+#include <stdatomic.h>
+
+// Registro asíncrono por niveles. Cada hilo escribe en su propio anillo sin bloqueos
+// (un productor, un consumidor) y un hilo de volcado los vacía hacia stdout, así que
+// el bucle de servicio nunca espera a la terminal. Si el anillo está lleno la línea se
+// descarta y se cuenta. Antes de log_start (o después de log_stop) se escribe directo.
+//
+// Compilando con -DLOG_DISABLED las macros no generan código (builds de benchmark).
+
+typedef enum
+{
+    LOG_LEVEL_DEBUG = 0,
+    LOG_LEVEL_INFO,
+    LOG_LEVEL_WARN,
+    LOG_LEVEL_ERROR,
+    LOG_LEVEL_OFF
+} LogLevel;
+
+#define LOG_LINE_MAX 240 // Bytes de texto por línea (se trunca lo que sobre)
+
+extern int log_level; // Nivel mínimo que se registra; se fija antes de arrancar los hilos
+
+// Arranca el hilo de volcado. Registra log_stop con atexit para no perder líneas al salir.
+int log_start(LogLevel level);
+
+// Vacía lo pendiente y detiene el hilo de volcado.
+void log_stop(void);
+
+// Convierte "debug", "info", "warn", "error" u "off"; devuelve fallback si no se reconoce.
+LogLevel log_level_parse(const char *name, LogLevel fallback);
+
+void log_write(LogLevel level, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+#ifdef LOG_DISABLED
+#define LOG_AT(level, ...)                 \
+    do                                     \
+    {                                      \
+        if (0)                             \
+            log_write(level, __VA_ARGS__); \
+    } while (0)
+#define LOG_SAMPLED(level, every, ...) LOG_AT(level, __VA_ARGS__)
+#else
+#define LOG_AT(level, ...)                 \
+    do                                     \
+    {                                      \
+        if ((level) >= log_level)          \
+            log_write(level, __VA_ARGS__); \
+    } while (0)
+// Registra solo una de cada `every` llamadas desde este punto del código
+#define LOG_SAMPLED(level, every, ...)                                                 \
+    do                                                                                 \
+    {                                                                                  \
+        static atomic_ulong log_sample_counter_;                                       \
+        if ((level) >= log_level &&                                                    \
+            atomic_fetch_add_explicit(&log_sample_counter_, 1, memory_order_relaxed) % \
+                    (every) ==                                                         \
+                0)                                                                     \
+            log_write(level, __VA_ARGS__);                                             \
+    } while (0)
+#endif
+
+#define LOG_DEBUG(...) LOG_AT(LOG_LEVEL_DEBUG, __VA_ARGS__)
+#define LOG_INFO(...) LOG_AT(LOG_LEVEL_INFO, __VA_ARGS__)
+#define LOG_WARN(...) LOG_AT(LOG_LEVEL_WARN, __VA_ARGS__)
+#define LOG_ERROR(...) LOG_AT(LOG_LEVEL_ERROR, __VA_ARGS__)
+
+#endif // LOG_H
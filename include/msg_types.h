@@ -0,0 +1,52 @@
+#ifndef MSG_TYPES_H
+#define MSG_TYPES_H
+
+#include <stddef.h>
+
+// Tipos de mensaje del protocolo (ver docs/protocolo.pdf), comunes al cliente y al servidor.
+// Cada lado despacha con un arreglo de manejadores indexado por MsgType.
+typedef enum
+{
+    MSG_UNKNOWN = 0,
+    // Cliente -> servidor
+    MSG_REGISTER,
+    MSG_BROADCAST, // También servidor -> cliente
+    MSG_PRIVATE,   // También servidor -> cliente
+    MSG_LIST_USERS,
+    MSG_USER_INFO,
+    MSG_CHANGE_STATUS,
+    MSG_DISCONNECT,
+    MSG_SUBSCRIBE,   // Presencia solo de los usuarios de "content" (nombres separados por comas)
+    MSG_UNSUBSCRIBE, // Sin "content" vuelve a recibir la presencia de todos
+    MSG_JOIN,        // "content": nombre de la sala
+    MSG_LEAVE,
+    MSG_ROOM_MESSAGE, // "target": sala; también servidor -> cliente
+    // Servidor -> cliente
+    MSG_REGISTER_SUCCESS,
+    MSG_LIST_USERS_RESPONSE,
+    MSG_USER_INFO_RESPONSE,
+    MSG_STATUS_UPDATE,
+    MSG_USER_DISCONNECTED,
+    MSG_SERVER,
+    MSG_ERROR,
+    MSG_BATCH, // Varios eventos en un frame, para clientes que lo pidieron al registrarse
+    MSG_LIST_USERS_DELTA, // Cambios de la lista desde la versión que mandó el cliente
+    MSG_TYPE_COUNT
+} MsgType;
+
+// Subprotocolos WebSocket. Ambos llevan los mismos mensajes: "chat-protocol" en JSON y
+// "chat-protocol-bin" en MessagePack (ver msgpack.h). El id identifica la codificación en
+// lws_protocols.id, en el cliente y en el servidor.
+#define CHAT_PROTOCOL "chat-protocol"
+#define CHAT_PROTOCOL_BIN "chat-protocol-bin"
+#define CHAT_PROTOCOL_ID_JSON 0
+#define CHAT_PROTOCOL_ID_BIN 1
+
+// Traduce el campo "type" con un hash perfecto: un cálculo, una comparación.
+// Devuelve MSG_UNKNOWN si el texto no es un tipo del protocolo.
+MsgType msg_type_lookup(const char *type, size_t len);
+
+// Nombre en el protocolo de un MsgType ("" para MSG_UNKNOWN)
+const char *msg_type_name(MsgType type);
+
+#endif // MSG_TYPES_H
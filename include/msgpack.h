@@ -0,0 +1,59 @@
+#ifndef MSGPACK_H
+#define MSGPACK_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Subconjunto de MessagePack usado por "chat-protocol-bin". Los mensajes binarios tienen
+// la misma forma que los JSON (mapas de claves de texto con cadenas, listas y mapas
+// anidados), así que ambas codificaciones se traducen entre sí sin pasar por un árbol.
+
+// Transcodifica el documento JSON json[0..len) a MessagePack en out (hasta cap bytes).
+// Devuelve los bytes escritos o -1 si el JSON es inválido, demasiado anidado o no cabe.
+// Con cap >= MSGPACK_MAX_SIZE(len) nunca falta espacio (el peor caso son números con
+// decimales, que pasan a float64); para las respuestas del chat el resultado es más corto.
+#define MSGPACK_MAX_DEPTH 32
+#define MSGPACK_MAX_SIZE(len) ((len) * 3 + 5 * (MSGPACK_MAX_DEPTH + 1))
+long json_to_msgpack(const char *json, size_t len, unsigned char *out, size_t cap);
+
+typedef enum
+{
+    MP_INVALID = 0,
+    MP_NIL,
+    MP_BOOL,
+    MP_INT,
+    MP_FLOAT,
+    MP_STR, // También bin: se tratan como cadenas
+    MP_ARRAY,
+    MP_MAP
+} MpType;
+
+// Lector secuencial sin copias sobre un buffer MessagePack
+typedef struct
+{
+    const unsigned char *p;
+    const unsigned char *end;
+} MpReader;
+
+static inline void mp_reader_init(MpReader *r, const void *buf, size_t len)
+{
+    r->p = (const unsigned char *)buf;
+    r->end = r->p + len;
+}
+
+// Tipo del siguiente valor sin consumirlo
+MpType mp_peek(const MpReader *r);
+
+// Cada lectura devuelve 0 y avanza, o -1 si el valor no es del tipo pedido o está truncado.
+int mp_read_nil(MpReader *r);
+int mp_read_bool(MpReader *r, int *value);
+int mp_read_int(MpReader *r, int64_t *value);
+int mp_read_float(MpReader *r, double *value);
+int mp_read_str(MpReader *r, const char **str, uint32_t *len);
+int mp_read_array(MpReader *r, uint32_t *count);
+int mp_read_map(MpReader *r, uint32_t *count);
+
+// Salta un valor completo (con sus hijos). -1 si está mal formado o demasiado anidado.
+int mp_skip(MpReader *r);
+
+#endif // MSGPACK_H
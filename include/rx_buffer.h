@@ -0,0 +1,38 @@
+#ifndef RX_BUFFER_H
+#define RX_BUFFER_H
+
+#include <stddef.h>
+#include <libwebsockets.h>
+
+// Reensamblado de mensajes WebSocket que lws entrega en varios pedazos (fragmentos del
+// protocolo o frames más grandes que rx_buffer_size). Un mensaje que llega entero en un
+// solo callback se entrega sin copiar; si no, los pedazos se acumulan en un bloque de un
+// pool por hilo con clases de tamaño (1K, 4K, 16K, 64K), así que las conexiones no
+// reservan memoria fija y los bloques se reutilizan. Ningún mensaje puede superar
+// RX_MAX_MESSAGE bytes.
+#define RX_MAX_MESSAGE (64 * 1024)
+
+struct RxBlock;
+
+typedef struct
+{
+    struct RxBlock *block; // NULL mientras no haya un mensaje a medias
+    size_t len;            // Bytes acumulados
+    int discarding;        // El mensaje actual superó el límite: se ignora hasta su último pedazo
+} RxBuffer;
+
+typedef enum
+{
+    RX_PARTIAL = 0,  // Falta el resto del mensaje
+    RX_COMPLETE = 1, // *msg / *msg_len tienen el mensaje entero
+    RX_TOO_LARGE = -1 // El mensaje superó RX_MAX_MESSAGE (se informa una vez por mensaje)
+} RxResult;
+
+// Agrega un pedazo recibido en LWS_CALLBACK_(CLIENT_)RECEIVE. Con RX_COMPLETE el mensaje
+// es modificable, va seguido de un '\0' cuando se copió, y vale hasta rx_buffer_release.
+RxResult rx_buffer_feed(RxBuffer *rb, struct lws *wsi, void *in, size_t len, char **msg, size_t *msg_len);
+
+// Devuelve el bloque al pool. Llamar después de procesar un mensaje y al cerrar la conexión.
+void rx_buffer_release(RxBuffer *rb);
+
+#endif // RX_BUFFER_H
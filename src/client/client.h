@@ -2,6 +2,9 @@
 #define CLIENT_H
 
 #include <libwebsockets.h>
+#include <cjson/cJSON.h>
+#include "common.h"
+#include "msg_types.h"
 
 // Estructura utilizada para almacenar los parámetros necesarios para enviar un mensaje privado.
 typedef struct
@@ -12,11 +15,20 @@ typedef struct
     char message[200]; // Contenido del mensaje
 } PrivateMessageArgs;
 
-// Obtiene el timestamp actual en formato ISO 8601 y lo guarda en el buffer.
-void get_timestamp(char *buffer, size_t size);
+// Indica si la conexión negoció "chat-protocol-bin" (mensajes en MessagePack).
+static inline int client_is_binary(struct lws *wsi)
+{
+    const struct lws_protocols *p = lws_get_protocol(wsi);
+    return p && p->id == CHAT_PROTOCOL_ID_BIN;
+}
+
+// Convierte un mensaje MessagePack recibido al mismo árbol cJSON que produciría su versión JSON.
+// Devuelve NULL si el mensaje es inválido.
+cJSON *msgpack_to_cjson(const void *buf, size_t len);
 
-// Funcion para enviar un mensaje de registro al servidor.
-int send_register_message(struct lws *wsi, const char *username);
+// Funcion para enviar un mensaje de registro al servidor. Con batch != 0 pide recibir
+// los eventos de difusión en lotes ({"type": "batch"}).
+int send_register_message(struct lws *wsi, const char *username, int batch);
 
 // Funcion para enviar un mensaje de broadcast al servidor.
 int send_broadcast_message(struct lws *wsi, const char *username, const char *message);
@@ -24,8 +36,20 @@ int send_broadcast_message(struct lws *wsi, const char *username, const char *me
 // Funcion para enviar un mensaje privado al servidor.
 int send_private_message(struct lws *wsi, const char *username, const char *target, const char *message);
 
-// Funcion para enviar un mensaje de lista de usuarios al servidor.
-int send_list_users_message(struct lws *wsi, const char *username);
+// Funcion para enviar un mensaje de lista de usuarios al servidor. version es la última
+// versión de la lista que se recibió (0 si no hay ninguna): el servidor responde solo con
+// los cambios posteriores cuando todavía los tiene.
+int send_list_users_message(struct lws *wsi, const char *username, unsigned long long version);
+
+// Funcion para seguir la presencia de algunos usuarios (names separados por comas);
+// names vacío vuelve a recibir la de todos.
+int send_subscribe_message(struct lws *wsi, const char *username, const char *names);
+
+// Funcion para unirse a una sala (join != 0) o salir de ella.
+int send_room_membership_message(struct lws *wsi, const char *username, const char *room, int join);
+
+// Funcion para enviar un mensaje a los miembros de una sala.
+int send_room_message(struct lws *wsi, const char *username, const char *room, const char *message);
 
 // Funcion para enviar un mensaje de informacion de algún usuario que este conectado en el servidor.
 int send_user_info_message(struct lws *wsi, const char *username, const char *target);
@@ -36,4 +60,9 @@ int send_change_status_message(struct lws *wsi, const char *username, const char
 // Funcion para enviar un mensaje de desconexión al servidor.
 int send_disconnect_message(struct lws *wsi, const char *username);
 
+// Modo de carga (--load): abre connections conexiones contra el servidor, registra un usuario
+// en cada una y envía rate mensajes por segundo en total durante seconds segundos, con la
+// mezcla de CHAT_LOAD_MIX. Al final imprime el throughput y la latencia de entrega.
+int run_load_generator(const char *server_addr, int port, int connections, int rate, int seconds);
+
 #endif // CLIENT_H
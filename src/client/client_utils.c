@@ -2,19 +2,11 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <time.h>
 #include <libwebsockets.h>
+#include "msgpack.h"
 
 #define MSG_BUFFER_SIZE 256 // Tamaño máximo de los mensajes a enviar
 
-// Obtiene el timestamp actual en formato ISO 8601 (ej: 2025-03-25T14:30:00)
-void get_timestamp(char *buffer, size_t size)
-{
-    time_t now = time(NULL);                        // Obtener el tiempo actual (en segundos desde Epoch)
-    struct tm *t = localtime(&now);                 // Convertir a tiempo local (estructura tm)
-    strftime(buffer, size, "%Y-%m-%dT%H:%M:%S", t); // Formatear la fecha y hora en formato ISO 8601
-}
-
 // Función interna que se encarga de enviar un string JSON al servidor vía WebSocket (wsi)
 // Recibe el WebSocket (`wsi`) y el mensaje JSON a enviar (`json_msg`).
 static int send_message(struct lws *wsi, const char *json_msg)
@@ -30,6 +22,24 @@ static int send_message(struct lws *wsi, const char *json_msg)
         return -1;
     }
 
+    // 🔹 Con "chat-protocol-bin" el mismo mensaje viaja transcodificado a MessagePack
+    if (client_is_binary(wsi))
+    {
+        unsigned char bin[LWS_PRE + MSGPACK_MAX_SIZE(MSG_BUFFER_SIZE)];
+        long bin_len = json_to_msgpack(json_msg, msg_len, &bin[LWS_PRE], sizeof(bin) - LWS_PRE);
+        if (bin_len < 0)
+        {
+            lwsl_err("Mensaje inválido, no se pudo codificar en binario\n");
+            return -1;
+        }
+        if (lws_write(wsi, &bin[LWS_PRE], (size_t)bin_len, LWS_WRITE_BINARY) < bin_len)
+        {
+            lwsl_err("Error enviando mensaje\n");
+            return -1;
+        }
+        return 0;
+    }
+
     // Inicializa el buffer y copia el mensaje a partir del offset LWS_PRE
     memset(buf, 0, sizeof(buf));
     memcpy(&buf[LWS_PRE], json_msg, msg_len);
@@ -45,16 +55,104 @@ static int send_message(struct lws *wsi, const char *json_msg)
     return 0;
 }
 
+// Crea una cadena cJSON a partir de un texto sin terminar en '\0'
+static cJSON *create_string_n(const char *s, uint32_t len)
+{
+    char *tmp = malloc((size_t)len + 1);
+    if (!tmp)
+        return NULL;
+    memcpy(tmp, s, len);
+    tmp[len] = '\0';
+    cJSON *item = cJSON_CreateString(tmp);
+    free(tmp);
+    return item;
+}
+
+static cJSON *msgpack_value_to_cjson(MpReader *r, int depth)
+{
+    if (depth > MSGPACK_MAX_DEPTH)
+        return NULL;
+
+    const char *s;
+    uint32_t n;
+    int64_t i;
+    double d;
+    int b;
+    cJSON *item = NULL;
+
+    switch (mp_peek(r))
+    {
+    case MP_NIL:
+        return mp_read_nil(r) < 0 ? NULL : cJSON_CreateNull();
+    case MP_BOOL:
+        return mp_read_bool(r, &b) < 0 ? NULL : cJSON_CreateBool(b);
+    case MP_INT:
+        return mp_read_int(r, &i) < 0 ? NULL : cJSON_CreateNumber((double)i);
+    case MP_FLOAT:
+        return mp_read_float(r, &d) < 0 ? NULL : cJSON_CreateNumber(d);
+    case MP_STR:
+        return mp_read_str(r, &s, &n) < 0 ? NULL : create_string_n(s, n);
+    case MP_ARRAY:
+        if (mp_read_array(r, &n) < 0 || !(item = cJSON_CreateArray()))
+            return NULL;
+        while (n--)
+        {
+            cJSON *child = msgpack_value_to_cjson(r, depth + 1);
+            if (!child)
+            {
+                cJSON_Delete(item);
+                return NULL;
+            }
+            cJSON_AddItemToArray(item, child);
+        }
+        return item;
+    case MP_MAP:
+        if (mp_read_map(r, &n) < 0 || !(item = cJSON_CreateObject()))
+            return NULL;
+        while (n--)
+        {
+            // Las claves se copian para terminarlas en '\0' (las del protocolo son cortas)
+            char key[64];
+            uint32_t key_len;
+            cJSON *child = NULL;
+            if (mp_read_str(r, &s, &key_len) == 0 && key_len < sizeof(key))
+            {
+                memcpy(key, s, key_len);
+                key[key_len] = '\0';
+                child = msgpack_value_to_cjson(r, depth + 1);
+            }
+            if (!child)
+            {
+                cJSON_Delete(item);
+                return NULL;
+            }
+            cJSON_AddItemToObject(item, key, child);
+        }
+        return item;
+    default:
+        return NULL;
+    }
+}
+
+cJSON *msgpack_to_cjson(const void *buf, size_t len)
+{
+    MpReader r;
+    mp_reader_init(&r, buf, len);
+    return msgpack_value_to_cjson(&r, 0);
+}
+
 // Envia mensaje de tipo "register" para registrar al usuario en el servidor
-int send_register_message(struct lws *wsi, const char *username)
+int send_register_message(struct lws *wsi, const char *username, int batch)
 {
 
     // Construye el mensaje JSON
     char msg[MSG_BUFFER_SIZE];
 
-    // Construye un JSON con el tipo "register" y el nombre de usuario.
+    // Construye un JSON con el tipo "register" y el nombre de usuario; "content": "batch"
+    // le pide al servidor los broadcasts y cambios de estado agrupados.
     snprintf(msg, sizeof(msg),
-             "{\"type\": \"register\", \"sender\": \"%s\"}",
+             batch ? "{\"type\": \"register\", \"sender\": \"%s\", \"content\": \"batch\"}"
+                   : "{\"type\": \"register\", \"sender\": \"%s\"}",
              username);
 
     // Envia el mensaje al servidor
@@ -65,8 +163,8 @@ int send_register_message(struct lws *wsi, const char *username)
 int send_broadcast_message(struct lws *wsi, const char *username, const char *message)
 {
     // Obtiene el timestamp actual
-    char timestamp[64];
-    get_timestamp(timestamp, sizeof(timestamp));
+    char timestamp[TIMESTAMP_SIZE];
+    timestamp_now(timestamp);
 
     // Se construye el mensaje JSON
     char msg[MSG_BUFFER_SIZE];
@@ -82,8 +180,8 @@ int send_broadcast_message(struct lws *wsi, const char *username, const char *me
 // Envia un mensaje privado a un destinatario en específico
 int send_private_message(struct lws *wsi, const char *username, const char *target, const char *message)
 {
-    char timestamp[64];
-    get_timestamp(timestamp, sizeof(timestamp));
+    char timestamp[TIMESTAMP_SIZE];
+    timestamp_now(timestamp);
 
     char msg[MSG_BUFFER_SIZE];
     // Construye un JSON con el tipo "private", incluyendo remitente, destinatario,
@@ -95,13 +193,55 @@ int send_private_message(struct lws *wsi, const char *username, const char *targ
 }
 
 // Solicita al servidor la lista de usuarios conectados
-int send_list_users_message(struct lws *wsi, const char *username)
+int send_list_users_message(struct lws *wsi, const char *username, unsigned long long version)
 {
     char msg[MSG_BUFFER_SIZE];
     // Envía un JSON con el tipo "list_users" y el nombre del usuario que realiza la consulta.
+    // Con una versión conocida el servidor puede responder solo con los cambios.
+    if (version)
+        snprintf(msg, sizeof(msg),
+                 "{\"type\": \"list_users\", \"sender\": \"%s\", \"content\": \"%llu\"}",
+                 username, version);
+    else
+        snprintf(msg, sizeof(msg),
+                 "{\"type\": \"list_users\", \"sender\": \"%s\"}",
+                 username);
+    return send_message(wsi, msg);
+}
+
+// Pide la presencia (status_update) solo de los usuarios de names, separados por comas.
+// Con names vacío se da de baja y vuelve a recibir la presencia de todos.
+int send_subscribe_message(struct lws *wsi, const char *username, const char *names)
+{
+    char msg[MSG_BUFFER_SIZE];
+    if (names[0])
+        snprintf(msg, sizeof(msg),
+                 "{\"type\": \"subscribe\", \"sender\": \"%s\", \"content\": \"%s\"}",
+                 username, names);
+    else
+        snprintf(msg, sizeof(msg),
+                 "{\"type\": \"unsubscribe\", \"sender\": \"%s\"}",
+                 username);
+    return send_message(wsi, msg);
+}
+
+// Se une a una sala (la crea si no existe) o sale de ella
+int send_room_membership_message(struct lws *wsi, const char *username, const char *room, int join)
+{
+    char msg[MSG_BUFFER_SIZE];
     snprintf(msg, sizeof(msg),
-             "{\"type\": \"list_users\", \"sender\": \"%s\"}",
-             username);
+             "{\"type\": \"%s\", \"sender\": \"%s\", \"content\": \"%s\"}",
+             join ? "join" : "leave", username, room);
+    return send_message(wsi, msg);
+}
+
+// Envía un mensaje a todos los miembros de una sala de la que es miembro
+int send_room_message(struct lws *wsi, const char *username, const char *room, const char *message)
+{
+    char msg[MSG_BUFFER_SIZE];
+    snprintf(msg, sizeof(msg),
+             "{\"type\": \"room_message\", \"sender\": \"%s\", \"target\": \"%s\", \"content\": \"%s\"}",
+             username, room, message);
     return send_message(wsi, msg);
 }
 
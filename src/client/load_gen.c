@@ -0,0 +1,440 @@
+#include "client.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <libwebsockets.h>
+#include "compression.h"
+#include "histogram.h"
+#include "rx_buffer.h"
+
+// 🔹 Generador de carga: N conexiones en un solo contexto de lws (un hilo), cada una con su
+// usuario, que envían una mezcla de mensajes a una tasa total fija. Los broadcast y privados
+// llevan en "content" la hora de envío ("~" + 16 dígitos hex de CLOCK_MONOTONIC en ns), así que
+// la latencia de entrega se mide al recibirlos sin estado extra. Solo tiene sentido contra un
+// servidor en la misma máquina (el reloj de ambos lados es el mismo).
+
+#define LOAD_MARK '~'
+#define LOAD_STAMP_DIGITS 16
+#define LOAD_REGISTER_TIMEOUT_MS 10000 // Espera máxima para que se registren todos
+#define LOAD_DRAIN_MS 1000             // Al terminar, tiempo para recibir lo que está en vuelo
+#define LOAD_MAX_PAYLOAD 150           // "content" debe entrar en el buffer de send_message
+
+typedef struct
+{
+    struct lws *wsi;
+    int registered;
+    int closed;
+    int pending; // Mensajes que le tocan y esperan WRITEABLE
+    RxBuffer rx;
+    char name[32];
+} LoadConn;
+
+// Mezcla de tipos: pesos relativos, configurables con CHAT_LOAD_MIX
+typedef struct
+{
+    MsgType type;
+    int weight;
+} LoadMix;
+
+static LoadMix mix[] = {
+    {MSG_BROADCAST, 20},
+    {MSG_PRIVATE, 50},
+    {MSG_LIST_USERS, 5},
+    {MSG_USER_INFO, 15},
+    {MSG_CHANGE_STATUS, 10},
+};
+#define MIX_COUNT ((int)(sizeof(mix) / sizeof(mix[0])))
+
+static LoadConn *conns;
+static int conn_count;
+static int registered_count;
+static int closed_count;
+static int payload_bytes = 32;
+static int batch_mode;
+static int measuring; // Las marcas recibidas antes de la fase de envío (p. ej. historia) no cuentan
+static volatile sig_atomic_t load_interrupted = 0;
+static uint32_t rng_state = 2463534242u;
+
+// Resultados (un solo hilo: no hace falta sincronizar)
+static Histogram *latency_ns;
+static unsigned long sent[MSG_TYPE_COUNT];
+static unsigned long send_failures;
+static unsigned long received_frames;
+static unsigned long received_errors;
+
+static void load_sigint(int sig)
+{
+    load_interrupted = 1;
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static uint32_t next_random(void)
+{
+    // xorshift32: suficiente para repartir tipos y destinatarios
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+// "tipo:peso,tipo:peso,..."; los tipos que no aparecen quedan con peso 0
+static int load_mix_parse(const char *spec)
+{
+    char copy[256];
+    snprintf(copy, sizeof(copy), "%s", spec);
+    for (int i = 0; i < MIX_COUNT; i++)
+        mix[i].weight = 0;
+
+    int total = 0;
+    char *save = NULL;
+    for (char *item = strtok_r(copy, ",", &save); item; item = strtok_r(NULL, ",", &save))
+    {
+        char *colon = strchr(item, ':');
+        if (!colon)
+            return -1;
+        MsgType type = msg_type_lookup(item, (size_t)(colon - item));
+        int weight = atoi(colon + 1);
+        int found = 0;
+        for (int i = 0; i < MIX_COUNT; i++)
+        {
+            if (mix[i].type == type)
+            {
+                mix[i].weight = weight;
+                found = 1;
+            }
+        }
+        if (!found || weight < 0)
+            return -1;
+        total += weight;
+    }
+    return total > 0 ? 0 : -1;
+}
+
+static MsgType pick_type(void)
+{
+    int total = 0;
+    for (int i = 0; i < MIX_COUNT; i++)
+        total += mix[i].weight;
+    int r = (int)(next_random() % (uint32_t)total);
+    for (int i = 0; i < MIX_COUNT; i++)
+    {
+        if (r < mix[i].weight)
+            return mix[i].type;
+        r -= mix[i].weight;
+    }
+    return mix[0].type;
+}
+
+// Otro usuario registrado cualquiera (el propio si es el único)
+static const char *pick_peer(const LoadConn *self)
+{
+    for (int tries = 0; tries < 8; tries++)
+    {
+        const LoadConn *c = &conns[next_random() % (uint32_t)conn_count];
+        if (c != self && c->registered && !c->closed)
+            return c->name;
+    }
+    return self->name;
+}
+
+static void send_one(LoadConn *c)
+{
+    char content[LOAD_MAX_PAYLOAD + 1];
+    MsgType type = pick_type();
+    int rc;
+
+    switch (type)
+    {
+    case MSG_BROADCAST:
+    case MSG_PRIVATE:
+    {
+        int n = snprintf(content, sizeof(content), "%c%016llx", LOAD_MARK, (unsigned long long)now_ns());
+        int pad = payload_bytes > n ? payload_bytes - n : 0;
+        memset(content + n, 'x', (size_t)pad);
+        content[n + pad] = '\0';
+        rc = type == MSG_BROADCAST ? send_broadcast_message(c->wsi, c->name, content)
+                                   : send_private_message(c->wsi, c->name, pick_peer(c), content);
+        break;
+    }
+    case MSG_LIST_USERS:
+        rc = send_list_users_message(c->wsi, c->name, 0);
+        break;
+    case MSG_USER_INFO:
+        rc = send_user_info_message(c->wsi, c->name, pick_peer(c));
+        break;
+    default:
+        rc = send_change_status_message(c->wsi, c->name, next_random() & 1 ? "OCUPADO" : "ACTIVO");
+        break;
+    }
+    if (rc < 0)
+        send_failures++;
+    else
+        sent[type]++;
+}
+
+static int contains(const char *hay, size_t len, const char *needle, size_t n)
+{
+    for (size_t i = 0; i + n <= len; i++)
+    {
+        if (hay[i] == needle[0] && memcmp(hay + i, needle, n) == 0)
+            return 1;
+    }
+    return 0;
+}
+
+static int hex_digit(char ch)
+{
+    if (ch >= '0' && ch <= '9')
+        return ch - '0';
+    if (ch >= 'a' && ch <= 'f')
+        return ch - 'a' + 10;
+    return -1;
+}
+
+// 🔹 Sin decodificar: las marcas de hora viajan tal cual en JSON y en MessagePack, y un lote
+// puede traer varias
+static void record_latencies(const char *msg, size_t len, uint64_t now)
+{
+    const char *end = msg + len;
+    const char *p = msg;
+    while ((p = memchr(p, LOAD_MARK, (size_t)(end - p))) != NULL)
+    {
+        p++;
+        if (end - p < LOAD_STAMP_DIGITS)
+            break;
+        uint64_t stamp = 0;
+        int i;
+        for (i = 0; i < LOAD_STAMP_DIGITS; i++)
+        {
+            int d = hex_digit(p[i]);
+            if (d < 0)
+                break;
+            stamp = stamp << 4 | (uint64_t)d;
+        }
+        if (i == LOAD_STAMP_DIGITS && stamp <= now)
+            hist_record(latency_ns, now - stamp);
+    }
+}
+
+static void on_load_message(LoadConn *c, const char *msg, size_t len)
+{
+    received_frames++;
+    int binary = client_is_binary(c->wsi);
+    if (!c->registered && contains(msg, len, "register_success", 16))
+    {
+        c->registered = 1;
+        registered_count++;
+        return;
+    }
+    // El servidor arma sus respuestas sin espacios; en MessagePack el tipo es un fixstr
+    if (binary ? contains(msg, len, "\xa5" "error", 6) : contains(msg, len, "\"type\":\"error\"", 14))
+        received_errors++;
+    if (measuring)
+        record_latencies(msg, len, now_ns());
+}
+
+static int callback_load(struct lws *wsi, enum lws_callback_reasons reason, void *user, void *in, size_t len)
+{
+    LoadConn *c = (LoadConn *)user;
+
+    switch (reason)
+    {
+    case LWS_CALLBACK_CLIENT_ESTABLISHED:
+        deflate_apply(wsi);
+        send_register_message(wsi, c->name, batch_mode);
+        break;
+    case LWS_CALLBACK_CLIENT_RECEIVE:
+    {
+        char *msg;
+        size_t msg_len;
+        if (rx_buffer_feed(&c->rx, wsi, in, len, &msg, &msg_len) != RX_COMPLETE)
+            break;
+        on_load_message(c, msg, msg_len);
+        rx_buffer_release(&c->rx);
+        break;
+    }
+    case LWS_CALLBACK_CLIENT_WRITEABLE:
+        // Un mensaje por callback, como el servidor
+        if (c->pending > 0 && !c->closed)
+        {
+            c->pending--;
+            send_one(c);
+            if (c->pending > 0)
+                lws_callback_on_writable(wsi);
+        }
+        break;
+    case LWS_CALLBACK_CLIENT_CONNECTION_ERROR:
+    case LWS_CALLBACK_CLIENT_CLOSED:
+        if (c && !c->closed)
+        {
+            c->closed = 1;
+            closed_count++;
+            if (c->registered)
+                registered_count--;
+            rx_buffer_release(&c->rx);
+        }
+        break;
+    default:
+        break;
+    }
+    return 0;
+}
+
+static struct lws_protocols load_protocols[] = {
+    {CHAT_PROTOCOL, callback_load, 0, 4096, CHAT_PROTOCOL_ID_JSON, NULL, 0},
+    {CHAT_PROTOCOL_BIN, callback_load, 0, 4096, CHAT_PROTOCOL_ID_BIN, NULL, 0},
+    {NULL, NULL, 0, 0}};
+
+static void print_report(double seconds)
+{
+    HistogramSnapshot snap = {0};
+    hist_accumulate(&snap, latency_ns);
+
+    unsigned long total = 0;
+    printf("\n===== Resultado de la carga =====\n");
+    printf("Conexiones registradas: %d de %d (%d cerradas)\n", registered_count, conn_count, closed_count);
+    printf("Duración: %.2f s\n", seconds);
+    for (int i = 0; i < MIX_COUNT; i++)
+    {
+        total += sent[mix[i].type];
+        printf("   %-14s %10lu enviados\n", msg_type_name(mix[i].type), sent[mix[i].type]);
+    }
+    printf("Enviados: %lu (%.0f msg/s), %lu fallidos\n", total, total / seconds, send_failures);
+    printf("Recibidos: %lu frames (%.0f/s), %lu errores del servidor\n", received_frames,
+           received_frames / seconds, received_errors);
+    printf("Entregas medidas: %llu (%.0f/s)\n", (unsigned long long)snap.count, snap.count / seconds);
+    if (snap.count > 0)
+    {
+        printf("Latencia de entrega (ms): p50 %.3f  p99 %.3f  p999 %.3f  máx %.3f  media %.3f\n",
+               hist_quantile(&snap, 0.50) / 1e6, hist_quantile(&snap, 0.99) / 1e6,
+               hist_quantile(&snap, 0.999) / 1e6, snap.max / 1e6, (double)snap.sum / snap.count / 1e6);
+    }
+}
+
+int run_load_generator(const char *server_addr, int port, int connections, int rate, int seconds)
+{
+    const char *spec = getenv("CHAT_LOAD_MIX");
+    if (spec && *spec && load_mix_parse(spec) < 0)
+    {
+        fprintf(stderr, "CHAT_LOAD_MIX inválido (ej.: broadcast:20,private:50,list_users:5,user_info:15,change_status:10)\n");
+        return -1;
+    }
+    payload_bytes = env_int("CHAT_LOAD_PAYLOAD", payload_bytes, 0, LOAD_MAX_PAYLOAD);
+    batch_mode = env_int("CHAT_BATCH", 0, 0, 1);
+    rng_state ^= (uint32_t)getpid();
+
+    conns = calloc((size_t)connections, sizeof(LoadConn));
+    latency_ns = calloc(1, sizeof(Histogram));
+    if (!conns || !latency_ns)
+    {
+        fprintf(stderr, "Sin memoria para %d conexiones\n", connections);
+        free(conns);
+        free(latency_ns);
+        return -1;
+    }
+    conn_count = connections;
+    signal(SIGINT, load_sigint);
+    lws_set_log_level(LLL_ERR | LLL_WARN, NULL);
+
+    struct lws_context_creation_info info;
+    memset(&info, 0, sizeof(info));
+    info.port = CONTEXT_PORT_NO_LISTEN;
+    info.protocols = load_protocols;
+    deflate_config_load();
+    info.extensions = deflate_extensions();
+    struct lws_context *context = lws_create_context(&info);
+    if (!context)
+    {
+        fprintf(stderr, "Error al crear el contexto de libwebsockets\n");
+        free(conns);
+        free(latency_ns);
+        return -1;
+    }
+
+    // Todas las conexiones comparten el contexto; LoadConn hace de datos de usuario de cada una
+    for (int i = 0; i < connections; i++)
+    {
+        LoadConn *c = &conns[i];
+        snprintf(c->name, sizeof(c->name), "carga%d-%d", (int)getpid(), i);
+
+        struct lws_client_connect_info ccinfo = {0};
+        ccinfo.context = context;
+        ccinfo.address = server_addr;
+        ccinfo.port = port;
+        ccinfo.path = "/";
+        ccinfo.host = lws_canonical_hostname(context);
+        ccinfo.origin = "origin";
+        ccinfo.protocol = CHAT_PROTOCOL_BIN "," CHAT_PROTOCOL;
+        ccinfo.ietf_version_or_minus_one = -1;
+        ccinfo.userdata = c;
+        ccinfo.pwsi = &c->wsi;
+        if (!lws_client_connect_via_info(&ccinfo))
+        {
+            c->closed = 1;
+            closed_count++;
+        }
+    }
+
+    // Fase 1: esperar los registros
+    uint64_t deadline = now_ns() + (uint64_t)LOAD_REGISTER_TIMEOUT_MS * 1000000ull;
+    while (!load_interrupted && registered_count + closed_count < connections && now_ns() < deadline)
+        lws_service(context, 10);
+    printf("Registrados %d de %d usuarios; enviando %d msg/s durante %d s\n", registered_count, connections, rate,
+           seconds);
+
+    // Fase 2: ⏱️ cada vuelta reparte entre las conexiones los mensajes que ya deberían haber
+    // salido según la tasa; así un atraso del bucle se compensa en la vuelta siguiente
+    measuring = 1;
+    uint64_t start = now_ns();
+    uint64_t end = start + (uint64_t)seconds * 1000000000ull;
+    uint64_t scheduled = 0;
+    int next = 0;
+    while (!load_interrupted && registered_count > 0)
+    {
+        uint64_t now = now_ns();
+        if (now >= end)
+            break;
+        uint64_t due = (now - start) * (uint64_t)rate / 1000000000ull;
+        for (; scheduled < due; scheduled++)
+        {
+            // Round-robin sobre las conexiones vivas
+            for (int tries = 0; tries < connections; tries++)
+            {
+                LoadConn *c = &conns[next];
+                next = (next + 1) % connections;
+                if (c->registered && !c->closed)
+                {
+                    if (c->pending++ == 0)
+                        lws_callback_on_writable(c->wsi);
+                    break;
+                }
+            }
+        }
+        lws_service(context, 1);
+    }
+    double elapsed = (double)(now_ns() - start) / 1e9;
+
+    // Fase 3: lo que ya salió todavía puede estar en camino
+    uint64_t drain_end = now_ns() + (uint64_t)LOAD_DRAIN_MS * 1000000ull;
+    for (int i = 0; i < connections; i++)
+        conns[i].pending = 0;
+    while (!load_interrupted && now_ns() < drain_end)
+        lws_service(context, 10);
+
+    print_report(elapsed > 0 ? elapsed : 1);
+    lws_context_destroy(context);
+    for (int i = 0; i < connections; i++)
+        rx_buffer_release(&conns[i].rx);
+    free(conns);
+    free(latency_ns);
+    return 0;
+}
@@ -4,9 +4,13 @@
 #include <signal.h>
 #include <time.h>
 #include <pthread.h> // Para manejar hilos
+#include <stdatomic.h>
 #include <unistd.h>  // Para `read`
 #include <libwebsockets.h>
 #include "client.h" // Incluir el header de las utilidades del cliente
+#include "msg_types.h"
+#include "compression.h"
+#include "rx_buffer.h"
 #include <cjson/cJSON.h>
 #include <pthread.h>
 
@@ -14,6 +18,15 @@
 static char *global_user_name = NULL;
 static int interrupted = 0;
 static int connection_failed = 0;
+static int registered = 0; // Ya llegó register_success: los errores dejan de ser fatales
+static DeflateStats deflate_stats; // El cliente tiene una sola conexión
+static RxBuffer rx_pending;        // Mensaje entrante a medias
+static int batch_mode = 0;         // CHAT_BATCH=1: eventos agrupados por el servidor
+
+static DeflateStats *client_deflate_stats(struct lws *wsi)
+{
+    return &deflate_stats;
+}
 
 // Esta función maneja la señal de interrupción (Ctrl+C) para salir del bucle principal.
 static void sigint_handler(int sig)
@@ -33,6 +46,276 @@ void *send_private_message_thread(void *arg)
     return NULL;
 }
 
+// 🔹 Manejadores por tipo de mensaje recibido del servidor
+typedef void (*ResponseHandler)(cJSON *json);
+
+static void on_user_info_response(cJSON *json)
+{
+    cJSON *target = cJSON_GetObjectItem(json, "target");
+    cJSON *content = cJSON_GetObjectItem(json, "content");
+    cJSON *ip = cJSON_GetObjectItem(content, "ip");
+    cJSON *status = cJSON_GetObjectItem(content, "status");
+    cJSON *timestamp = cJSON_GetObjectItem(json, "timestamp");
+
+    if (cJSON_IsString(target) && cJSON_IsString(ip) && cJSON_IsString(status) && cJSON_IsString(timestamp))
+    {
+        printf("\nInformación del usuario: %s\n", target->valuestring);
+        printf("   Estado: %s\n", status->valuestring);
+        printf("   IP: %s\n", ip->valuestring);
+        printf("   Timestamp: %s\n\n", timestamp->valuestring);
+    }
+}
+
+// 🔹 Copia local de la lista de usuarios y su versión: list_users manda la versión conocida
+// y el servidor responde solo con los cambios (list_users_delta) cuando puede.
+static char (*roster)[50] = NULL;
+static int roster_count = 0;
+static int roster_cap = 0;
+static _Atomic unsigned long long roster_version = 0; // 0 = desconocida; la lee el hilo de entrada
+
+static void roster_add(const char *username)
+{
+    for (int i = 0; i < roster_count; i++)
+        if (strcmp(roster[i], username) == 0)
+            return;
+    if (roster_count == roster_cap)
+    {
+        int cap = roster_cap ? roster_cap * 2 : 32;
+        char(*grown)[50] = realloc(roster, cap * sizeof(*roster));
+        if (!grown)
+            return;
+        roster = grown;
+        roster_cap = cap;
+    }
+    snprintf(roster[roster_count++], sizeof(roster[0]), "%s", username);
+}
+
+static void roster_remove(const char *username)
+{
+    for (int i = 0; i < roster_count; i++)
+    {
+        if (strcmp(roster[i], username) == 0)
+        {
+            memcpy(roster[i], roster[--roster_count], sizeof(roster[0]));
+            return;
+        }
+    }
+}
+
+// Reemplaza la copia local por una lista completa; sin "version" la copia queda sin versión
+static void roster_reset(cJSON *list, cJSON *version)
+{
+    roster_count = 0;
+    cJSON *user;
+    cJSON_ArrayForEach(user, list)
+    {
+        if (cJSON_IsString(user))
+            roster_add(user->valuestring);
+    }
+    roster_version = cJSON_IsNumber(version) ? (unsigned long long)version->valuedouble : 0;
+}
+
+static void print_roster(void)
+{
+    for (int i = 0; i < roster_count; i++)
+        printf("   - %s\n", roster[i]);
+}
+
+static void on_register_success(cJSON *json)
+{
+    cJSON *content = cJSON_GetObjectItem(json, "content");
+    cJSON *userList = cJSON_GetObjectItem(json, "userList");
+    cJSON *timestamp = cJSON_GetObjectItem(json, "timestamp");
+
+    if (cJSON_IsString(content) && cJSON_IsArray(userList) && cJSON_IsString(timestamp))
+    {
+        registered = 1;
+        printf("\nRegistro exitoso: %s\n", content->valuestring);
+        printf("Usuarios conectados:\n");
+        roster_reset(userList, cJSON_GetObjectItem(json, "version"));
+        print_roster();
+        printf("Timestamp: %s\n\n", timestamp->valuestring);
+    }
+}
+
+static void on_list_users_response(cJSON *json)
+{
+    cJSON *users = cJSON_GetObjectItem(json, "content");
+    cJSON *timestamp = cJSON_GetObjectItem(json, "timestamp");
+
+    if (cJSON_IsArray(users) && cJSON_IsString(timestamp))
+    {
+        printf("\nLista de usuarios conectados:\n");
+        roster_reset(users, cJSON_GetObjectItem(json, "version"));
+        print_roster();
+        printf("Timestamp: %s\n\n", timestamp->valuestring);
+    }
+}
+
+// Cambios desde la versión que se pidió, en orden; se aplican sobre la copia local
+static void on_list_users_delta(cJSON *json)
+{
+    cJSON *changes = cJSON_GetObjectItem(json, "content");
+    cJSON *since = cJSON_GetObjectItem(json, "since");
+    cJSON *version = cJSON_GetObjectItem(json, "version");
+    cJSON *timestamp = cJSON_GetObjectItem(json, "timestamp");
+
+    if (!cJSON_IsArray(changes) || !cJSON_IsNumber(since) || !cJSON_IsNumber(version) || !cJSON_IsString(timestamp))
+        return;
+    if ((unsigned long long)since->valuedouble != roster_version)
+        return; // Respuesta a un pedido viejo: la copia ya avanzó por otro camino
+
+    cJSON *change;
+    cJSON_ArrayForEach(change, changes)
+    {
+        cJSON *op = cJSON_GetObjectItem(change, "op");
+        cJSON *user = cJSON_GetObjectItem(change, "user");
+        if (!cJSON_IsString(op) || !cJSON_IsString(user))
+            continue;
+        if (strcmp(op->valuestring, "join") == 0)
+            roster_add(user->valuestring);
+        else if (strcmp(op->valuestring, "leave") == 0)
+            roster_remove(user->valuestring);
+    }
+    roster_version = (unsigned long long)version->valuedouble;
+
+    printf("\nLista de usuarios conectados (%d cambios):\n", cJSON_GetArraySize(changes));
+    print_roster();
+    printf("Timestamp: %s\n\n", timestamp->valuestring);
+}
+
+static void on_status_update(cJSON *json)
+{
+    cJSON *content = cJSON_GetObjectItem(json, "content");
+    cJSON *user = cJSON_GetObjectItem(content, "user");
+    cJSON *status = cJSON_GetObjectItem(content, "status");
+    cJSON *timestamp = cJSON_GetObjectItem(json, "timestamp");
+
+    if (cJSON_IsString(user) && cJSON_IsString(status) && cJSON_IsString(timestamp))
+    {
+        printf("\nEstado actualizado:\n");
+        printf("   Usuario: %s\n", user->valuestring);
+        printf("   Nuevo estado: %s\n", status->valuestring);
+        printf("   Timestamp: %s\n\n", timestamp->valuestring);
+    }
+}
+
+static void on_user_disconnected(cJSON *json)
+{
+    cJSON *content = cJSON_GetObjectItem(json, "content");
+    cJSON *timestamp = cJSON_GetObjectItem(json, "timestamp");
+
+    if (cJSON_IsString(content) && cJSON_IsString(timestamp))
+    {
+        printf("\nUsuario desconectado: %s\n", content->valuestring);
+        printf("Timestamp: %s\n\n", timestamp->valuestring);
+    }
+}
+
+static void on_broadcast(cJSON *json)
+{
+    cJSON *sender = cJSON_GetObjectItem(json, "sender");
+    cJSON *content = cJSON_GetObjectItem(json, "content");
+    cJSON *timestamp = cJSON_GetObjectItem(json, "timestamp");
+
+    if (cJSON_IsString(sender) && cJSON_IsString(content) && cJSON_IsString(timestamp))
+    {
+        printf("\nMensaje para todos %s: %s\n", sender->valuestring, content->valuestring);
+        printf("Timestamp: %s\n\n", timestamp->valuestring);
+    }
+}
+
+static void on_private(cJSON *json)
+{
+    cJSON *sender = cJSON_GetObjectItem(json, "sender");
+    cJSON *content = cJSON_GetObjectItem(json, "content");
+    cJSON *timestamp = cJSON_GetObjectItem(json, "timestamp");
+
+    if (cJSON_IsString(sender) && cJSON_IsString(content) && cJSON_IsString(timestamp))
+    {
+        printf("\nMensaje privado de %s: %s\n", sender->valuestring, content->valuestring);
+        printf("Timestamp: %s\n\n", timestamp->valuestring);
+    }
+}
+
+static void on_room_message(cJSON *json)
+{
+    cJSON *sender = cJSON_GetObjectItem(json, "sender");
+    cJSON *room = cJSON_GetObjectItem(json, "target");
+    cJSON *content = cJSON_GetObjectItem(json, "content");
+    cJSON *timestamp = cJSON_GetObjectItem(json, "timestamp");
+
+    if (cJSON_IsString(sender) && cJSON_IsString(room) && cJSON_IsString(content) && cJSON_IsString(timestamp))
+    {
+        printf("\n[%s] %s: %s\n", room->valuestring, sender->valuestring, content->valuestring);
+        printf("Timestamp: %s\n\n", timestamp->valuestring);
+    }
+}
+
+static void on_server(cJSON *json)
+{
+    cJSON *content = cJSON_GetObjectItem(json, "content");
+
+    if (cJSON_IsString(content))
+    {
+        printf("\nMensaje del servidor: %s\n\n", content->valuestring);
+    }
+}
+
+static void on_error(cJSON *json)
+{
+    cJSON *content = cJSON_GetObjectItem(json, "content");
+    cJSON *timestamp = cJSON_GetObjectItem(json, "timestamp");
+
+    if (cJSON_IsString(content) && cJSON_IsString(timestamp))
+    {
+        printf("\nError del servidor: %s\n", content->valuestring);
+        printf("Timestamp: %s\n\n", timestamp->valuestring);
+        // Antes del registro el error es su rechazo; después, como salir de una sala a la que
+        // no se pertenece, solo se informa y el menú sigue
+        if (!registered)
+        {
+            connection_failed = 1;
+            interrupted = 1;
+        }
+    }
+}
+
+static void on_batch(cJSON *json);
+
+// Tabla de despacho compartida con el servidor (msg_types.h); los tipos que solo envía el cliente quedan en NULL
+static const ResponseHandler response_handlers[MSG_TYPE_COUNT] = {
+    [MSG_USER_INFO_RESPONSE] = on_user_info_response,
+    [MSG_REGISTER_SUCCESS] = on_register_success,
+    [MSG_LIST_USERS_RESPONSE] = on_list_users_response,
+    [MSG_STATUS_UPDATE] = on_status_update,
+    [MSG_USER_DISCONNECTED] = on_user_disconnected,
+    [MSG_BROADCAST] = on_broadcast,
+    [MSG_PRIVATE] = on_private,
+    [MSG_ROOM_MESSAGE] = on_room_message,
+    [MSG_SERVER] = on_server,
+    [MSG_ERROR] = on_error,
+    [MSG_BATCH] = on_batch,
+    [MSG_LIST_USERS_DELTA] = on_list_users_delta,
+};
+
+// Un lote trae varios eventos completos en "content"; cada uno pasa por la misma tabla
+static void on_batch(cJSON *json)
+{
+    cJSON *content = cJSON_GetObjectItem(json, "content");
+    cJSON *event;
+
+    cJSON_ArrayForEach(event, content)
+    {
+        cJSON *type = cJSON_GetObjectItemCaseSensitive(event, "type");
+        if (!cJSON_IsString(type))
+            continue;
+        MsgType t = msg_type_lookup(type->valuestring, strlen(type->valuestring));
+        if (t != MSG_BATCH && response_handlers[t])
+            response_handlers[t](event);
+    }
+}
+
 // Callback principal para el protocolo de chat. Se invoca en diferentes eventos del ciclo de vida del WebSocket.
 static int callback_chat(struct lws *wsi, enum lws_callback_reasons reason,
                          void *user, void *in, size_t len)
@@ -43,165 +326,68 @@ static int callback_chat(struct lws *wsi, enum lws_callback_reasons reason,
     // Cuando se establece la conexión con el servidor
     case LWS_CALLBACK_CLIENT_ESTABLISHED:
         lwsl_user("Conexión establecida con el servidor WebSocket\n");
+        deflate_apply(wsi); // Antes del primer envío
 
         // Envía el mensaje de registro para identificar al usuario
-        send_register_message(wsi, global_user_name);
+        send_register_message(wsi, global_user_name, batch_mode);
         break;
 
     // Cuando se recibe un mensaje del servidor
     case LWS_CALLBACK_CLIENT_RECEIVE:
     {
-        printf("\nMensaje recibido: %s\n", (char *)in);
+        // 🔹 Con un rx buffer de 256 bytes las listas largas llegan en varios pedazos
+        char *msg;
+        size_t msg_len;
+        RxResult rx = rx_buffer_feed(&rx_pending, wsi, in, len, &msg, &msg_len);
+        if (rx == RX_TOO_LARGE)
+            printf("\nMensaje descartado: supera %d bytes\n", RX_MAX_MESSAGE);
+        if (rx != RX_COMPLETE)
+            break;
+
+        // Con "chat-protocol-bin" el mensaje llega en MessagePack y se arma el mismo árbol
+        int binary = client_is_binary(wsi);
+        cJSON *json;
+        if (binary)
+        {
+            printf("\nMensaje recibido (binario, %zu bytes)\n", msg_len);
+            json = msgpack_to_cjson(msg, msg_len);
+        }
+        else
+        {
+            printf("\nMensaje recibido: %.*s\n", (int)msg_len, msg);
 
-        // Parsea el mensaje recibido como JSON
-        cJSON *json = cJSON_Parse((char *)in);
+            // Parsea el mensaje recibido como JSON
+            json = cJSON_ParseWithLength(msg, msg_len);
+        }
         if (!json)
+        {
+            rx_buffer_release(&rx_pending);
             break;
+        }
 
         // Obtiene el campo "type" del JSON para determinar el tipo de mensaje
         cJSON *type = cJSON_GetObjectItemCaseSensitive(json, "type");
 
         if (cJSON_IsString(type))
         {
-            if (strcmp(type->valuestring, "user_info_response") == 0)
-            {
-                cJSON *target = cJSON_GetObjectItem(json, "target");
-                cJSON *content = cJSON_GetObjectItem(json, "content");
-                cJSON *ip = cJSON_GetObjectItem(content, "ip");
-                cJSON *status = cJSON_GetObjectItem(content, "status");
-                cJSON *timestamp = cJSON_GetObjectItem(json, "timestamp");
-
-                if (cJSON_IsString(target) && cJSON_IsString(ip) && cJSON_IsString(status) && cJSON_IsString(timestamp))
-                {
-                    printf("\nInformación del usuario: %s\n", target->valuestring);
-                    printf("   Estado: %s\n", status->valuestring);
-                    printf("   IP: %s\n", ip->valuestring);
-                    printf("   Timestamp: %s\n\n", timestamp->valuestring);
-                }
-            }
-            else if (strcmp(type->valuestring, "register_success") == 0)
-            {
-                cJSON *content = cJSON_GetObjectItem(json, "content");
-                cJSON *userList = cJSON_GetObjectItem(json, "userList");
-                cJSON *timestamp = cJSON_GetObjectItem(json, "timestamp");
-
-                if (cJSON_IsString(content) && cJSON_IsArray(userList) && cJSON_IsString(timestamp))
-                {
-                    printf("\nRegistro exitoso: %s\n", content->valuestring);
-                    printf("Usuarios conectados:\n");
-                    int size = cJSON_GetArraySize(userList);
-
-                    // Muestra cada usuario conectado
-                    for (int i = 0; i < size; i++)
-                    {
-                        cJSON *user = cJSON_GetArrayItem(userList, i);
-                        if (cJSON_IsString(user))
-                        {
-                            printf("   - %s\n", user->valuestring);
-                        }
-                    }
-                    printf("Timestamp: %s\n\n", timestamp->valuestring);
-                }
-            }
-            else if (strcmp(type->valuestring, "list_users_response") == 0)
-            {
-                cJSON *users = cJSON_GetObjectItem(json, "content");
-                cJSON *timestamp = cJSON_GetObjectItem(json, "timestamp");
-
-                if (cJSON_IsArray(users) && cJSON_IsString(timestamp))
-                {
-                    printf("\nLista de usuarios conectados:\n");
-                    int size = cJSON_GetArraySize(users);
-                    for (int i = 0; i < size; i++)
-                    {
-                        cJSON *user = cJSON_GetArrayItem(users, i);
-                        if (cJSON_IsString(user))
-                        {
-                            printf("   - %s\n", user->valuestring);
-                        }
-                    }
-                    printf("Timestamp: %s\n\n", timestamp->valuestring);
-                }
-            }
-            else if (strcmp(type->valuestring, "status_update") == 0)
-            {
-                cJSON *content = cJSON_GetObjectItem(json, "content");
-                cJSON *user = cJSON_GetObjectItem(content, "user");
-                cJSON *status = cJSON_GetObjectItem(content, "status");
-                cJSON *timestamp = cJSON_GetObjectItem(json, "timestamp");
-
-                if (cJSON_IsString(user) && cJSON_IsString(status) && cJSON_IsString(timestamp))
-                {
-                    printf("\nEstado actualizado:\n");
-                    printf("   Usuario: %s\n", user->valuestring);
-                    printf("   Nuevo estado: %s\n", status->valuestring);
-                    printf("   Timestamp: %s\n\n", timestamp->valuestring);
-                }
-            }
-            else if (strcmp(type->valuestring, "user_disconnected") == 0)
+            // Un hash y una llamada indirecta en lugar de una cadena de strcmp
+            ResponseHandler handler = response_handlers[msg_type_lookup(type->valuestring, strlen(type->valuestring))];
+            if (handler)
             {
-                cJSON *content = cJSON_GetObjectItem(json, "content");
-                cJSON *timestamp = cJSON_GetObjectItem(json, "timestamp");
-
-                if (cJSON_IsString(content) && cJSON_IsString(timestamp))
-                {
-                    printf("\nUsuario desconectado: %s\n", content->valuestring);
-                    printf("Timestamp: %s\n\n", timestamp->valuestring);
-                }
-            }
-            else if (strcmp(type->valuestring, "broadcast") == 0)
-            {
-                cJSON *sender = cJSON_GetObjectItem(json, "sender");
-                cJSON *content = cJSON_GetObjectItem(json, "content");
-                cJSON *timestamp = cJSON_GetObjectItem(json, "timestamp");
-
-                if (cJSON_IsString(sender) && cJSON_IsString(content) && cJSON_IsString(timestamp))
-                {
-                    printf("\nMensaje para todos %s: %s\n", sender->valuestring, content->valuestring);
-                    printf("Timestamp: %s\n\n", timestamp->valuestring);
-                }
+                handler(json);
             }
-            else if (strcmp(type->valuestring, "private") == 0)
+            else if (binary)
             {
-                cJSON *sender = cJSON_GetObjectItem(json, "sender");
-                cJSON *content = cJSON_GetObjectItem(json, "content");
-                cJSON *timestamp = cJSON_GetObjectItem(json, "timestamp");
-
-                if (cJSON_IsString(sender) && cJSON_IsString(content) && cJSON_IsString(timestamp))
-                {
-                    printf("\nMensaje privado de %s: %s\n", sender->valuestring, content->valuestring);
-                    printf("Timestamp: %s\n\n", timestamp->valuestring);
-                }
-            }
-            else if (strcmp(type->valuestring, "server") == 0)
-            {
-                cJSON *content = cJSON_GetObjectItem(json, "content");
-
-                if (cJSON_IsString(content))
-                {
-                    printf("\nMensaje del servidor: %s\n\n", content->valuestring);
-                }
-            }
-            else if (strcmp(type->valuestring, "error") == 0)
-            {
-                cJSON *content = cJSON_GetObjectItem(json, "content");
-                cJSON *timestamp = cJSON_GetObjectItem(json, "timestamp");
-
-                if (cJSON_IsString(content) && cJSON_IsString(timestamp))
-                {
-                    printf("\nError del servidor: %s\n", content->valuestring);
-                    printf("Timestamp: %s\n\n", timestamp->valuestring);
-                    connection_failed = 1;
-                    interrupted = 1;
-                }
+                printf("Mensaje recibido sin formato especial: %s\n", type->valuestring);
             }
             else
             {
-                printf("Mensaje recibido sin formato especial: %s\n", (char *)in);
+                printf("Mensaje recibido sin formato especial: %.*s\n", (int)msg_len, msg);
             }
         }
 
         cJSON_Delete(json);
+        rx_buffer_release(&rx_pending);
         break;
     }
 
@@ -211,6 +397,7 @@ static int callback_chat(struct lws *wsi, enum lws_callback_reasons reason,
     // Cuando se cierra la conexión
     case LWS_CALLBACK_CLOSED:
         lwsl_user("Conexión cerrada\n");
+        rx_buffer_release(&rx_pending);
         break;
 
     default:
@@ -220,12 +407,21 @@ static int callback_chat(struct lws *wsi, enum lws_callback_reasons reason,
 }
 
 // Definición de los protocolos que utilizará libwebsockets.
+// Ambos subprotocolos comparten el callback; el id indica la codificación negociada.
 static struct lws_protocols protocols[] = {
     {
-        "chat-protocol", // Nombre del protocolo
-        callback_chat,   // Callback para manejar los eventos del WebSocket
-        0,               // Tamaño de la estructura de usuario
-        256,             // Tamaño del buffer de recepción
+        CHAT_PROTOCOL,         // Nombre del protocolo
+        callback_chat,         // Callback para manejar los eventos del WebSocket
+        0,                     // Tamaño de la estructura de usuario
+        256,                   // Tamaño del buffer de recepción
+        CHAT_PROTOCOL_ID_JSON, // Mensajes en JSON
+    },
+    {
+        CHAT_PROTOCOL_BIN,
+        callback_chat,
+        0,
+        256,
+        CHAT_PROTOCOL_ID_BIN, // Mensajes en MessagePack
     },
     {NULL, NULL, 0, 0} // Terminador de la lista de protocolos, debe ser NULL porque libwebsockets espera un array de structs con un último elemento nulo.
 };
@@ -247,9 +443,11 @@ void *user_input_thread(void *arg)
         printf("3. Cambiar de estado\n");
         printf("4. Listar usuarios conectados\n");
         printf("5. Ver información de un usuario\n");
-        printf("6. Ayuda\n");
-        printf("7. Salir\n");
-        printf("Seleccione una opción (1-7): ");
+        printf("6. Seguir la presencia de usuarios\n");
+        printf("7. Salas (unirse, salir, escribir)\n");
+        printf("8. Ayuda\n");
+        printf("9. Salir\n");
+        printf("Seleccione una opción (1-9): ");
 
         // Leer la opción ingresada por el usuario
         if (!fgets(input, sizeof(input), stdin))
@@ -350,7 +548,7 @@ void *user_input_thread(void *arg)
         else if (strcmp(input, "4") == 0)
         {
             // Opción 4: Listar usuarios conectados
-            send_list_users_message(wsi, global_user_name);
+            send_list_users_message(wsi, global_user_name, roster_version);
         }
         else if (strcmp(input, "5") == 0)
         {
@@ -368,19 +566,74 @@ void *user_input_thread(void *arg)
         }
         else if (strcmp(input, "6") == 0)
         {
-            // Opción 6: Mostrar ayuda con la descripción de las opciones
+            // Opción 6: Recibir cambios de estado solo de algunos usuarios
+            char names[200];
+            printf("Usuarios a seguir, separados por comas (vacío = todos): ");
+            if (!fgets(names, sizeof(names), stdin))
+            {
+                perror("Error leyendo los usuarios");
+                continue;
+            }
+            names[strcspn(names, "\n")] = '\0';
+            send_subscribe_message(wsi, global_user_name, names);
+        }
+        else if (strcmp(input, "7") == 0)
+        {
+            // Opción 7: Salas con nombre
+            char action[20], room[64], message[200];
+            printf("Acción (unirse, salir, escribir): ");
+            if (!fgets(action, sizeof(action), stdin))
+            {
+                perror("Error leyendo la acción");
+                continue;
+            }
+            action[strcspn(action, "\n")] = '\0';
+
+            printf("Nombre de la sala: ");
+            if (!fgets(room, sizeof(room), stdin))
+            {
+                perror("Error leyendo la sala");
+                continue;
+            }
+            room[strcspn(room, "\n")] = '\0';
+
+            if (strcmp(action, "unirse") == 0 || strcmp(action, "salir") == 0)
+            {
+                send_room_membership_message(wsi, global_user_name, room, action[0] == 'u');
+            }
+            else if (strcmp(action, "escribir") == 0)
+            {
+                printf("Ingrese el mensaje: ");
+                if (!fgets(message, sizeof(message), stdin))
+                {
+                    perror("Error leyendo el mensaje");
+                    continue;
+                }
+                message[strcspn(message, "\n")] = '\0';
+                send_room_message(wsi, global_user_name, room, message);
+            }
+            else
+            {
+                printf("⚠ Acción no reconocida.\n");
+            }
+        }
+        else if (strcmp(input, "8") == 0)
+        {
+            // Opción 8: Mostrar ayuda con la descripción de las opciones
             printf("\n=== AYUDA ===\n");
             printf("1. Chatear con todos: Envía un mensaje público a todos los usuarios.\n");
             printf("2. Enviar mensaje privado: Especifique un usuario y envíele un mensaje directo.\n");
             printf("3. Cambiar de estado: Puede cambiar su estado a ACTIVO, OCUPADO o INACTIVO.\n");
             printf("4. Listar usuarios: Muestra los usuarios conectados al chat.\n");
             printf("5. Información de un usuario: Muestra detalles sobre un usuario específico.\n");
-            printf("6. Ayuda: Muestra esta información.\n");
-            printf("7. Salir: Desconectarse del servidor y cerrar el programa.\n");
+            printf("6. Seguir la presencia: Solo recibe los cambios de estado de los usuarios indicados.\n");
+            printf("7. Salas: Únase a una sala por nombre, salga de ella o escriba a todos sus miembros.\n");
+            printf("8. Ayuda: Muestra esta información.\n");
+            printf("9. Salir: Desconectarse del servidor y cerrar el programa.\n");
         }
-        else if (strcmp(input, "7") == 0)
+        else if (strcmp(input, "9") == 0)
         {
-            // Opción 7: Desconectarse y salir del programa
+            // Opción 9: Desconectarse y salir del programa
             send_disconnect_message(wsi, global_user_name);
             printf("Desconectando...\n");
             interrupted = 1; // Indicar que se debe salir del bucle principal
@@ -402,10 +655,26 @@ void *user_input_thread(void *arg)
 // procesa los eventos del WebSocket hasta que se interrumpe el programa.
 int main(int argc, char **argv)
 {
+    // 🔹 Modo sin interfaz para medir el servidor: --load <servidor> <puerto> [conexiones] [msg/s] [segundos]
+    if (argc >= 4 && strcmp(argv[1], "--load") == 0)
+    {
+        int connections = argc > 4 ? atoi(argv[4]) : 100;
+        int rate = argc > 5 ? atoi(argv[5]) : 1000;
+        int seconds = argc > 6 ? atoi(argv[6]) : 10;
+        if (connections < 1 || rate < 1 || seconds < 1)
+        {
+            fprintf(stderr, "Conexiones, mensajes por segundo y segundos deben ser positivos\n");
+            return -1;
+        }
+        return run_load_generator(argv[2], atoi(argv[3]), connections, rate, seconds) < 0 ? -1 : 0;
+    }
+
     // Verifica que se hayan pasado los parámetros necesarios
     if (argc < 4)
     {
         fprintf(stderr, "Uso: %s <nombre_usuario> <direccion_servidor> <puerto>\n", argv[0]);
+        fprintf(stderr, "     %s --load <direccion_servidor> <puerto> [conexiones] [mensajes_por_segundo] [segundos]\n",
+                argv[0]);
         return -1;
     }
 
@@ -423,6 +692,14 @@ int main(int argc, char **argv)
     info.protocols = protocols;                           // Asigna los protocolos definidos
     info.options |= LWS_SERVER_OPTION_DO_SSL_GLOBAL_INIT; // Inicializa SSL si es necesario
 
+    // permessage-deflate con la política de CHAT_DEFLATE_* (ver compression.h)
+    deflate_config_load();
+    deflate_set_stats_hook(client_deflate_stats);
+    info.extensions = deflate_extensions();
+
+    // Con CHAT_BATCH=1 se pide al registrarse que los eventos lleguen agrupados
+    batch_mode = env_int("CHAT_BATCH", 0, 0, 1);
+
     // Crea el contexto de libwebsockets, que maneja la conexión con el servidor
     struct lws_context *context = lws_create_context(&info);
     if (!context)
@@ -439,7 +716,7 @@ int main(int argc, char **argv)
     ccinfo.path = "/";                             // Ruta del endpoint en el servidor
     ccinfo.host = lws_canonical_hostname(context); // Nombre canónico del host
     ccinfo.origin = "origin";                      // Origen de la conexión
-    ccinfo.protocol = protocols[0].name;           // Usa el primer protocolo definido ("chat-protocol")
+    ccinfo.protocol = CHAT_PROTOCOL_BIN "," CHAT_PROTOCOL; // Prefiere binario; el servidor elige el primero que soporte
     ccinfo.ietf_version_or_minus_one = -1;         // Versión del protocolo IETF o -1 para la versión predeterminada
 
     // Establece la conexión con el servidor WebSocket
@@ -487,6 +764,12 @@ int main(int argc, char **argv)
         context = NULL;
     }
 
+    if (deflate_stats.compressed_messages > 0)
+    {
+        printf("Compresión: %llu -> %llu bytes enviados (%.1f%%)\n",
+               (unsigned long long)deflate_stats.raw_bytes, (unsigned long long)deflate_stats.wire_bytes,
+               100.0 * deflate_ratio(&deflate_stats));
+    }
     printf("Cliente desconectado. Saliendo...\n");
 
     return 0;
@@ -0,0 +1,118 @@
+#include "compression.h"
+#include "common.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+DeflateConfig deflate_config = {
+    .enabled = 1,
+    .level = 6,
+    .window_bits = 15,
+    .threshold = 128,
+};
+
+static deflate_stats_fn stats_hook = NULL;
+static deflate_totals_fn totals_hook = NULL;
+static char client_offer[96] = "permessage-deflate; client_max_window_bits";
+
+void deflate_config_load(void)
+{
+    deflate_config.enabled = env_int("CHAT_DEFLATE", deflate_config.enabled, 0, 1);
+    deflate_config.level = env_int("CHAT_DEFLATE_LEVEL", deflate_config.level, 0, 9);
+    deflate_config.window_bits = env_int("CHAT_DEFLATE_WINDOW", deflate_config.window_bits, 9, 15);
+    deflate_config.threshold = (size_t)env_int("CHAT_DEFLATE_THRESHOLD", (int)deflate_config.threshold, 0, 1 << 20);
+
+    // La ventana se negocia: el cliente se compromete a usar la suya y le pide lo mismo al servidor
+    snprintf(client_offer, sizeof(client_offer),
+             "permessage-deflate; client_max_window_bits=%d; server_max_window_bits=%d",
+             deflate_config.window_bits, deflate_config.window_bits);
+}
+
+void deflate_set_stats_hook(deflate_stats_fn fn)
+{
+    stats_hook = fn;
+}
+
+void deflate_set_totals_hook(deflate_totals_fn fn)
+{
+    totals_hook = fn;
+}
+
+// 🔹 Envoltorio de la extensión de lws. lws comprime todos los mensajes de datos de una
+// conexión que negoció permessage-deflate; para respetar el umbral, los mensajes chicos
+// no pasan por el compresor (PAYLOAD_TX) ni se marcan con RSV1 (PACKET_TX_PRESEND), que es
+// como RFC 7692 indica un mensaje sin comprimir. Ambos pasos ocurren dentro del mismo
+// lws_write, así que alcanza con recordar la decisión en el hilo.
+static int deflate_callback(struct lws_context *context, const struct lws_extension *ext, struct lws *wsi,
+                            enum lws_extension_callback_reasons reason, void *user, void *in, size_t len)
+{
+    static __thread int skipping = 0;
+
+    if (reason == LWS_EXT_CB_PAYLOAD_TX)
+    {
+        struct lws_ext_pm_deflate_rx_ebufs *pmdrx = in;
+        DeflateStats *stats = stats_hook ? stats_hook(wsi) : NULL;
+        int raw = pmdrx->eb_in.len;
+
+        // Solo mensajes completos en un frame: no se puede mezclar dentro de un mensaje fragmentado
+        int whole = (len & 0xf) != LWS_WRITE_CONTINUATION && !(len & LWS_WRITE_NO_FIN);
+        if (whole && raw > 0 && (size_t)raw < deflate_config.threshold)
+        {
+            skipping = 1;
+            if (stats)
+            {
+                stats->raw_bytes += (uint64_t)raw;
+                stats->wire_bytes += (uint64_t)raw;
+                stats->messages++;
+            }
+            if (totals_hook)
+                totals_hook((uint64_t)raw, (uint64_t)raw, 0);
+            return 0;
+        }
+
+        int n = lws_extension_callback_pm_deflate(context, ext, wsi, reason, user, in, len);
+        uint64_t wire = (uint64_t)(pmdrx->eb_out.len > 0 ? pmdrx->eb_out.len : 0);
+        if (stats && n >= 0)
+        {
+            // Un mensaje grande puede salir en varios pedazos: los siguientes llegan con eb_in vacío
+            stats->raw_bytes += (uint64_t)raw;
+            stats->wire_bytes += wire;
+            if (raw > 0)
+            {
+                stats->messages++;
+                stats->compressed_messages++;
+            }
+        }
+        if (totals_hook && n >= 0)
+            totals_hook((uint64_t)raw, wire, raw > 0);
+        return n;
+    }
+
+    if (reason == LWS_EXT_CB_PACKET_TX_PRESEND && skipping)
+    {
+        skipping = 0;
+        return 0;
+    }
+
+    return lws_extension_callback_pm_deflate(context, ext, wsi, reason, user, in, len);
+}
+
+static const struct lws_extension extensions[] = {
+    {"permessage-deflate", deflate_callback, client_offer},
+    {NULL, NULL, NULL}};
+
+const struct lws_extension *deflate_extensions(void)
+{
+    return deflate_config.enabled ? extensions : NULL;
+}
+
+void deflate_apply(struct lws *wsi)
+{
+    if (!deflate_config.enabled)
+        return;
+
+    // El compresor de lws se inicializa con el primer envío, así que el nivel aún se puede
+    // cambiar. Si la conexión no negoció la extensión lws devuelve error y no hay nada que ajustar.
+    char level[4];
+    snprintf(level, sizeof(level), "%d", deflate_config.level);
+    lws_set_extension_option(wsi, "permessage-deflate", "compression_level", level);
+}
@@ -0,0 +1,18 @@
+#include "common.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+int env_int(const char *name, int fallback, int min, int max)
+{
+    const char *value = getenv(name);
+    if (!value || !*value)
+        return fallback;
+    char *end;
+    long n = strtol(value, &end, 10);
+    if (*end != '\0' || n < min || n > max)
+    {
+        fprintf(stderr, "%s inválido (%d-%d), se usa %d\n", name, min, max, fallback);
+        return fallback;
+    }
+    return (int)n;
+}
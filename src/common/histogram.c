@@ -0,0 +1,63 @@
+#include "histogram.h"
+
+uint64_t hist_bucket_upper(int i)
+{
+    if (i < HIST_SUB)
+        return (uint64_t)i;
+    int e = (i - HIST_SUB) / HIST_SUB + HIST_SUB_BITS;
+    int sub = (i - HIST_SUB) % HIST_SUB;
+    uint64_t width = 1ull << (e - HIST_SUB_BITS);
+    return ((uint64_t)(HIST_SUB + sub) << (e - HIST_SUB_BITS)) + width - 1;
+}
+
+void hist_accumulate(HistogramSnapshot *snap, const Histogram *h)
+{
+    for (int i = 0; i < HIST_BUCKETS; i++)
+        snap->counts[i] += atomic_load_explicit(&h->counts[i], memory_order_relaxed);
+    snap->count += atomic_load_explicit(&h->count, memory_order_relaxed);
+    snap->sum += atomic_load_explicit(&h->sum, memory_order_relaxed);
+    uint64_t max = atomic_load_explicit(&h->max, memory_order_relaxed);
+    if (max > snap->max)
+        snap->max = max;
+}
+
+uint64_t hist_quantile(const HistogramSnapshot *snap, double q)
+{
+    // Los contadores se leen por separado mientras se escriben: se usa la suma de los
+    // buckets y no snap->count para que el rango buscado siempre exista
+    uint64_t total = 0;
+    for (int i = 0; i < HIST_BUCKETS; i++)
+        total += snap->counts[i];
+    if (total == 0)
+        return 0;
+
+    uint64_t rank = (uint64_t)(q * (double)total);
+    if (rank >= total)
+        rank = total - 1;
+    uint64_t seen = 0;
+    for (int i = 0; i < HIST_BUCKETS; i++)
+    {
+        seen += snap->counts[i];
+        if (seen > rank)
+        {
+            uint64_t upper = hist_bucket_upper(i);
+            return snap->max && upper > snap->max ? snap->max : upper;
+        }
+    }
+    return snap->max;
+}
+
+uint64_t hist_count_below_pow2(const HistogramSnapshot *snap, int e)
+{
+    int limit;
+    if (e > HIST_MAX_EXP)
+        limit = HIST_BUCKETS;
+    else if (e <= HIST_SUB_BITS)
+        limit = e < 0 ? 0 : 1 << e;
+    else
+        limit = hist_index(1ull << e);
+    uint64_t n = 0;
+    for (int i = 0; i < limit; i++)
+        n += snap->counts[i];
+    return n;
+}
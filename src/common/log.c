@@ -0,0 +1,260 @@
+#include "log.h"
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+
+#define LOG_RING_SIZE 512      // Líneas por hilo (potencia de 2)
+#define LOG_MAX_THREADS 64     // Anillos máximos; se reutilizan cuando un hilo termina
+#define LOG_FLUSH_INTERVAL_MS 20
+
+typedef struct
+{
+    uint64_t ns;   // CLOCK_REALTIME al registrar; ordena las líneas de distintos hilos
+    int level;
+    int len;
+    char text[LOG_LINE_MAX];
+} LogEntry;
+
+typedef struct
+{
+    _Alignas(64) atomic_size_t head; // Solo lo avanza el hilo dueño
+    _Alignas(64) atomic_size_t tail; // Solo lo avanza el hilo de volcado
+    atomic_ulong dropped;            // Líneas perdidas por anillo lleno
+    atomic_int owned;                // 1 mientras un hilo vivo lo usa
+    LogEntry entries[LOG_RING_SIZE];
+} LogRing;
+
+int log_level = LOG_LEVEL_INFO;
+
+static const char *level_names[] = {"DEBUG", "INFO", "WARN", "ERROR"};
+
+static LogRing *rings[LOG_MAX_THREADS];
+static atomic_int ring_count = 0;
+static pthread_mutex_t ring_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t ring_key;
+static pthread_once_t ring_key_once = PTHREAD_ONCE_INIT;
+static __thread LogRing *thread_ring = NULL;
+
+static atomic_int log_running = 0;
+static atomic_int log_stopping = 0;
+static pthread_t flusher;
+
+static uint64_t realtime_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+// Al terminar un hilo su anillo queda libre; lo pendiente se sigue volcando normalmente
+static void release_ring(void *ring)
+{
+    atomic_store_explicit(&((LogRing *)ring)->owned, 0, memory_order_release);
+}
+
+static void make_ring_key(void)
+{
+    pthread_key_create(&ring_key, release_ring);
+}
+
+static LogRing *acquire_ring(void)
+{
+    pthread_once(&ring_key_once, make_ring_key);
+
+    LogRing *ring = NULL;
+    pthread_mutex_lock(&ring_lock);
+    int count = atomic_load_explicit(&ring_count, memory_order_relaxed);
+    for (int i = 0; i < count && !ring; i++)
+    {
+        int expected = 0;
+        if (atomic_compare_exchange_strong(&rings[i]->owned, &expected, 1))
+            ring = rings[i];
+    }
+    if (!ring && count < LOG_MAX_THREADS)
+    {
+        ring = calloc(1, sizeof(LogRing));
+        if (ring)
+        {
+            atomic_store(&ring->owned, 1);
+            rings[count] = ring;
+            atomic_store_explicit(&ring_count, count + 1, memory_order_release);
+        }
+    }
+    pthread_mutex_unlock(&ring_lock);
+
+    if (ring)
+        pthread_setspecific(ring_key, ring);
+    return ring;
+}
+
+static void write_line(FILE *out, uint64_t ns, int level, const char *text, int len)
+{
+    // Caché del prefijo de fecha: solo lo usa un hilo a la vez (el de volcado o el llamador síncrono)
+    static __thread time_t last_sec = -1;
+    static __thread char stamp[32];
+
+    time_t sec = (time_t)(ns / 1000000000ull);
+    if (sec != last_sec)
+    {
+        struct tm t;
+        localtime_r(&sec, &t);
+        strftime(stamp, sizeof(stamp), "%Y-%m-%dT%H:%M:%S", &t);
+        last_sec = sec;
+    }
+    fprintf(out, "[%s.%03u] %-5s %.*s\n", stamp, (unsigned)(ns / 1000000ull % 1000), level_names[level], len, text);
+}
+
+void log_write(LogLevel level, const char *fmt, ...)
+{
+    if (level < LOG_LEVEL_DEBUG || level >= LOG_LEVEL_OFF)
+        return;
+
+    uint64_t ns = realtime_ns();
+    va_list ap;
+
+    if (!atomic_load_explicit(&log_running, memory_order_acquire))
+    {
+        char text[LOG_LINE_MAX];
+        va_start(ap, fmt);
+        int len = vsnprintf(text, sizeof(text), fmt, ap);
+        va_end(ap);
+        if (len < 0)
+            return;
+        write_line(stdout, ns, level, text, len < LOG_LINE_MAX ? len : LOG_LINE_MAX - 1);
+        return;
+    }
+
+    LogRing *ring = thread_ring;
+    if (!ring)
+        ring = thread_ring = acquire_ring();
+    if (!ring)
+        return; // Más hilos que anillos: se descarta
+
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    if (head - tail >= LOG_RING_SIZE)
+    {
+        atomic_fetch_add_explicit(&ring->dropped, 1, memory_order_relaxed);
+        return;
+    }
+
+    LogEntry *e = &ring->entries[head & (LOG_RING_SIZE - 1)];
+    va_start(ap, fmt);
+    int len = vsnprintf(e->text, sizeof(e->text), fmt, ap);
+    va_end(ap);
+    if (len < 0)
+        return;
+    e->len = len < LOG_LINE_MAX ? len : LOG_LINE_MAX - 1;
+    e->level = level;
+    e->ns = ns;
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+// Vuelca lo publicado hasta ahora en todos los anillos, intercalado por hora de registro.
+// Solo puede llamarla un consumidor a la vez.
+static void drain_rings(FILE *out)
+{
+    int count = atomic_load_explicit(&ring_count, memory_order_acquire);
+    size_t pos[LOG_MAX_THREADS];
+    size_t limit[LOG_MAX_THREADS];
+
+    for (int i = 0; i < count; i++)
+    {
+        pos[i] = atomic_load_explicit(&rings[i]->tail, memory_order_relaxed);
+        limit[i] = atomic_load_explicit(&rings[i]->head, memory_order_acquire);
+    }
+
+    for (;;)
+    {
+        int next = -1;
+        uint64_t next_ns = 0;
+        for (int i = 0; i < count; i++)
+        {
+            if (pos[i] == limit[i])
+                continue;
+            uint64_t ns = rings[i]->entries[pos[i] & (LOG_RING_SIZE - 1)].ns;
+            if (next < 0 || ns < next_ns)
+            {
+                next = i;
+                next_ns = ns;
+            }
+        }
+        if (next < 0)
+            break;
+
+        LogEntry *e = &rings[next]->entries[pos[next] & (LOG_RING_SIZE - 1)];
+        write_line(out, e->ns, e->level, e->text, e->len);
+        pos[next]++;
+    }
+
+    for (int i = 0; i < count; i++)
+    {
+        atomic_store_explicit(&rings[i]->tail, pos[i], memory_order_release);
+        unsigned long dropped = atomic_exchange_explicit(&rings[i]->dropped, 0, memory_order_relaxed);
+        if (dropped)
+            fprintf(out, "[log] %lu líneas descartadas (anillo %d lleno)\n", dropped, i);
+    }
+    fflush(out);
+}
+
+static void *flusher_thread(void *arg)
+{
+    (void)arg;
+    const struct timespec interval = {0, LOG_FLUSH_INTERVAL_MS * 1000000L};
+    while (!atomic_load_explicit(&log_stopping, memory_order_acquire))
+    {
+        drain_rings(stdout);
+        nanosleep(&interval, NULL);
+    }
+    drain_rings(stdout);
+    return NULL;
+}
+
+int log_start(LogLevel level)
+{
+    log_level = level;
+    if (atomic_load(&log_running))
+        return 0;
+
+    atomic_store(&log_stopping, 0);
+    if (pthread_create(&flusher, NULL, flusher_thread, NULL) != 0)
+    {
+        fprintf(stderr, "No se pudo crear el hilo de registro; se escribirá de forma síncrona\n");
+        return -1;
+    }
+    atomic_store_explicit(&log_running, 1, memory_order_release);
+
+    static int registered = 0;
+    if (!registered)
+    {
+        atexit(log_stop);
+        registered = 1;
+    }
+    return 0;
+}
+
+void log_stop(void)
+{
+    if (!atomic_exchange(&log_running, 0))
+        return;
+    atomic_store_explicit(&log_stopping, 1, memory_order_release);
+    pthread_join(flusher, NULL);
+}
+
+LogLevel log_level_parse(const char *name, LogLevel fallback)
+{
+    static const char *names[] = {"debug", "info", "warn", "error", "off"};
+    if (!name)
+        return fallback;
+    for (int i = 0; i <= LOG_LEVEL_OFF; i++)
+    {
+        if (strcasecmp(name, names[i]) == 0)
+            return (LogLevel)i;
+    }
+    return fallback;
+}
@@ -0,0 +1,90 @@
+#include "msg_types.h"
+#include <stdint.h>
+#include <string.h>
+
+// Hash perfecto sobre los tipos del protocolo: (primer byte + 2 * último byte + 15 * largo)
+// mod 64 no produce colisiones (el largo separa "user_info_response" de "unsubscribe"),
+// así que cada tipo tiene su propia celda y la búsqueda termina con un único memcmp.
+// Si se agrega un tipo hay que elegir otros coeficientes (o tamaño) que sigan sin
+// colisiones y recalcular las celdas de la tabla.
+#define MSG_HASH_SIZE 64
+#define MSG_HASH_FIRST 1
+#define MSG_HASH_LAST 2
+#define MSG_HASH_LEN 15
+
+typedef struct
+{
+    const char *name;
+    uint8_t len;
+    MsgType type;
+} MsgTypeEntry;
+
+static const MsgTypeEntry msg_type_table[MSG_HASH_SIZE] = {
+    [0] = {"status_update", 13, MSG_STATUS_UPDATE},
+    [1] = {"leave", 5, MSG_LEAVE},
+    [2] = {"join", 4, MSG_JOIN},
+    [4] = {"subscribe", 9, MSG_SUBSCRIBE},
+    [8] = {"register_success", 16, MSG_REGISTER_SUCCESS},
+    [12] = {"change_status", 13, MSG_CHANGE_STATUS},
+    [13] = {"user_info_response", 18, MSG_USER_INFO_RESPONSE},
+    [14] = {"register", 8, MSG_REGISTER},
+    [17] = {"broadcast", 9, MSG_BROADCAST},
+    [19] = {"list_users_response", 19, MSG_LIST_USERS_RESPONSE},
+    [20] = {"error", 5, MSG_ERROR},
+    [26] = {"user_info", 9, MSG_USER_INFO},
+    [30] = {"list_users_delta", 16, MSG_LIST_USERS_DELTA},
+    [34] = {"disconnect", 10, MSG_DISCONNECT},
+    [35] = {"private", 7, MSG_PRIVATE},
+    [36] = {"unsubscribe", 11, MSG_UNSUBSCRIBE},
+    [40] = {"list_users", 10, MSG_LIST_USERS},
+    [48] = {"room_message", 12, MSG_ROOM_MESSAGE},
+    [49] = {"server", 6, MSG_SERVER},
+    [60] = {"user_disconnected", 17, MSG_USER_DISCONNECTED},
+    [61] = {"batch", 5, MSG_BATCH},
+};
+
+static const char *const msg_type_names[MSG_TYPE_COUNT] = {
+    [MSG_UNKNOWN] = "",
+    [MSG_REGISTER] = "register",
+    [MSG_BROADCAST] = "broadcast",
+    [MSG_PRIVATE] = "private",
+    [MSG_LIST_USERS] = "list_users",
+    [MSG_USER_INFO] = "user_info",
+    [MSG_CHANGE_STATUS] = "change_status",
+    [MSG_DISCONNECT] = "disconnect",
+    [MSG_REGISTER_SUCCESS] = "register_success",
+    [MSG_LIST_USERS_RESPONSE] = "list_users_response",
+    [MSG_USER_INFO_RESPONSE] = "user_info_response",
+    [MSG_STATUS_UPDATE] = "status_update",
+    [MSG_USER_DISCONNECTED] = "user_disconnected",
+    [MSG_SERVER] = "server",
+    [MSG_ERROR] = "error",
+    [MSG_BATCH] = "batch",
+    [MSG_LIST_USERS_DELTA] = "list_users_delta",
+    [MSG_SUBSCRIBE] = "subscribe",
+    [MSG_UNSUBSCRIBE] = "unsubscribe",
+    [MSG_JOIN] = "join",
+    [MSG_LEAVE] = "leave",
+    [MSG_ROOM_MESSAGE] = "room_message",
+};
+
+MsgType msg_type_lookup(const char *type, size_t len)
+{
+    if (len == 0)
+        return MSG_UNKNOWN;
+
+    unsigned h = (MSG_HASH_FIRST * (unsigned char)type[0] + MSG_HASH_LAST * (unsigned char)type[len - 1] +
+                  MSG_HASH_LEN * (unsigned)len) &
+                 (MSG_HASH_SIZE - 1);
+    const MsgTypeEntry *e = &msg_type_table[h];
+    if (e->len == len && memcmp(e->name, type, len) == 0)
+        return e->type;
+    return MSG_UNKNOWN;
+}
+
+const char *msg_type_name(MsgType type)
+{
+    if ((unsigned)type >= MSG_TYPE_COUNT)
+        return "";
+    return msg_type_names[type];
+}
@@ -0,0 +1,624 @@
+#include "msgpack.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define MP_MAX_DEPTH MSGPACK_MAX_DEPTH // Anidamiento máximo aceptado al transcodificar o saltar
+
+// ---------------------------------------------------------------------------------------
+// JSON -> MessagePack
+// ---------------------------------------------------------------------------------------
+
+typedef struct
+{
+    const char *p;
+    const char *end;
+    unsigned char *out;
+    size_t len;
+    size_t cap;
+} Transcoder;
+
+static void skip_ws(Transcoder *t)
+{
+    while (t->p < t->end && (*t->p == ' ' || *t->p == '\t' || *t->p == '\n' || *t->p == '\r'))
+        t->p++;
+}
+
+static int put(Transcoder *t, const void *src, size_t n)
+{
+    if (t->cap - t->len < n)
+        return -1;
+    memcpy(t->out + t->len, src, n);
+    t->len += n;
+    return 0;
+}
+
+static int put_byte(Transcoder *t, unsigned char b)
+{
+    return put(t, &b, 1);
+}
+
+static int put_be(Transcoder *t, unsigned char tag, uint64_t v, int bytes)
+{
+    unsigned char b[9];
+    b[0] = tag;
+    for (int i = 0; i < bytes; i++)
+        b[1 + i] = (unsigned char)(v >> (8 * (bytes - 1 - i)));
+    return put(t, b, 1 + (size_t)bytes);
+}
+
+// Escribe la cabecera de un contenedor/cadena cuyo contenido ya está en out[start + 5 ..]
+// y lo corre hacia atrás para dejar la cabecera de tamaño mínimo.
+static void finish_header(Transcoder *t, size_t start, uint32_t n, unsigned char fix, uint32_t fix_max,
+                          unsigned char tag8, unsigned char tag16, unsigned char tag32)
+{
+    unsigned char hdr[5];
+    size_t h;
+    if (n <= fix_max)
+    {
+        hdr[0] = fix | (unsigned char)n;
+        h = 1;
+    }
+    else if (tag8 && n <= 0xff)
+    {
+        hdr[0] = tag8;
+        hdr[1] = (unsigned char)n;
+        h = 2;
+    }
+    else if (n <= 0xffff)
+    {
+        hdr[0] = tag16;
+        hdr[1] = (unsigned char)(n >> 8);
+        hdr[2] = (unsigned char)n;
+        h = 3;
+    }
+    else
+    {
+        hdr[0] = tag32;
+        hdr[1] = (unsigned char)(n >> 24);
+        hdr[2] = (unsigned char)(n >> 16);
+        hdr[3] = (unsigned char)(n >> 8);
+        hdr[4] = (unsigned char)n;
+        h = 5;
+    }
+    size_t body = t->len - (start + 5);
+    memmove(t->out + start + h, t->out + start + 5, body);
+    memcpy(t->out + start, hdr, h);
+    t->len = start + h + body;
+}
+
+static int reserve_header(Transcoder *t, size_t *start)
+{
+    *start = t->len;
+    if (t->cap - t->len < 5)
+        return -1;
+    t->len += 5;
+    return 0;
+}
+
+static int hex4(const char *s, uint32_t *out)
+{
+    uint32_t v = 0;
+    for (int i = 0; i < 4; i++)
+    {
+        char c = s[i];
+        v <<= 4;
+        if (c >= '0' && c <= '9')
+            v |= (uint32_t)(c - '0');
+        else if (c >= 'a' && c <= 'f')
+            v |= (uint32_t)(c - 'a' + 10);
+        else if (c >= 'A' && c <= 'F')
+            v |= (uint32_t)(c - 'A' + 10);
+        else
+            return -1;
+    }
+    *out = v;
+    return 0;
+}
+
+static int put_utf8(Transcoder *t, uint32_t cp)
+{
+    unsigned char b[4];
+    size_t n;
+    if (cp < 0x80)
+    {
+        b[0] = (unsigned char)cp;
+        n = 1;
+    }
+    else if (cp < 0x800)
+    {
+        b[0] = (unsigned char)(0xc0 | (cp >> 6));
+        b[1] = (unsigned char)(0x80 | (cp & 0x3f));
+        n = 2;
+    }
+    else if (cp < 0x10000)
+    {
+        b[0] = (unsigned char)(0xe0 | (cp >> 12));
+        b[1] = (unsigned char)(0x80 | ((cp >> 6) & 0x3f));
+        b[2] = (unsigned char)(0x80 | (cp & 0x3f));
+        n = 3;
+    }
+    else
+    {
+        b[0] = (unsigned char)(0xf0 | (cp >> 18));
+        b[1] = (unsigned char)(0x80 | ((cp >> 12) & 0x3f));
+        b[2] = (unsigned char)(0x80 | ((cp >> 6) & 0x3f));
+        b[3] = (unsigned char)(0x80 | (cp & 0x3f));
+        n = 4;
+    }
+    return put(t, b, n);
+}
+
+static int transcode_string(Transcoder *t)
+{
+    t->p++; // Comilla de apertura
+    size_t start;
+    if (reserve_header(t, &start) < 0)
+        return -1;
+
+    for (;;)
+    {
+        // Tramo sin escapes: copia directa
+        const char *run = t->p;
+        while (t->p < t->end && *t->p != '"' && *t->p != '\\')
+        {
+            if ((unsigned char)*t->p < 0x20)
+                return -1;
+            t->p++;
+        }
+        if (put(t, run, (size_t)(t->p - run)) < 0 || t->p >= t->end)
+            return -1;
+        if (*t->p == '"')
+            break;
+
+        // Secuencia de escape
+        if (t->end - t->p < 2)
+            return -1;
+        char c = t->p[1];
+        t->p += 2;
+        unsigned char b;
+        switch (c)
+        {
+        case '"':
+        case '\\':
+        case '/':
+            b = (unsigned char)c;
+            break;
+        case 'b':
+            b = '\b';
+            break;
+        case 'f':
+            b = '\f';
+            break;
+        case 'n':
+            b = '\n';
+            break;
+        case 'r':
+            b = '\r';
+            break;
+        case 't':
+            b = '\t';
+            break;
+        case 'u':
+        {
+            uint32_t cp;
+            if (t->end - t->p < 4 || hex4(t->p, &cp) < 0)
+                return -1;
+            t->p += 4;
+            if (cp >= 0xd800 && cp <= 0xdbff)
+            {
+                uint32_t lo;
+                if (t->end - t->p < 6 || t->p[0] != '\\' || t->p[1] != 'u' || hex4(t->p + 2, &lo) < 0 ||
+                    lo < 0xdc00 || lo > 0xdfff)
+                    return -1;
+                t->p += 6;
+                cp = 0x10000 + ((cp - 0xd800) << 10) + (lo - 0xdc00);
+            }
+            else if (cp >= 0xdc00 && cp <= 0xdfff)
+            {
+                return -1;
+            }
+            if (put_utf8(t, cp) < 0)
+                return -1;
+            continue;
+        }
+        default:
+            return -1;
+        }
+        if (put_byte(t, b) < 0)
+            return -1;
+    }
+    t->p++; // Comilla de cierre
+
+    size_t n = t->len - (start + 5);
+    if (n > UINT32_MAX)
+        return -1;
+    finish_header(t, start, (uint32_t)n, 0xa0, 31, 0xd9, 0xda, 0xdb);
+    return 0;
+}
+
+static int transcode_number(Transcoder *t)
+{
+    const char *s = t->p;
+    const char *q = s;
+    int is_float = 0;
+    if (q < t->end && *q == '-')
+        q++;
+    while (q < t->end && ((*q >= '0' && *q <= '9') || *q == '.' || *q == 'e' || *q == 'E' || *q == '+' || *q == '-'))
+    {
+        if (*q == '.' || *q == 'e' || *q == 'E')
+            is_float = 1;
+        q++;
+    }
+    size_t n = (size_t)(q - s);
+    if (n == 0 || n > 63)
+        return -1;
+
+    char tmp[64];
+    memcpy(tmp, s, n);
+    tmp[n] = '\0';
+    char *endp;
+    t->p = q;
+
+    if (!is_float)
+    {
+        long long v = strtoll(tmp, &endp, 10);
+        if (*endp != '\0')
+            return -1;
+        if (v >= 0 && v <= 0x7f)
+            return put_byte(t, (unsigned char)v);
+        if (v < 0 && v >= -32)
+            return put_byte(t, (unsigned char)(int8_t)v);
+        if (v >= INT32_MIN && v <= INT32_MAX)
+            return put_be(t, 0xd2, (uint64_t)(uint32_t)(int32_t)v, 4);
+        return put_be(t, 0xd3, (uint64_t)v, 8);
+    }
+
+    double d = strtod(tmp, &endp);
+    if (*endp != '\0')
+        return -1;
+    uint64_t bits;
+    memcpy(&bits, &d, sizeof(bits));
+    return put_be(t, 0xcb, bits, 8);
+}
+
+static int transcode_value(Transcoder *t, int depth);
+
+static int transcode_container(Transcoder *t, int depth, int is_map)
+{
+    if (depth >= MP_MAX_DEPTH)
+        return -1;
+    char close = is_map ? '}' : ']';
+    t->p++;
+    size_t start;
+    if (reserve_header(t, &start) < 0)
+        return -1;
+
+    uint32_t count = 0;
+    skip_ws(t);
+    if (t->p < t->end && *t->p == close)
+    {
+        t->p++;
+    }
+    else
+    {
+        for (;;)
+        {
+            skip_ws(t);
+            if (is_map)
+            {
+                if (t->p >= t->end || *t->p != '"' || transcode_string(t) < 0)
+                    return -1;
+                skip_ws(t);
+                if (t->p >= t->end || *t->p != ':')
+                    return -1;
+                t->p++;
+            }
+            if (transcode_value(t, depth + 1) < 0)
+                return -1;
+            count++;
+            skip_ws(t);
+            if (t->p >= t->end)
+                return -1;
+            if (*t->p == ',')
+            {
+                t->p++;
+                continue;
+            }
+            if (*t->p != close)
+                return -1;
+            t->p++;
+            break;
+        }
+    }
+
+    if (is_map)
+        finish_header(t, start, count, 0x80, 15, 0, 0xde, 0xdf);
+    else
+        finish_header(t, start, count, 0x90, 15, 0, 0xdc, 0xdd);
+    return 0;
+}
+
+static int match_literal(Transcoder *t, const char *lit, size_t n)
+{
+    if ((size_t)(t->end - t->p) < n || memcmp(t->p, lit, n) != 0)
+        return -1;
+    t->p += n;
+    return 0;
+}
+
+static int transcode_value(Transcoder *t, int depth)
+{
+    skip_ws(t);
+    if (t->p >= t->end)
+        return -1;
+    switch (*t->p)
+    {
+    case '{':
+        return transcode_container(t, depth, 1);
+    case '[':
+        return transcode_container(t, depth, 0);
+    case '"':
+        return transcode_string(t);
+    case 't':
+        return match_literal(t, "true", 4) < 0 ? -1 : put_byte(t, 0xc3);
+    case 'f':
+        return match_literal(t, "false", 5) < 0 ? -1 : put_byte(t, 0xc2);
+    case 'n':
+        return match_literal(t, "null", 4) < 0 ? -1 : put_byte(t, 0xc0);
+    default:
+        return transcode_number(t);
+    }
+}
+
+long json_to_msgpack(const char *json, size_t len, unsigned char *out, size_t cap)
+{
+    Transcoder t = {json, json + len, out, 0, cap};
+    if (transcode_value(&t, 0) < 0)
+        return -1;
+    return (long)t.len;
+}
+
+// ---------------------------------------------------------------------------------------
+// Lector
+// ---------------------------------------------------------------------------------------
+
+static int need(const MpReader *r, size_t n)
+{
+    return (size_t)(r->end - r->p) >= n ? 0 : -1;
+}
+
+static uint64_t be(const unsigned char *p, int bytes)
+{
+    uint64_t v = 0;
+    for (int i = 0; i < bytes; i++)
+        v = (v << 8) | p[i];
+    return v;
+}
+
+MpType mp_peek(const MpReader *r)
+{
+    if (r->p >= r->end)
+        return MP_INVALID;
+    unsigned char b = *r->p;
+    if (b <= 0x7f || b >= 0xe0)
+        return MP_INT;
+    if ((b & 0xf0) == 0x80)
+        return MP_MAP;
+    if ((b & 0xf0) == 0x90)
+        return MP_ARRAY;
+    if ((b & 0xe0) == 0xa0)
+        return MP_STR;
+    switch (b)
+    {
+    case 0xc0:
+        return MP_NIL;
+    case 0xc2:
+    case 0xc3:
+        return MP_BOOL;
+    case 0xc4:
+    case 0xc5:
+    case 0xc6:
+    case 0xd9:
+    case 0xda:
+    case 0xdb:
+        return MP_STR;
+    case 0xca:
+    case 0xcb:
+        return MP_FLOAT;
+    case 0xcc:
+    case 0xcd:
+    case 0xce:
+    case 0xcf:
+    case 0xd0:
+    case 0xd1:
+    case 0xd2:
+    case 0xd3:
+        return MP_INT;
+    case 0xdc:
+    case 0xdd:
+        return MP_ARRAY;
+    case 0xde:
+    case 0xdf:
+        return MP_MAP;
+    default:
+        return MP_INVALID; // ext y códigos reservados
+    }
+}
+
+int mp_read_nil(MpReader *r)
+{
+    if (mp_peek(r) != MP_NIL)
+        return -1;
+    r->p++;
+    return 0;
+}
+
+int mp_read_bool(MpReader *r, int *value)
+{
+    if (mp_peek(r) != MP_BOOL)
+        return -1;
+    *value = *r->p == 0xc3;
+    r->p++;
+    return 0;
+}
+
+int mp_read_int(MpReader *r, int64_t *value)
+{
+    if (mp_peek(r) != MP_INT)
+        return -1;
+    unsigned char b = *r->p;
+    if (b <= 0x7f || b >= 0xe0)
+    {
+        *value = (int8_t)b;
+        r->p++;
+        return 0;
+    }
+    static const int sizes[] = {1, 2, 4, 8};
+    int bytes = sizes[(b - 0xcc) & 3];
+    if (need(r, 1 + (size_t)bytes) < 0)
+        return -1;
+    uint64_t v = be(r->p + 1, bytes);
+    if (b >= 0xd0)
+    {
+        // Con signo: extender desde el ancho original
+        int shift = 64 - 8 * bytes;
+        *value = (int64_t)(v << shift) >> shift;
+    }
+    else
+    {
+        if (v > INT64_MAX)
+            return -1;
+        *value = (int64_t)v;
+    }
+    r->p += 1 + bytes;
+    return 0;
+}
+
+int mp_read_float(MpReader *r, double *value)
+{
+    if (mp_peek(r) != MP_FLOAT)
+        return -1;
+    if (*r->p == 0xca)
+    {
+        if (need(r, 5) < 0)
+            return -1;
+        uint32_t bits = (uint32_t)be(r->p + 1, 4);
+        float f;
+        memcpy(&f, &bits, sizeof(f));
+        *value = f;
+        r->p += 5;
+        return 0;
+    }
+    if (need(r, 9) < 0)
+        return -1;
+    uint64_t bits = be(r->p + 1, 8);
+    memcpy(value, &bits, sizeof(*value));
+    r->p += 9;
+    return 0;
+}
+
+int mp_read_str(MpReader *r, const char **str, uint32_t *len)
+{
+    if (mp_peek(r) != MP_STR)
+        return -1;
+    unsigned char b = *r->p;
+    size_t h;
+    uint32_t n;
+    if ((b & 0xe0) == 0xa0)
+    {
+        h = 1;
+        n = b & 0x1f;
+    }
+    else
+    {
+        int bytes = (b == 0xc4 || b == 0xd9) ? 1 : (b == 0xc5 || b == 0xda) ? 2
+                                                                            : 4;
+        if (need(r, 1 + (size_t)bytes) < 0)
+            return -1;
+        h = 1 + (size_t)bytes;
+        n = (uint32_t)be(r->p + 1, bytes);
+    }
+    if (need(r, h + n) < 0)
+        return -1;
+    *str = (const char *)r->p + h;
+    *len = n;
+    r->p += h + n;
+    return 0;
+}
+
+static int read_container(MpReader *r, MpType type, unsigned char fix, unsigned char tag16, uint32_t *count)
+{
+    if (mp_peek(r) != type)
+        return -1;
+    unsigned char b = *r->p;
+    if ((b & 0xf0) == fix)
+    {
+        *count = b & 0x0f;
+        r->p++;
+        return 0;
+    }
+    int bytes = b == tag16 ? 2 : 4;
+    if (need(r, 1 + (size_t)bytes) < 0)
+        return -1;
+    *count = (uint32_t)be(r->p + 1, bytes);
+    r->p += 1 + bytes;
+    // Cada elemento ocupa al menos un byte: descarta cuentas imposibles antes de iterar
+    if ((size_t)(r->end - r->p) < *count)
+        return -1;
+    return 0;
+}
+
+int mp_read_array(MpReader *r, uint32_t *count)
+{
+    return read_container(r, MP_ARRAY, 0x90, 0xdc, count);
+}
+
+int mp_read_map(MpReader *r, uint32_t *count)
+{
+    return read_container(r, MP_MAP, 0x80, 0xde, count);
+}
+
+static int skip_value(MpReader *r, int depth)
+{
+    if (depth >= MP_MAX_DEPTH)
+        return -1;
+    uint32_t n;
+    const char *s;
+    int64_t i;
+    double d;
+    int b;
+    switch (mp_peek(r))
+    {
+    case MP_NIL:
+        return mp_read_nil(r);
+    case MP_BOOL:
+        return mp_read_bool(r, &b);
+    case MP_INT:
+        return mp_read_int(r, &i);
+    case MP_FLOAT:
+        return mp_read_float(r, &d);
+    case MP_STR:
+        return mp_read_str(r, &s, &n);
+    case MP_ARRAY:
+        if (mp_read_array(r, &n) < 0)
+            return -1;
+        while (n--)
+            if (skip_value(r, depth + 1) < 0)
+                return -1;
+        return 0;
+    case MP_MAP:
+        if (mp_read_map(r, &n) < 0)
+            return -1;
+        while (n--)
+            if (skip_value(r, depth + 1) < 0 || skip_value(r, depth + 1) < 0)
+                return -1;
+        return 0;
+    default:
+        return -1;
+    }
+}
+
+int mp_skip(MpReader *r)
+{
+    return skip_value(r, 0);
+}
@@ -0,0 +1,114 @@
+#include "rx_buffer.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define RX_CLASSES 4
+#define RX_CACHED_PER_CLASS 32 // Bloques libres que guarda cada hilo por clase
+
+static const size_t class_size[RX_CLASSES] = {1024, 4 * 1024, 16 * 1024, RX_MAX_MESSAGE};
+
+typedef struct RxBlock
+{
+    struct RxBlock *next; // Enlace en la lista libre
+    int cls;
+    unsigned char data[]; // class_size[cls] + 1 (para el '\0')
+} RxBlock;
+
+// 🔹 Pool por hilo: cada conexión recibe siempre en el mismo hilo de servicio, así que
+// pedir y devolver bloques no necesita locks.
+static __thread RxBlock *free_blocks[RX_CLASSES];
+static __thread int free_count[RX_CLASSES];
+
+static RxBlock *block_get(size_t need)
+{
+    int cls = 0;
+    while (cls < RX_CLASSES && class_size[cls] < need)
+        cls++;
+    if (cls == RX_CLASSES)
+        return NULL;
+
+    RxBlock *b = free_blocks[cls];
+    if (b)
+    {
+        free_blocks[cls] = b->next;
+        free_count[cls]--;
+        return b;
+    }
+    b = malloc(sizeof(RxBlock) + class_size[cls] + 1);
+    if (b)
+        b->cls = cls;
+    return b;
+}
+
+static void block_put(RxBlock *b)
+{
+    if (free_count[b->cls] >= RX_CACHED_PER_CLASS)
+    {
+        free(b);
+        return;
+    }
+    b->next = free_blocks[b->cls];
+    free_blocks[b->cls] = b;
+    free_count[b->cls]++;
+}
+
+// Asegura espacio para need bytes; si hace falta pasa el contenido a un bloque de otra clase
+static int reserve(RxBuffer *rb, size_t need)
+{
+    if (rb->block && class_size[rb->block->cls] >= need)
+        return 0;
+    RxBlock *b = block_get(need);
+    if (!b)
+        return -1;
+    if (rb->block)
+    {
+        memcpy(b->data, rb->block->data, rb->len);
+        block_put(rb->block);
+    }
+    rb->block = b;
+    return 0;
+}
+
+RxResult rx_buffer_feed(RxBuffer *rb, struct lws *wsi, void *in, size_t len, char **msg, size_t *msg_len)
+{
+    int last = lws_is_final_fragment(wsi) && lws_remaining_packet_payload(wsi) == 0;
+
+    if (rb->discarding)
+    {
+        if (last)
+            rb->discarding = 0;
+        return RX_PARTIAL;
+    }
+
+    // Camino habitual: el mensaje entero llegó en este callback, se usa el buffer de lws
+    if (last && !rb->block)
+    {
+        *msg = (char *)in;
+        *msg_len = len;
+        return RX_COMPLETE;
+    }
+
+    if (rb->len + len > RX_MAX_MESSAGE || reserve(rb, rb->len + len) < 0)
+    {
+        rx_buffer_release(rb);
+        rb->discarding = !last;
+        return RX_TOO_LARGE;
+    }
+    memcpy(rb->block->data + rb->len, in, len);
+    rb->len += len;
+    if (!last)
+        return RX_PARTIAL;
+
+    rb->block->data[rb->len] = '\0';
+    *msg = (char *)rb->block->data;
+    *msg_len = rb->len;
+    return RX_COMPLETE;
+}
+
+void rx_buffer_release(RxBuffer *rb)
+{
+    if (rb->block)
+        block_put(rb->block);
+    rb->block = NULL;
+    rb->len = 0;
+}
@@ -0,0 +1,74 @@
+#include "common.h"
+#include <stdatomic.h>
+#include <string.h>
+#include <time.h>
+
+// ⏱️ Caché del timestamp ISO 8601 del segundo en curso.
+// Hay TS_SLOTS ranuras; quien detecta el cambio de segundo renderiza la siguiente y la publica
+// con un puntero atómico. Cada ranura funciona como un seqlock: `second` vale -1 mientras se
+// escribe, y el lector vuelve a comprobarlo después de copiar. Al rotar entre varias ranuras
+// la que se sobrescribe casi nunca es la que alguien está leyendo.
+#define TS_SLOTS 4
+
+typedef struct
+{
+    _Atomic long long second; // Segundo (epoch) que representa el texto, -1 mientras se reescribe
+    char text[TIMESTAMP_SIZE];
+} TimestampSlot;
+
+static TimestampSlot ts_slots[TS_SLOTS];
+static _Atomic(TimestampSlot *) ts_current = NULL;
+static atomic_flag ts_refreshing = ATOMIC_FLAG_INIT;
+static unsigned ts_next = 0; // Solo lo toca quien tiene ts_refreshing
+
+static void format_second(time_t sec, char *out)
+{
+    struct tm t;
+    localtime_r(&sec, &t);
+    strftime(out, TIMESTAMP_SIZE, "%Y-%m-%dT%H:%M:%S", &t);
+}
+
+void timestamp_now(char *buf)
+{
+    time_t now = time(NULL);
+
+    TimestampSlot *slot = atomic_load_explicit(&ts_current, memory_order_acquire);
+    if (slot && atomic_load_explicit(&slot->second, memory_order_acquire) == (long long)now)
+    {
+        memcpy(buf, slot->text, TIMESTAMP_SIZE);
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&slot->second, memory_order_relaxed) == (long long)now)
+            return;
+    }
+
+    // 🔹 Cambio de segundo: un solo hilo renderiza la caché; los demás formatean por su cuenta
+    if (atomic_flag_test_and_set_explicit(&ts_refreshing, memory_order_acquire))
+    {
+        format_second(now, buf);
+        return;
+    }
+
+    TimestampSlot *next = &ts_slots[ts_next++ % TS_SLOTS];
+    atomic_store_explicit(&next->second, -1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    format_second(now, next->text);
+    atomic_store_explicit(&next->second, (long long)now, memory_order_release);
+    atomic_store_explicit(&ts_current, next, memory_order_release);
+    atomic_flag_clear_explicit(&ts_refreshing, memory_order_release);
+
+    memcpy(buf, next->text, TIMESTAMP_SIZE);
+}
+
+uint64_t monotonic_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+uint64_t realtime_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
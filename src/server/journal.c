@@ -0,0 +1,589 @@
+#define _GNU_SOURCE
+#include "journal.h"
+#include "common.h"
+#include "log.h"
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define JOURNAL_SEGMENT_MB 16
+#define JOURNAL_SEGMENTS 8
+#define JOURNAL_REPLAY 50
+
+// Cabecera de cada registro en el segmento, seguida de sender, target y payload.
+// size es múltiplo de 8 e incluye el relleno; size == 0 marca el final de lo escrito
+// (el resto del archivo está en cero). check es FNV-1a de todo lo que sigue al propio campo.
+typedef struct
+{
+    uint32_t size;
+    uint32_t check;
+    uint64_t seq;
+    uint64_t time_ms;
+    uint8_t kind;
+    uint8_t sender_len;
+    uint8_t target_len;
+    uint8_t reserved;
+    uint32_t payload_len;
+} RecordHeader;
+
+#define RECORD_CHECKED_FROM offsetof(RecordHeader, seq)
+
+// Entrada del índice disperso: con la hora y la secuencia ubica el offset desde donde leer
+typedef struct
+{
+    uint64_t time_ms;
+    uint32_t seq_delta; // seq - first_seq del segmento
+    uint32_t offset;
+} IndexEntry;
+
+typedef struct
+{
+    int fd;
+    unsigned char *map;
+    size_t size;        // Tamaño del archivo mapeado
+    size_t used;        // Bytes con registros válidos
+    uint64_t first_seq; // Del nombre del archivo
+    uint64_t last_seq;  // 0 si está vacío
+    uint64_t last_ms;
+    size_t synced;      // Hasta dónde llegó el último msync
+    IndexEntry *index;
+    int index_count;
+    int index_cap;
+} Segment;
+
+// Mensaje esperando al escritor
+typedef struct Pending
+{
+    struct Pending *next;
+    uint64_t seq;
+    uint64_t time_ms;
+    uint8_t kind;
+    uint8_t sender_len;
+    uint8_t target_len;
+    uint32_t payload_len;
+    char data[]; // sender + target + payload
+} Pending;
+
+JournalConfig journal_config = {0, "journal", (size_t)JOURNAL_SEGMENT_MB << 20, JOURNAL_SEGMENTS, JOURNAL_REPLAY};
+
+// Segmentos del más viejo al más nuevo; se escribe siempre en el último.
+// Los cambia solo el escritor con segments_lock para escritura; la relectura lo toma para lectura.
+static Segment segments[JOURNAL_MAX_SEGMENTS_LIMIT];
+static int segment_count = 0;
+static pthread_rwlock_t segments_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+// Segmentos que una rotación sacó de la lista: el escritor los desmapea y borra después de
+// soltar segments_lock. Solo los toca el escritor.
+static Segment retired[JOURNAL_MAX_SEGMENTS_LIMIT];
+static int retired_count = 0;
+
+static pthread_mutex_t pending_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pending_cond = PTHREAD_COND_INITIALIZER;
+static Pending *pending_head = NULL;
+static Pending *pending_tail = NULL;
+static int pending_count = 0;
+static uint64_t next_seq = 1;
+static atomic_ulong journal_dropped = 0;
+
+static _Atomic uint64_t committed_seq = 0; // Último registro que llegó a disco
+static atomic_int journal_running = 0;
+static int journal_stopping = 0;
+static pthread_t writer;
+
+static size_t record_size(size_t body)
+{
+    return (sizeof(RecordHeader) + body + 7) & ~(size_t)7;
+}
+
+void journal_config_load(void)
+{
+    journal_config.enabled = env_int("CHAT_JOURNAL", 0, 0, 1);
+    const char *dir = getenv("CHAT_JOURNAL_DIR");
+    if (dir && *dir)
+        snprintf(journal_config.dir, sizeof(journal_config.dir), "%s", dir);
+    journal_config.segment_size = (size_t)env_int("CHAT_JOURNAL_SEGMENT_MB", JOURNAL_SEGMENT_MB, 1, 1024) << 20;
+    journal_config.max_segments = env_int("CHAT_JOURNAL_SEGMENTS", JOURNAL_SEGMENTS, 2, JOURNAL_MAX_SEGMENTS_LIMIT);
+    journal_config.replay = env_int("CHAT_JOURNAL_REPLAY", JOURNAL_REPLAY, 0, 1000);
+}
+
+static void segment_path(char *buf, size_t size, uint64_t first_seq)
+{
+    snprintf(buf, size, "%s/%016" PRIx64 ".seg", journal_config.dir, first_seq);
+}
+
+static void index_add(Segment *s, const RecordHeader *h, size_t offset)
+{
+    if ((h->seq - s->first_seq) % JOURNAL_INDEX_STRIDE != 0 && s->index_count > 0)
+        return;
+    if (s->index_count == s->index_cap)
+    {
+        int cap = s->index_cap ? s->index_cap * 2 : 64;
+        IndexEntry *grown = realloc(s->index, (size_t)cap * sizeof(IndexEntry));
+        if (!grown)
+            return; // Sin la entrada solo se lee un poco más al buscar
+        s->index = grown;
+        s->index_cap = cap;
+    }
+    s->index[s->index_count++] = (IndexEntry){h->time_ms, (uint32_t)(h->seq - s->first_seq), (uint32_t)offset};
+}
+
+static void segment_unmap(Segment *s)
+{
+    if (s->map)
+        munmap(s->map, s->size);
+    if (s->fd >= 0)
+        close(s->fd);
+    free(s->index);
+    memset(s, 0, sizeof(*s));
+    s->fd = -1;
+}
+
+// Valida los registros de un segmento existente y deja used al final del último completo
+static void segment_recover(Segment *s, uint64_t after_seq)
+{
+    size_t off = 0;
+    uint64_t prev = after_seq;
+    while (off + sizeof(RecordHeader) <= s->size)
+    {
+        const RecordHeader *h = (const RecordHeader *)(s->map + off);
+        if (h->size == 0)
+            break;
+        if (h->size % 8 != 0 || h->size < sizeof(RecordHeader) || h->size > s->size - off ||
+            record_size((size_t)h->sender_len + h->target_len + h->payload_len) != h->size ||
+            h->seq <= prev || h->seq < s->first_seq ||
+            fnv1a(s->map + off + RECORD_CHECKED_FROM, h->size - RECORD_CHECKED_FROM) != h->check)
+        {
+            // Escritura cortada por una caída: se descarta desde acá y se limpia para no
+            // confundirla con datos válidos en la próxima recuperación
+            LOG_WARN("Diario: segmento %016" PRIx64 " truncado en el byte %zu", s->first_seq, off);
+            memset(s->map + off, 0, s->size - off);
+            break;
+        }
+        index_add(s, h, off);
+        prev = s->last_seq = h->seq;
+        s->last_ms = h->time_ms;
+        off += h->size;
+    }
+    s->used = s->synced = off;
+}
+
+static int segment_map(Segment *s, const char *path, size_t size, int create)
+{
+    s->fd = open(path, O_RDWR | (create ? O_CREAT | O_TRUNC : 0), 0644);
+    if (s->fd < 0)
+        return -1;
+    if (create)
+    {
+        // Se reserva el espacio de entrada: escribir en un mapeo sin bloques detrás termina en SIGBUS
+        int err = posix_fallocate(s->fd, 0, (off_t)size);
+        if (err != 0)
+        {
+            errno = err;
+            return -1;
+        }
+    }
+    s->size = size;
+    s->map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, s->fd, 0);
+    if (s->map == MAP_FAILED)
+    {
+        s->map = NULL;
+        return -1;
+    }
+    madvise(s->map, size, MADV_SEQUENTIAL);
+    return 0;
+}
+
+// Desmapea un segmento que ya no está en la lista y borra su archivo
+static void segment_discard(Segment *s)
+{
+    char path[sizeof(journal_config.dir) + 32];
+    segment_path(path, sizeof(path), s->first_seq);
+    segment_unmap(s);
+    unlink(path);
+}
+
+// Abre un segmento nuevo que empieza en first_seq y descarta los que exceden max_segments.
+// Con segments_lock tomado para escritura.
+static int segment_rotate(uint64_t first_seq)
+{
+    char path[sizeof(journal_config.dir) + 32];
+    segment_path(path, sizeof(path), first_seq);
+
+    Segment fresh = {.fd = -1, .first_seq = first_seq};
+    if (segment_map(&fresh, path, journal_config.segment_size, 1) < 0)
+    {
+        LOG_ERROR("Diario: no se pudo crear %s: %s", path, strerror(errno));
+        segment_unmap(&fresh);
+        unlink(path);
+        return -1;
+    }
+
+    while (segment_count >= journal_config.max_segments)
+    {
+        if (retired_count < JOURNAL_MAX_SEGMENTS_LIMIT)
+            retired[retired_count++] = segments[0];
+        else
+            segment_discard(&segments[0]); // Una tanda enorme que rotó muchas veces
+        memmove(&segments[0], &segments[1], (size_t)(segment_count - 1) * sizeof(Segment));
+        segment_count--;
+    }
+    segments[segment_count++] = fresh;
+    return 0;
+}
+
+static int compare_seq(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+// Mapea los segmentos que quedaron de ejecuciones anteriores y devuelve la próxima secuencia
+static uint64_t journal_recover(void)
+{
+    DIR *d = opendir(journal_config.dir);
+    if (!d)
+        return 1;
+
+    uint64_t found[256];
+    int count = 0;
+    struct dirent *e;
+    while ((e = readdir(d)) != NULL && count < (int)(sizeof(found) / sizeof(found[0])))
+    {
+        char *end;
+        unsigned long long first = strtoull(e->d_name, &end, 16);
+        if (end != e->d_name && strcmp(end, ".seg") == 0 && first > 0)
+            found[count++] = first;
+    }
+    closedir(d);
+    qsort(found, (size_t)count, sizeof(found[0]), compare_seq);
+
+    uint64_t last = 0;
+    char path[sizeof(journal_config.dir) + 32];
+    for (int i = 0; i < count; i++)
+    {
+        segment_path(path, sizeof(path), found[i]);
+        if (i < count - journal_config.max_segments)
+        {
+            unlink(path); // Bajó CHAT_JOURNAL_SEGMENTS desde la ejecución anterior
+            continue;
+        }
+
+        struct stat st;
+        Segment s = {.fd = -1, .first_seq = found[i]};
+        if (stat(path, &st) < 0 || st.st_size < (off_t)sizeof(RecordHeader) ||
+            segment_map(&s, path, (size_t)st.st_size, 0) < 0)
+        {
+            LOG_WARN("Diario: se ignora el segmento %s", path);
+            segment_unmap(&s);
+            continue;
+        }
+        segment_recover(&s, last);
+        if (s.last_seq)
+            last = s.last_seq;
+        segments[segment_count++] = s;
+    }
+
+    if (segment_count > 0)
+        LOG_INFO("Diario: %d segmentos recuperados, último mensaje %" PRIu64, segment_count, last);
+    return last + 1;
+}
+
+// Copia un mensaje al segmento actual (rotando si no entra); con segments_lock para escritura
+static int segment_append(const Pending *p)
+{
+    size_t body = (size_t)p->sender_len + p->target_len + p->payload_len;
+    size_t size = record_size(body);
+    if (size > journal_config.segment_size)
+        return -1;
+
+    Segment *s = segment_count ? &segments[segment_count - 1] : NULL;
+    if (!s || s->used + size > s->size)
+    {
+        if (segment_rotate(p->seq) < 0)
+            return -1;
+        s = &segments[segment_count - 1];
+    }
+
+    unsigned char *dst = s->map + s->used;
+    RecordHeader h = {0};
+    h.size = (uint32_t)size;
+    h.seq = p->seq;
+    h.time_ms = p->time_ms;
+    h.kind = p->kind;
+    h.sender_len = p->sender_len;
+    h.target_len = p->target_len;
+    h.payload_len = p->payload_len;
+    memcpy(dst, &h, sizeof(h));
+    memcpy(dst + sizeof(h), p->data, body);
+    memset(dst + sizeof(h) + body, 0, size - sizeof(h) - body);
+    ((RecordHeader *)dst)->check = fnv1a(dst + RECORD_CHECKED_FROM, size - RECORD_CHECKED_FROM);
+
+    index_add(s, &h, s->used);
+    s->used += size;
+    s->last_seq = p->seq;
+    s->last_ms = p->time_ms;
+    return 0;
+}
+
+// Rango de un segmento por llevar a disco: se anota con segments_lock y el msync se hace sin él
+typedef struct
+{
+    unsigned char *map;
+    size_t from;
+    size_t len;
+} SyncRange;
+
+// Anota lo escrito desde el último msync, alineado a página. 0 si no hay nada pendiente.
+static int segment_pending_sync(Segment *s, SyncRange *r)
+{
+    if (s->used == s->synced)
+        return 0;
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    r->map = s->map;
+    r->from = s->synced & ~(page - 1);
+    r->len = s->used - r->from;
+    s->synced = s->used;
+    return 1;
+}
+
+// 🔹 Group commit: toma todo lo encolado desde la última vuelta, lo copia a los segmentos y
+// lo confirma con un msync por segmento tocado, sin importar cuántos mensajes sean. El lock
+// de escritura cubre solo la copia y la rotación: la relectura de un registro no espera al disco.
+static void *writer_thread(void *arg)
+{
+    (void)arg;
+    SyncRange ranges[JOURNAL_MAX_SEGMENTS_LIMIT];
+    for (;;)
+    {
+        pthread_mutex_lock(&pending_lock);
+        while (!pending_head && !journal_stopping)
+            pthread_cond_wait(&pending_cond, &pending_lock);
+        Pending *batch = pending_head;
+        int stopping = journal_stopping;
+        pending_head = pending_tail = NULL;
+        pending_count = 0;
+        pthread_mutex_unlock(&pending_lock);
+
+        if (!batch && stopping)
+            break;
+
+        uint64_t last = 0;
+        int range_count = 0;
+        pthread_rwlock_wrlock(&segments_lock);
+        for (Pending *p = batch; p; p = p->next)
+        {
+            if (segment_append(p) == 0)
+                last = p->seq;
+            else
+                atomic_fetch_add_explicit(&journal_dropped, 1, memory_order_relaxed);
+        }
+        // Si la tanda rotó, el segmento anterior también quedó con una cola sin sincronizar
+        for (int i = 0; i < segment_count; i++)
+            range_count += segment_pending_sync(&segments[i], &ranges[range_count]);
+        pthread_rwlock_unlock(&segments_lock);
+
+        // Los mapeos siguen vivos: solo este hilo desmapea, y los retirados recién después
+        for (int i = 0; i < range_count; i++)
+        {
+            if (msync(ranges[i].map + ranges[i].from, ranges[i].len, MS_SYNC) < 0)
+                LOG_WARN("Diario: msync falló: %s", strerror(errno));
+        }
+        for (int i = 0; i < retired_count; i++)
+            segment_discard(&retired[i]);
+        retired_count = 0;
+
+        if (last)
+            atomic_store_explicit(&committed_seq, last, memory_order_release);
+
+        while (batch)
+        {
+            Pending *next = batch->next;
+            free(batch);
+            batch = next;
+        }
+
+        unsigned long dropped = atomic_exchange_explicit(&journal_dropped, 0, memory_order_relaxed);
+        if (dropped)
+            LOG_WARN("Diario: %lu mensajes sin guardar", dropped);
+    }
+    return NULL;
+}
+
+int journal_open(void)
+{
+    if (!journal_config.enabled || atomic_load(&journal_running))
+        return 0;
+
+    if (mkdir(journal_config.dir, 0755) < 0 && errno != EEXIST)
+    {
+        LOG_ERROR("Diario: no se pudo crear %s: %s", journal_config.dir, strerror(errno));
+        return -1;
+    }
+
+    uint64_t start = journal_recover();
+    atomic_store(&committed_seq, start - 1);
+    next_seq = start;
+
+    journal_stopping = 0;
+    if (pthread_create(&writer, NULL, writer_thread, NULL) != 0)
+    {
+        LOG_ERROR("Diario: no se pudo crear el hilo escritor");
+        return -1;
+    }
+    atomic_store_explicit(&journal_running, 1, memory_order_release);
+
+    static int registered = 0;
+    if (!registered)
+    {
+        atexit(journal_close);
+        registered = 1;
+    }
+    LOG_INFO("Diario en %s: %d segmentos de %zu MB, %d mensajes al registrarse", journal_config.dir,
+             journal_config.max_segments, journal_config.segment_size >> 20, journal_config.replay);
+    return 0;
+}
+
+void journal_close(void)
+{
+    if (!atomic_exchange(&journal_running, 0))
+        return;
+    pthread_mutex_lock(&pending_lock);
+    journal_stopping = 1;
+    pthread_cond_signal(&pending_cond);
+    pthread_mutex_unlock(&pending_lock);
+    pthread_join(writer, NULL);
+
+    pthread_rwlock_wrlock(&segments_lock);
+    for (int i = 0; i < segment_count; i++)
+        segment_unmap(&segments[i]);
+    segment_count = 0;
+    pthread_rwlock_unlock(&segments_lock);
+}
+
+uint64_t journal_append(JournalKind kind, const char *sender, const char *target, const char *payload, size_t len)
+{
+    if (!atomic_load_explicit(&journal_running, memory_order_acquire))
+        return 0;
+
+    size_t sender_len = strnlen(sender, 255);
+    size_t target_len = target ? strnlen(target, 255) : 0;
+    if (len > UINT32_MAX)
+        return 0;
+
+    // Se copia fuera del lock; el lock solo cubre el encadenado y la secuencia
+    Pending *p = malloc(sizeof(Pending) + sender_len + target_len + len);
+    if (!p)
+        return 0;
+    p->next = NULL;
+    p->time_ms = realtime_ms();
+    p->kind = (uint8_t)kind;
+    p->sender_len = (uint8_t)sender_len;
+    p->target_len = (uint8_t)target_len;
+    p->payload_len = (uint32_t)len;
+    memcpy(p->data, sender, sender_len);
+    if (target_len)
+        memcpy(p->data + sender_len, target, target_len); // target es NULL en los broadcast
+    memcpy(p->data + sender_len + target_len, payload, len);
+
+    pthread_mutex_lock(&pending_lock);
+    if (pending_count >= JOURNAL_QUEUE_MAX)
+    {
+        pthread_mutex_unlock(&pending_lock);
+        atomic_fetch_add_explicit(&journal_dropped, 1, memory_order_relaxed);
+        free(p);
+        return 0;
+    }
+    p->seq = next_seq++;
+    if (pending_tail)
+        pending_tail->next = p;
+    else
+        pending_head = p;
+    pending_tail = p;
+    pending_count++;
+    uint64_t seq = p->seq;
+    pthread_cond_signal(&pending_cond);
+    pthread_mutex_unlock(&pending_lock);
+    return seq;
+}
+
+uint64_t journal_last_seq(void)
+{
+    pthread_mutex_lock(&pending_lock);
+    uint64_t seq = next_seq - 1;
+    pthread_mutex_unlock(&pending_lock);
+    return seq;
+}
+
+// Offset desde donde empezar a leer un segmento para no saltear seq ni registros desde since_ms
+static size_t segment_locate(const Segment *s, uint64_t seq, uint64_t since_ms)
+{
+    int lo = 0, hi = s->index_count; // Primera entrada que ya queda después del punto buscado
+    while (lo < hi)
+    {
+        int mid = (lo + hi) / 2;
+        const IndexEntry *e = &s->index[mid];
+        if (s->first_seq + e->seq_delta <= seq && (since_ms == 0 || e->time_ms < since_ms))
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo > 0 ? s->index[lo - 1].offset : 0;
+}
+
+int journal_replay(uint64_t upto, uint64_t last_n, uint64_t since_ms, journal_visit_fn fn, void *arg)
+{
+    if (!atomic_load_explicit(&journal_running, memory_order_acquire) || last_n == 0)
+        return 0;
+
+    uint64_t committed = atomic_load_explicit(&committed_seq, memory_order_acquire);
+    if (upto == 0 || upto > committed)
+        upto = committed;
+    uint64_t from = upto >= last_n ? upto - last_n + 1 : 1;
+
+    int visited = 0;
+    pthread_rwlock_rdlock(&segments_lock);
+    // Último segmento que empieza antes de from; desde ahí la lectura es secuencial
+    int first = 0;
+    while (first + 1 < segment_count && segments[first + 1].first_seq <= from)
+        first++;
+
+    for (int i = first; i < segment_count; i++)
+    {
+        const Segment *s = &segments[i];
+        if (s->first_seq > upto)
+            break;
+        if (!s->last_seq || (since_ms && s->last_ms < since_ms))
+            continue;
+
+        size_t off = segment_locate(s, from, since_ms);
+        while (off + sizeof(RecordHeader) <= s->used)
+        {
+            const RecordHeader *h = (const RecordHeader *)(s->map + off);
+            if (h->seq > upto)
+                break;
+            if (h->seq >= from && (since_ms == 0 || h->time_ms >= since_ms))
+            {
+                const char *body = (const char *)(h + 1);
+                JournalEntry e = {h->seq, h->time_ms, (JournalKind)h->kind,
+                                  body, h->sender_len,
+                                  body + h->sender_len, h->target_len,
+                                  body + h->sender_len + h->target_len, h->payload_len};
+                fn(&e, arg);
+                visited++;
+            }
+            off += h->size;
+        }
+    }
+    pthread_rwlock_unlock(&segments_lock);
+    return visited;
+}
@@ -0,0 +1,80 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Diario de solo-agregado con los broadcast y privados que reparte el servidor, para que un
+// usuario recién registrado reciba los últimos mensajes y un reinicio no pierda la historia.
+//
+// 🔹 Los segmentos son archivos de tamaño fijo mapeados en memoria (<dir>/<primer seq>.seg);
+// al llenarse uno se abre el siguiente y se borran los más viejos. Cada registro lleva su
+// número de secuencia, la hora y un checksum, así que al arrancar se recorren los segmentos
+// y se descarta lo que haya quedado a medio escribir. Un índice disperso en memoria (una
+// entrada cada JOURNAL_INDEX_STRIDE registros) ubica por secuencia o por hora el punto
+// desde donde se lee en forma secuencial.
+//
+// Los hilos de servicio solo encolan (journal_append); un hilo escritor copia lo pendiente
+// a los segmentos y lo confirma en disco con un único msync por tanda (group commit).
+// La relectura ve solo lo confirmado.
+#define JOURNAL_INDEX_STRIDE 64     // Registros entre entradas del índice
+#define JOURNAL_QUEUE_MAX 65536     // Registros pendientes de escribir antes de descartar
+#define JOURNAL_MAX_SEGMENTS_LIMIT 64
+
+typedef enum
+{
+    JOURNAL_BROADCAST = 1,
+    JOURNAL_PRIVATE = 2,
+} JournalKind;
+
+typedef struct
+{
+    int enabled;
+    char dir[256];
+    size_t segment_size; // Bytes por segmento
+    int max_segments;    // Segmentos que se conservan
+    int replay;          // Mensajes que se reenvían al registrarse (0 = ninguno)
+} JournalConfig;
+
+extern JournalConfig journal_config;
+
+// Lee CHAT_JOURNAL (0/1), CHAT_JOURNAL_DIR, CHAT_JOURNAL_SEGMENT_MB, CHAT_JOURNAL_SEGMENTS y
+// CHAT_JOURNAL_REPLAY.
+void journal_config_load(void);
+
+// Recupera los segmentos existentes y arranca el hilo escritor. Devuelve -1 si el diario no
+// se pudo abrir (el servidor sigue sin él). Registra journal_close con atexit.
+int journal_open(void);
+// Escribe lo pendiente y detiene el hilo escritor.
+void journal_close(void);
+
+// Encola un mensaje ya serializado (el JSON que se envió). target es NULL para broadcast.
+// No bloquea al hilo de servicio salvo por un lock breve; si el escritor no da abasto se
+// descarta. Devuelve la secuencia asignada, o 0 si no se guardará.
+uint64_t journal_append(JournalKind kind, const char *sender, const char *target, const char *payload, size_t len);
+
+// Última secuencia asignada por journal_append (confirmada o no); 0 si no hay ninguna.
+uint64_t journal_last_seq(void);
+
+// Registro leído del diario; los punteros apuntan al segmento mapeado y solo valen durante la visita.
+typedef struct
+{
+    uint64_t seq;
+    uint64_t time_ms; // Hora de escritura (ms desde la época)
+    JournalKind kind;
+    const char *sender;
+    size_t sender_len;
+    const char *target; // Vacío en broadcast
+    size_t target_len;
+    const char *payload;
+    size_t payload_len;
+} JournalEntry;
+
+typedef void (*journal_visit_fn)(const JournalEntry *e, void *arg);
+
+// Recorre en orden los últimos last_n registros confirmados hasta la secuencia upto (0 = hasta
+// el último) que no sean anteriores a since_ms (0 = sin límite de hora). Devuelve la cantidad
+// visitada. fn corre mientras el escritor espera para tocar los segmentos: no debe bloquearse.
+int journal_replay(uint64_t upto, uint64_t last_n, uint64_t since_ms, journal_visit_fn fn, void *arg);
+
+#endif
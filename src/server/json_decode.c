@@ -0,0 +1,421 @@
+#include "json_decode.h"
+#include "msgpack.h"
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+
+#define MAX_DEPTH 32 // Anidamiento máximo aceptado en valores que se saltan
+
+static const char *skip_ws(const char *p, const char *end)
+{
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r'))
+        p++;
+    return p;
+}
+
+static int hex4(const char *p, uint32_t *out)
+{
+    uint32_t v = 0;
+    for (int i = 0; i < 4; i++)
+    {
+        char c = p[i];
+        v <<= 4;
+        if (c >= '0' && c <= '9')
+            v |= (uint32_t)(c - '0');
+        else if (c >= 'a' && c <= 'f')
+            v |= (uint32_t)(c - 'a' + 10);
+        else if (c >= 'A' && c <= 'F')
+            v |= (uint32_t)(c - 'A' + 10);
+        else
+            return -1;
+    }
+    *out = v;
+    return 0;
+}
+
+// Recorre una cadena que empieza en la comilla de apertura. Devuelve el puntero a la
+// comilla de cierre, o NULL si está mal formada. *escaped indica si tiene '\'.
+static const char *scan_string(const char *p, const char *end, int *escaped)
+{
+    for (p++; p < end; p++)
+    {
+        if (*p == '"')
+            return p;
+        if (*p == '\\')
+        {
+            *escaped = 1;
+            if (++p >= end)
+                return NULL;
+            if (*p == 'u')
+            {
+                uint32_t cp;
+                if (end - p < 5 || hex4(p + 1, &cp) < 0)
+                    return NULL;
+                p += 4;
+            }
+            else if (!strchr("\"\\/bfnrt", *p))
+            {
+                return NULL;
+            }
+        }
+    }
+    return NULL;
+}
+
+// Desescapa [src, end) en dst (que puede ser src: el resultado nunca es más largo).
+// Con dst NULL solo valida. Devuelve la longitud resultante o -1 si es inválida.
+static long unescape(const char *src, const char *end, char *dst)
+{
+    long n = 0;
+    while (src < end)
+    {
+        char c = *src++;
+        if (c != '\\')
+        {
+            if (dst)
+                dst[n] = c;
+            n++;
+            continue;
+        }
+        char e = *src++;
+        uint32_t cp;
+        switch (e)
+        {
+        case 'b': cp = '\b'; break;
+        case 'f': cp = '\f'; break;
+        case 'n': cp = '\n'; break;
+        case 'r': cp = '\r'; break;
+        case 't': cp = '\t'; break;
+        case 'u':
+            hex4(src, &cp);
+            src += 4;
+            if (cp >= 0xDC00 && cp <= 0xDFFF)
+                return -1; // Sustituto bajo sin alto
+            if (cp >= 0xD800 && cp <= 0xDBFF)
+            {
+                uint32_t lo;
+                if (end - src < 6 || src[0] != '\\' || src[1] != 'u' || hex4(src + 2, &lo) < 0 ||
+                    lo < 0xDC00 || lo > 0xDFFF)
+                    return -1;
+                cp = 0x10000 + ((cp - 0xD800) << 10) + (lo - 0xDC00);
+                src += 6;
+            }
+            break;
+        default: cp = (unsigned char)e; break; // \" \\ \/
+        }
+
+        // Codificar el punto de código en UTF-8
+        unsigned char out[4];
+        int k;
+        if (cp < 0x80)
+        {
+            out[0] = (unsigned char)cp;
+            k = 1;
+        }
+        else if (cp < 0x800)
+        {
+            out[0] = (unsigned char)(0xC0 | (cp >> 6));
+            out[1] = (unsigned char)(0x80 | (cp & 0x3F));
+            k = 2;
+        }
+        else if (cp < 0x10000)
+        {
+            out[0] = (unsigned char)(0xE0 | (cp >> 12));
+            out[1] = (unsigned char)(0x80 | ((cp >> 6) & 0x3F));
+            out[2] = (unsigned char)(0x80 | (cp & 0x3F));
+            k = 3;
+        }
+        else
+        {
+            out[0] = (unsigned char)(0xF0 | (cp >> 18));
+            out[1] = (unsigned char)(0x80 | ((cp >> 12) & 0x3F));
+            out[2] = (unsigned char)(0x80 | ((cp >> 6) & 0x3F));
+            out[3] = (unsigned char)(0x80 | (cp & 0x3F));
+            k = 4;
+        }
+        if (dst)
+            memcpy(dst + n, out, k);
+        n += k;
+    }
+    return n;
+}
+
+static const char *skip_value(const char *p, const char *end, int depth);
+
+static const char *skip_container(const char *p, const char *end, int depth, char close, int is_object)
+{
+    if (depth > MAX_DEPTH)
+        return NULL;
+    p = skip_ws(p + 1, end);
+    if (p < end && *p == close)
+        return p + 1;
+    while (p < end)
+    {
+        if (is_object)
+        {
+            int escaped = 0;
+            if (*p != '"' || !(p = scan_string(p, end, &escaped)))
+                return NULL;
+            p = skip_ws(p + 1, end);
+            if (p >= end || *p != ':')
+                return NULL;
+            p = skip_ws(p + 1, end);
+        }
+        if (!(p = skip_value(p, end, depth + 1)))
+            return NULL;
+        p = skip_ws(p, end);
+        if (p >= end)
+            return NULL;
+        if (*p == close)
+            return p + 1;
+        if (*p != ',')
+            return NULL;
+        p = skip_ws(p + 1, end);
+    }
+    return NULL;
+}
+
+static const char *skip_number(const char *p, const char *end)
+{
+    if (p < end && *p == '-')
+        p++;
+    const char *digits = p;
+    while (p < end && *p >= '0' && *p <= '9')
+        p++;
+    if (p == digits)
+        return NULL;
+    if (p < end && *p == '.')
+    {
+        digits = ++p;
+        while (p < end && *p >= '0' && *p <= '9')
+            p++;
+        if (p == digits)
+            return NULL;
+    }
+    if (p < end && (*p == 'e' || *p == 'E'))
+    {
+        p++;
+        if (p < end && (*p == '+' || *p == '-'))
+            p++;
+        digits = p;
+        while (p < end && *p >= '0' && *p <= '9')
+            p++;
+        if (p == digits)
+            return NULL;
+    }
+    return p;
+}
+
+static const char *skip_literal(const char *p, const char *end, const char *lit)
+{
+    size_t n = strlen(lit);
+    if ((size_t)(end - p) < n || memcmp(p, lit, n) != 0)
+        return NULL;
+    return p + n;
+}
+
+static const char *skip_value(const char *p, const char *end, int depth)
+{
+    if (p >= end)
+        return NULL;
+    switch (*p)
+    {
+    case '"':
+    {
+        int escaped = 0;
+        p = scan_string(p, end, &escaped);
+        return p ? p + 1 : NULL;
+    }
+    case '{':
+        return skip_container(p, end, depth, '}', 1);
+    case '[':
+        return skip_container(p, end, depth, ']', 0);
+    case 't':
+        return skip_literal(p, end, "true");
+    case 'f':
+        return skip_literal(p, end, "false");
+    case 'n':
+        return skip_literal(p, end, "null");
+    default:
+        return skip_number(p, end);
+    }
+}
+
+// Posición de un campo conocido mientras se valida el mensaje completo
+typedef struct
+{
+    JsonField *field;
+    char *start; // Primer carácter tras la comilla de apertura
+    char *quote; // Comilla de cierre
+    int escaped;
+} PendingField;
+
+static JsonField *known_field(ChatMessage *msg, const char *key, size_t len, int *unusual)
+{
+    static const char *const names[] = {"type", "sender", "target", "content"};
+    JsonField *fields[] = {&msg->type, &msg->sender, &msg->target, &msg->content};
+
+    for (int i = 0; i < 4; i++)
+    {
+        if (strlen(names[i]) != len)
+            continue;
+        if (memcmp(names[i], key, len) == 0)
+            return fields[i];
+        // cJSON_GetObjectItem no distingue mayúsculas: ese caso va por el camino lento
+        if (strncasecmp(names[i], key, len) == 0)
+            *unusual = 1;
+    }
+    return NULL;
+}
+
+int chat_message_decode(char *buf, size_t len, ChatMessage *msg)
+{
+    const char *end = buf + len;
+    PendingField pending[4];
+    int npending = 0;
+
+    memset(msg, 0, sizeof(*msg));
+
+    const char *p = skip_ws(buf, end);
+    if (p >= end || *p != '{')
+        return -1;
+    p = skip_ws(p + 1, end);
+    if (p < end && *p == '}')
+        return 0;
+
+    while (p < end)
+    {
+        // Clave
+        int escaped = 0, unusual = 0;
+        if (*p != '"')
+            return -1;
+        const char *key = p + 1;
+        const char *key_end = scan_string(p, end, &escaped);
+        if (!key_end || escaped)
+            return -1;
+        JsonField *field = known_field(msg, key, (size_t)(key_end - key), &unusual);
+        if (unusual)
+            return -1;
+
+        p = skip_ws(key_end + 1, end);
+        if (p >= end || *p != ':')
+            return -1;
+        p = skip_ws(p + 1, end);
+        if (p >= end)
+            return -1;
+
+        // Valor: solo se registran los campos conocidos (el primero gana, como en cJSON)
+        if (field && field->kind == JSON_FIELD_ABSENT && *p == '"')
+        {
+            int value_escaped = 0;
+            const char *quote = scan_string(p, end, &value_escaped);
+            if (!quote)
+                return -1;
+            if (value_escaped && unescape(p + 1, quote, NULL) < 0)
+                return -1;
+            field->kind = JSON_FIELD_STRING;
+            pending[npending].field = field;
+            pending[npending].start = (char *)p + 1;
+            pending[npending].quote = (char *)quote;
+            pending[npending].escaped = value_escaped;
+            npending++;
+            p = quote + 1;
+        }
+        else
+        {
+            if (field && field->kind == JSON_FIELD_ABSENT)
+                field->kind = JSON_FIELD_OTHER;
+            if (!(p = skip_value(p, end, 1)))
+                return -1;
+        }
+
+        p = skip_ws(p, end);
+        if (p >= end)
+            return -1;
+        if (*p == '}')
+            break; // Lo que venga después se ignora, igual que cJSON_Parse
+        if (*p != ',')
+            return -1;
+        p = skip_ws(p + 1, end);
+    }
+    if (p >= end)
+        return -1;
+
+    // 🔹 Mensaje válido: recién ahora se termina y desescapa cada campo en el lugar
+    for (int i = 0; i < npending; i++)
+    {
+        PendingField *f = &pending[i];
+        size_t n = (size_t)(f->quote - f->start);
+        if (f->escaped)
+            n = (size_t)unescape(f->start, f->quote, f->start);
+        f->start[n] = '\0';
+        f->field->str = f->start;
+        f->field->len = n;
+    }
+    return 0;
+}
+
+int chat_message_decode_msgpack(unsigned char *buf, size_t len, ChatMessage *msg)
+{
+    static const char *const names[] = {"type", "sender", "target", "content"};
+    JsonField *fields[] = {&msg->type, &msg->sender, &msg->target, &msg->content};
+    unsigned char *headers[4] = {NULL}; // Inicio (cabecera incluida) de cada campo de texto
+
+    memset(msg, 0, sizeof(*msg));
+
+    MpReader r;
+    uint32_t count;
+    mp_reader_init(&r, buf, len);
+    if (mp_read_map(&r, &count) < 0)
+        return -1;
+
+    while (count--)
+    {
+        const char *key;
+        uint32_t key_len;
+        if (mp_read_str(&r, &key, &key_len) < 0)
+            return -1;
+
+        int idx = -1;
+        for (int i = 0; i < 4; i++)
+        {
+            if (strlen(names[i]) == key_len && memcmp(names[i], key, key_len) == 0)
+            {
+                idx = i;
+                break;
+            }
+        }
+
+        // La primera aparición de cada clave gana; el resto de los valores se salta
+        if (idx >= 0 && fields[idx]->kind == JSON_FIELD_ABSENT)
+        {
+            unsigned char *start = (unsigned char *)r.p;
+            const char *str;
+            uint32_t n;
+            if (mp_peek(&r) == MP_STR)
+            {
+                if (mp_read_str(&r, &str, &n) < 0)
+                    return -1;
+                headers[idx] = start;
+                fields[idx]->kind = JSON_FIELD_STRING;
+                fields[idx]->str = str;
+                fields[idx]->len = n;
+                continue;
+            }
+            fields[idx]->kind = JSON_FIELD_OTHER;
+        }
+        if (mp_skip(&r) < 0)
+            return -1;
+    }
+
+    // 🔹 Mensaje válido: cada cadena se corre sobre su cabecera (>= 1 byte) y se termina en '\0'
+    for (int i = 0; i < 4; i++)
+    {
+        if (!headers[i])
+            continue;
+        memmove(headers[i], fields[i]->str, fields[i]->len);
+        headers[i][fields[i]->len] = '\0';
+        fields[i]->str = (const char *)headers[i];
+    }
+    return 0;
+}
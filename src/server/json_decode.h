@@ -0,0 +1,44 @@
+#ifndef JSON_DECODE_H
+#define JSON_DECODE_H
+
+#include <stddef.h>
+
+// Decodificador de una sola pasada para los mensajes que envían los clientes
+// ({"type", "sender", "target", "content", ...} según docs/protocolo.pdf).
+// No reserva memoria: los campos quedan como cadenas terminadas en '\0' dentro del
+// propio buffer recibido, que se modifica en el lugar (solo se desescapan los campos
+// que traen secuencias de escape). Cualquier entrada que no sea un objeto JSON
+// simple y bien formado se rechaza para que el llamador recurra a cJSON.
+
+typedef enum
+{
+    JSON_FIELD_ABSENT = 0, // La clave no aparece
+    JSON_FIELD_STRING,     // La clave tiene un valor de tipo cadena
+    JSON_FIELD_OTHER       // La clave existe pero su valor no es una cadena
+} JsonFieldKind;
+
+typedef struct
+{
+    const char *str; // Solo válido si kind == JSON_FIELD_STRING
+    size_t len;
+    JsonFieldKind kind;
+} JsonField;
+
+typedef struct
+{
+    JsonField type;
+    JsonField sender;
+    JsonField target;
+    JsonField content;
+} ChatMessage;
+
+// Devuelve 0 si el mensaje se decodificó y -1 si hay que usar el camino lento (cJSON).
+// Si devuelve -1 el buffer no fue modificado.
+int chat_message_decode(char *buf, size_t len, ChatMessage *msg);
+
+// Variante para "chat-protocol-bin": buf es un mapa MessagePack con las mismas claves.
+// Las cadenas se corren sobre su propia cabecera para terminarlas en '\0', así que
+// tampoco reserva memoria. Devuelve -1 (sin tocar el buffer) si el mensaje es inválido.
+int chat_message_decode_msgpack(unsigned char *buf, size_t len, ChatMessage *msg);
+
+#endif
@@ -1,45 +1,137 @@
 #include "server.h"
 #include <pthread.h>
+#include <stdint.h>
+
+static DeflateStats *session_deflate_stats(struct lws *wsi)
+{
+    SessionData *pss = (SessionData *)lws_wsi_user(wsi);
+    return pss ? &pss->deflate : NULL;
+}
+
+// Deja de leer del socket hasta que el cliente recupere tokens; lo que mande mientras tanto
+// queda en el kernel (y en su propio buffer de envío) en lugar de consumir CPU acá
+static void pause_reading(struct lws *wsi, SessionData *pss, int wait_ms)
+{
+    if (pss->rate.paused)
+        return;
+    pss->rate.paused = 1;
+    lws_rx_flow_control(wsi, 0);
+    lws_set_timer_usecs(wsi, (lws_usec_t)wait_ms * 1000);
+    LOG_SAMPLED(LOG_LEVEL_WARN, 100, "Cliente limitado: lectura en pausa %d ms (%lu mensajes descartados)",
+                wait_ms, pss->rate.limited);
+}
 
 static int callback_chat(struct lws *wsi, enum lws_callback_reasons reason, void *user, void *in, size_t len)
 {
+    SessionData *pss = (SessionData *)user;
+
     switch (reason)
     {
     case LWS_CALLBACK_ESTABLISHED:
     {
-        printf("Cliente conectado\n");
+        LOG_INFO("Cliente conectado");
+        metrics_add(METRIC_CONNECTIONS_OPENED, 1);
+        send_queue_init(&pss->queue);
+        pss->shard = shard_current() < 0 ? 0 : shard_current();
+        pss->shard_pos = -1;
         char client_ip[48] = {0};
         lws_get_peer_simple(wsi, client_ip, sizeof(client_ip));
-        printf("IP del cliente: %s\n", client_ip);
-        // Envía mensaje de bienvenida, etc.
-        const char *msg = "{\"type\": \"server\", \"content\": \"Conexión establecida\"}";
-        size_t msg_len = strlen(msg);
-        unsigned char buf[LWS_PRE + msg_len];
-        unsigned char *p = &buf[LWS_PRE];
-        memcpy(p, msg, msg_len);
-        lws_write(wsi, p, msg_len, LWS_WRITE_TEXT);
+        LOG_INFO("IP del cliente: %s", client_ip);
+        deflate_apply(wsi); // Antes del primer envío
+        // Envía mensaje de bienvenida, etc. (en binario si se negoció chat-protocol-bin)
+        JsonWriter *w = json_writer_begin();
+        jw_lit(w, "{\"type\": \"server\", \"content\": \"Conexión establecida\"}");
+        json_writer_send(w, wsi);
         break;
     }
     case LWS_CALLBACK_RECEIVE:
-        handle_message((char *)in, wsi);
-        break;
-    case LWS_CALLBACK_SERVER_WRITEABLE:
     {
-        pthread_mutex_lock(&broadcast_lock);
-        if (g_broadcast_msg)
+        // 🔹 Los límites se cobran antes de decodificar: un cliente que se pasa no gasta CPU
+        uint64_t now = monotonic_ms();
+        metrics_add(METRIC_BYTES_IN, len);
+        int wait_ms = rate_charge_bytes(&pss->rate, len, now);
+
+        // 🔹 lws puede entregar un mensaje en varios pedazos: sólo se procesa cuando está completo
+        char *msg;
+        size_t msg_len;
+        switch (rx_buffer_feed(&pss->rx, wsi, in, len, &msg, &msg_len))
+        {
+        case RX_COMPLETE:
         {
-            size_t msg_len = strlen(g_broadcast_msg);
-            unsigned char buf[LWS_PRE + msg_len];
-            unsigned char *p = &buf[LWS_PRE];
-            strcpy((char *)p, g_broadcast_msg);
-            lws_write(wsi, p, msg_len, LWS_WRITE_TEXT);
+            int msg_wait = rate_take_message(&pss->rate, rate_sniff_type(msg, msg_len, wsi_is_binary(wsi)), now);
+            if (msg_wait == 0)
+            {
+                handle_message(msg, msg_len, wsi);
+            }
+            else
+            {
+                metrics_add(METRIC_RATE_LIMITED, 1);
+                if (!pss->rate.paused)
+                    send_error(wsi, "Demasiados mensajes; espere antes de enviar más");
+                if (msg_wait > wait_ms)
+                    wait_ms = msg_wait;
+            }
+            rx_buffer_release(&pss->rx);
+            break;
         }
-        pthread_mutex_unlock(&broadcast_lock);
+        case RX_TOO_LARGE:
+            LOG_SAMPLED(LOG_LEVEL_WARN, 100, "Mensaje descartado: supera %d bytes", RX_MAX_MESSAGE);
+            send_error(wsi, "Mensaje demasiado grande");
+            break;
+        default:
+            break;
+        }
+        if (wait_ms > 0)
+            pause_reading(wsi, pss, wait_ms);
         break;
     }
+    case LWS_CALLBACK_TIMER:
+        // ⏱️ Volvieron a alcanzar los tokens: se reanuda la lectura
+        if (pss->rate.paused)
+        {
+            pss->rate.paused = 0;
+            lws_rx_flow_control(wsi, 1);
+        }
+        break;
+    case LWS_CALLBACK_SERVER_WRITEABLE:
+        // 🔹 Un frame por callback; send_queue_write_next re-arma si quedan pendientes
+        if (send_queue_write_next(&pss->queue, wsi) < 0)
+            return -1;
+        break;
+    case LWS_CALLBACK_EVENT_WAIT_CANCELLED:
+        // 🔹 Otro hilo dejó frames en el buzón de este shard (llega una vez por protocolo;
+        // la segunda llamada encuentra el buzón vacío)
+        drain_shard_mailbox();
+        break;
+    case LWS_CALLBACK_HTTP:
+        // Las conexiones HTTP llegan al primer protocolo: solo sirven las métricas
+        return stats_http_begin(wsi, pss, (const char *)in);
+    case LWS_CALLBACK_HTTP_WRITEABLE:
+        return stats_http_write(wsi, pss);
+    case LWS_CALLBACK_CLOSED_HTTP:
+        if (pss)
+            stats_http_release(pss);
+        break;
     case LWS_CALLBACK_CLOSED:
-        printf("Cliente desconectado\n");
-        remove_user(wsi);
+        LOG_INFO("Cliente desconectado");
+        metrics_add(METRIC_CONNECTIONS_CLOSED, 1);
+        if (pss->deflate.compressed_messages > 0)
+        {
+            char peer_ip[48] = {0};
+            lws_get_peer_simple(wsi, peer_ip, sizeof(peer_ip));
+            LOG_INFO("Compresión de %s: %llu -> %llu bytes (%.1f%%) en %llu mensajes, %llu comprimidos",
+                     peer_ip, (unsigned long long)pss->deflate.raw_bytes,
+                     (unsigned long long)pss->deflate.wire_bytes, 100.0 * deflate_ratio(&pss->deflate),
+                     (unsigned long long)pss->deflate.messages,
+                     (unsigned long long)pss->deflate.compressed_messages);
+        }
+        if (pss->queue.dropped > 0)
+            LOG_INFO("Se descartaron %lu frames por contrapresión", pss->queue.dropped);
+        if (pss->rate.limited > 0)
+            LOG_INFO("Se descartaron %lu mensajes por límite de tasa", pss->rate.limited);
+        remove_user(wsi); // Primero se saca del registro para que nadie más encole
+        send_queue_destroy(&pss->queue);
+        rx_buffer_release(&pss->rx);
         break;
     default:
         break;
@@ -47,15 +139,33 @@ static int callback_chat(struct lws *wsi, enum lws_callback_reasons reason, void
     return 0;
 }
 
+// Mismo callback y mismo registro de usuarios para ambos subprotocolos; la codificación
+// de cada conexión se decide por el id. JSON va primero: es el que usa lws por defecto.
 static struct lws_protocols protocols[] = {
-    {"chat-protocol", callback_chat, 0, 4096},
+    {CHAT_PROTOCOL, callback_chat, sizeof(SessionData), 4096, CHAT_PROTOCOL_ID_JSON, NULL, 0},
+    {CHAT_PROTOCOL_BIN, callback_chat, sizeof(SessionData), 4096, CHAT_PROTOCOL_ID_BIN, NULL, 0},
     {NULL, NULL, 0, 0}};
 
+static struct lws_context *context;
+
+// Bucle de los hilos de servicio adicionales; cada uno atiende sus propias conexiones
+static void *service_thread(void *arg)
+{
+    int tsi = (int)(intptr_t)arg;
+    shard_bind_thread(tsi);
+    while (1)
+    {
+        lws_service_tsi(context, batch_wait_ms(50), tsi);
+        flush_due_batch(); // ⏱️ Cierra el lote del shard si venció su ventana
+    }
+    return NULL;
+}
+
 int main(int argc, char *argv[])
 {
-    if (argc != 2)
+    if (argc < 2 || argc > 3)
     {
-        fprintf(stderr, "Uso: %s <puerto>\n", argv[0]);
+        fprintf(stderr, "Uso: %s <puerto> [hilos]\n", argv[0]);
         return 1;
     }
 
@@ -66,23 +176,79 @@ int main(int argc, char *argv[])
         return 1;
     }
 
+    int threads = argc == 3 ? atoi(argv[2]) : 1;
+    if (threads < 1 || threads > MAX_SHARDS)
+    {
+        fprintf(stderr, "Cantidad de hilos inválida (1-%d).\n", MAX_SHARDS);
+        return 1;
+    }
+
+    // Nivel de registro configurable con CHAT_LOG_LEVEL (debug, info, warn, error, off)
+    log_start(log_level_parse(getenv("CHAT_LOG_LEVEL"), LOG_LEVEL_INFO));
+
     struct lws_context_creation_info info = {0};
-    struct lws_context *context;
+
+    // 🔹 permessage-deflate con la política de CHAT_DEFLATE_* (ver compression.h)
+    deflate_config_load();
+    send_queue_config_load();
+    rate_config_load();
+    batch_window_ms = env_int("CHAT_BATCH_MS", BATCH_WINDOW_MS, 1, 1000);
+    deflate_set_stats_hook(session_deflate_stats);
+    deflate_set_totals_hook(metrics_deflate);
+    metrics_init();
+
+    // Diario de mensajes (CHAT_JOURNAL=1); sin él el servidor funciona igual, sin historia
+    journal_config_load();
+    if (journal_open() < 0)
+        LOG_WARN("Se continúa sin diario de mensajes");
+    offline_config_load();
+    if (offline_init() < 0)
+        LOG_WARN("Los mensajes para usuarios desconectados no podrán pasar a disco");
 
     info.port = port;
     info.protocols = protocols;
+    info.extensions = deflate_extensions();
+    info.count_threads = threads; // 🔹 Un hilo de servicio (shard) por núcleo pedido
     context = lws_create_context(&info);
     if (!context)
     {
-        fprintf(stderr, "Error creando contexto WebSocket\n");
+        LOG_ERROR("Error creando contexto WebSocket");
         return -1;
     }
 
-    printf("Servidor WebSocket en puerto %d\n", port);
+    // lws recorta count_threads a su LWS_MAX_SMP: los shards son solo los hilos que creó
+    int granted = lws_get_count_threads(context);
+    if (granted < threads)
+    {
+        LOG_WARN("libwebsockets admite %d hilos de servicio (LWS_MAX_SMP); se usan %d de los %d pedidos", granted,
+                 granted, threads);
+        threads = granted;
+    }
+
+    LOG_INFO("Servidor WebSocket en puerto %d (%d hilos de servicio); métricas en /metrics y /stats", port, threads);
+    idle_timers_init();
+    shards_init(context, threads);
+
+    for (int tsi = 1; tsi < threads; tsi++)
+    {
+        pthread_t tid;
+        if (pthread_create(&tid, NULL, service_thread, (void *)(intptr_t)tsi) != 0)
+        {
+            LOG_ERROR("No se pudo crear el hilo de servicio %d", tsi);
+            lws_context_destroy(context);
+            return -1;
+        }
+        pthread_detach(tid);
+    }
 
+    // El hilo principal atiende el shard 0 y la rueda de inactividad
+    shard_bind_thread(0);
     while (1)
     {
-        lws_service(context, 50); // 🔹 Ahora solo maneja nuevas conexiones
+        lws_service_tsi(context, batch_wait_ms(50), 0);
+        flush_due_batch();
+        check_inactive_users(); // ⏱️ Avanza la rueda de inactividad
+        offline_expire();
     }
 
     lws_context_destroy(context);
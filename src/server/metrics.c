@@ -0,0 +1,377 @@
+#include "metrics.h"
+#include "send_queue.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+__thread MetricsThread *metrics_self = NULL;
+
+static MetricsThread *blocks[METRICS_MAX_THREADS];
+static atomic_int block_count = 0;
+static pthread_mutex_t block_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t block_key;
+static pthread_once_t block_key_once = PTHREAD_ONCE_INIT;
+static uint64_t start_ns;
+
+static const struct
+{
+    const char *name;
+    const char *help;
+} counters[METRIC_COUNTER_COUNT] = {
+    [METRIC_BYTES_IN] = {"bytes_in", "Bytes WebSocket recibidos"},
+    [METRIC_BYTES_OUT] = {"bytes_out", "Bytes de payload enviados"},
+    [METRIC_FRAMES_OUT] = {"frames_out", "Frames enviados"},
+    [METRIC_CONNECTIONS_OPENED] = {"connections_opened", "Conexiones WebSocket aceptadas"},
+    [METRIC_CONNECTIONS_CLOSED] = {"connections_closed", "Conexiones WebSocket cerradas"},
+    [METRIC_RATE_LIMITED] = {"rate_limited", "Mensajes descartados por límite de tasa"},
+    [METRIC_DEFLATE_RAW] = {"deflate_raw_bytes", "Bytes salientes antes de permessage-deflate"},
+    [METRIC_DEFLATE_WIRE] = {"deflate_wire_bytes", "Bytes salientes después de permessage-deflate"},
+    [METRIC_DEFLATE_MESSAGES] = {"deflate_messages", "Mensajes en conexiones con permessage-deflate"},
+    [METRIC_DEFLATE_COMPRESSED] = {"deflate_compressed_messages", "Mensajes que pasaron por el compresor"},
+};
+
+static const char *lock_names[METRIC_LOCK_COUNT] = {
+    [METRIC_LOCK_USER] = "user_lock",
+    [METRIC_LOCK_BROADCAST] = "broadcast_lock",
+};
+
+// Al terminar un hilo su bloque queda libre para otro; lo acumulado se conserva
+static void release_block(void *block)
+{
+    atomic_store_explicit(&((MetricsThread *)block)->owned, 0, memory_order_release);
+}
+
+static void make_block_key(void)
+{
+    pthread_key_create(&block_key, release_block);
+}
+
+MetricsThread *metrics_attach(void)
+{
+    pthread_once(&block_key_once, make_block_key);
+
+    MetricsThread *block = NULL;
+    pthread_mutex_lock(&block_lock);
+    int count = atomic_load_explicit(&block_count, memory_order_relaxed);
+    for (int i = 0; i < count && !block; i++)
+    {
+        int expected = 0;
+        if (atomic_compare_exchange_strong(&blocks[i]->owned, &expected, 1))
+            block = blocks[i];
+    }
+    if (!block && count < METRICS_MAX_THREADS)
+    {
+        block = calloc(1, sizeof(MetricsThread));
+        if (block)
+        {
+            atomic_store(&block->owned, 1);
+            blocks[count] = block;
+            atomic_store_explicit(&block_count, count + 1, memory_order_release);
+        }
+    }
+    pthread_mutex_unlock(&block_lock);
+
+    if (block)
+        pthread_setspecific(block_key, block);
+    return metrics_self = block;
+}
+
+void metrics_deflate(uint64_t raw_bytes, uint64_t wire_bytes, int compressed)
+{
+    metrics_add(METRIC_DEFLATE_RAW, raw_bytes);
+    metrics_add(METRIC_DEFLATE_WIRE, wire_bytes);
+    if (raw_bytes > 0)
+        metrics_add(METRIC_DEFLATE_MESSAGES, 1);
+    if (compressed)
+        metrics_add(METRIC_DEFLATE_COMPRESSED, 1);
+}
+
+void metrics_init(void)
+{
+    start_ns = metrics_now_ns();
+}
+
+// Suma de los bloques de todos los hilos
+typedef struct
+{
+    uint64_t counters[METRIC_COUNTER_COUNT];
+    uint64_t messages[MSG_TYPE_COUNT];
+    HistogramSnapshot handle_ns[MSG_TYPE_COUNT];
+    HistogramSnapshot fanout;
+    HistogramSnapshot lock_wait_ns[METRIC_LOCK_COUNT];
+    uint64_t lock_contended[METRIC_LOCK_COUNT];
+} MetricsSnapshot;
+
+static void snapshot(MetricsSnapshot *s)
+{
+    int count = atomic_load_explicit(&block_count, memory_order_acquire);
+    for (int b = 0; b < count; b++)
+    {
+        const MetricsThread *t = blocks[b];
+        for (int i = 0; i < METRIC_COUNTER_COUNT; i++)
+            s->counters[i] += atomic_load_explicit(&t->counters[i], memory_order_relaxed);
+        for (int i = 0; i < MSG_TYPE_COUNT; i++)
+        {
+            s->messages[i] += atomic_load_explicit(&t->messages[i], memory_order_relaxed);
+            hist_accumulate(&s->handle_ns[i], &t->handle_ns[i]);
+        }
+        hist_accumulate(&s->fanout, &t->fanout);
+        for (int i = 0; i < METRIC_LOCK_COUNT; i++)
+        {
+            hist_accumulate(&s->lock_wait_ns[i], &t->lock_wait_ns[i]);
+            s->lock_contended[i] += atomic_load_explicit(&t->lock_contended[i], memory_order_relaxed);
+        }
+    }
+}
+
+static void jw_double(JsonWriter *w, double v)
+{
+    char num[32];
+    int n = snprintf(num, sizeof(num), "%.9g", v);
+    jw_raw(w, num, (size_t)n);
+}
+
+static void jw_i64(JsonWriter *w, int64_t v)
+{
+    if (v < 0)
+    {
+        jw_lit(w, "-");
+        v = -v;
+    }
+    jw_u64(w, (uint64_t)v);
+}
+
+static const char *type_label(MsgType t)
+{
+    return t == MSG_UNKNOWN ? "unknown" : msg_type_name(t);
+}
+
+// --- Prometheus ---
+
+static void prom_header(JsonWriter *w, const char *name, const char *type, const char *help)
+{
+    jw_lit(w, "# HELP chat_");
+    jw_raw(w, name, strlen(name));
+    jw_lit(w, " ");
+    jw_raw(w, help, strlen(help));
+    jw_lit(w, "\n# TYPE chat_");
+    jw_raw(w, name, strlen(name));
+    jw_lit(w, " ");
+    jw_raw(w, type, strlen(type));
+    jw_lit(w, "\n");
+}
+
+// chat_<name><suffix>{label="value",le="le"} con las etiquetas que no sean NULL
+static void prom_name(JsonWriter *w, const char *name, const char *suffix, const char *label, const char *value,
+                      const char *le)
+{
+    jw_lit(w, "chat_");
+    jw_raw(w, name, strlen(name));
+    jw_raw(w, suffix, strlen(suffix));
+    if (label || le)
+        jw_lit(w, "{");
+    if (label)
+    {
+        jw_raw(w, label, strlen(label));
+        jw_lit(w, "=\"");
+        jw_raw(w, value, strlen(value));
+        jw_lit(w, "\"");
+    }
+    if (le)
+    {
+        if (label)
+            jw_lit(w, ",");
+        jw_lit(w, "le=\"");
+        jw_raw(w, le, strlen(le));
+        jw_lit(w, "\"");
+    }
+    if (label || le)
+        jw_lit(w, "}");
+    jw_lit(w, " ");
+}
+
+static void prom_sample(JsonWriter *w, const char *name, const char *label, const char *value, uint64_t v)
+{
+    prom_name(w, name, "", label, value, NULL);
+    jw_u64(w, v);
+    jw_lit(w, "\n");
+}
+
+// Buckets acumulados en las potencias de 2, exactos porque los buckets del histograma no
+// las cruzan: le = 2^e - 1 para e de lo a hi, en la unidad original dividida por scale
+static void prom_histogram(JsonWriter *w, const char *name, const char *label, const char *value,
+                           const HistogramSnapshot *h, int lo, int hi, double scale)
+{
+    char le[32];
+    for (int e = lo; e <= hi; e++)
+    {
+        snprintf(le, sizeof(le), "%.9g", (double)((1ull << e) - 1) / scale);
+        prom_name(w, name, "_bucket", label, value, le);
+        jw_u64(w, hist_count_below_pow2(h, e));
+        jw_lit(w, "\n");
+    }
+    uint64_t total = hist_count_below_pow2(h, HIST_MAX_EXP + 1);
+    prom_name(w, name, "_bucket", label, value, "+Inf");
+    jw_u64(w, total);
+    jw_lit(w, "\n");
+    prom_name(w, name, "_sum", label, value, NULL);
+    jw_double(w, (double)h->sum / scale);
+    jw_lit(w, "\n");
+    prom_name(w, name, "_count", label, value, NULL);
+    jw_u64(w, total);
+    jw_lit(w, "\n");
+}
+
+static void render_prometheus(JsonWriter *w, const MetricsSnapshot *s, int users)
+{
+    int64_t connections = (int64_t)(s->counters[METRIC_CONNECTIONS_OPENED] - s->counters[METRIC_CONNECTIONS_CLOSED]);
+
+    prom_header(w, "uptime_seconds", "gauge", "Segundos desde el arranque");
+    prom_name(w, "uptime_seconds", "", NULL, NULL, NULL);
+    jw_double(w, (double)(metrics_now_ns() - start_ns) / 1e9);
+    jw_lit(w, "\n");
+    prom_header(w, "connections", "gauge", "Conexiones WebSocket abiertas");
+    prom_name(w, "connections", "", NULL, NULL, NULL);
+    jw_i64(w, connections);
+    jw_lit(w, "\n");
+    prom_header(w, "users", "gauge", "Usuarios registrados");
+    prom_sample(w, "users", NULL, NULL, (uint64_t)users);
+
+    for (int i = 0; i < METRIC_COUNTER_COUNT; i++)
+    {
+        char name[64];
+        snprintf(name, sizeof(name), "%s_total", counters[i].name);
+        prom_header(w, name, "counter", counters[i].help);
+        prom_sample(w, name, NULL, NULL, s->counters[i]);
+    }
+
+    prom_header(w, "send_queue_frames", "gauge", "Frames esperando en las colas de envío");
+    prom_name(w, "send_queue_frames", "", NULL, NULL, NULL);
+    jw_i64(w, atomic_load_explicit(&send_queue_totals.queued_frames, memory_order_relaxed));
+    jw_lit(w, "\n");
+    prom_header(w, "send_queue_bytes", "gauge", "Bytes esperando en las colas de envío");
+    prom_name(w, "send_queue_bytes", "", NULL, NULL, NULL);
+    jw_i64(w, atomic_load_explicit(&send_queue_totals.queued_bytes, memory_order_relaxed));
+    jw_lit(w, "\n");
+    prom_header(w, "send_queue_dropped_total", "counter", "Frames descartados por contrapresión");
+    prom_sample(w, "send_queue_dropped_total", NULL, NULL,
+                atomic_load_explicit(&send_queue_totals.dropped, memory_order_relaxed));
+    prom_header(w, "send_queue_disconnects_total", "counter", "Conexiones cerradas por no leer");
+    prom_sample(w, "send_queue_disconnects_total", NULL, NULL,
+                atomic_load_explicit(&send_queue_totals.disconnects, memory_order_relaxed));
+
+    prom_header(w, "messages_total", "counter", "Mensajes recibidos por tipo");
+    for (int t = 0; t < MSG_TYPE_COUNT; t++)
+    {
+        if (s->messages[t])
+            prom_sample(w, "messages_total", "type", type_label((MsgType)t), s->messages[t]);
+    }
+    // De ~1 us a ~17 s
+    prom_header(w, "handle_seconds", "histogram", "Duración de handle_message por tipo");
+    for (int t = 0; t < MSG_TYPE_COUNT; t++)
+    {
+        if (s->handle_ns[t].count)
+            prom_histogram(w, "handle_seconds", "type", type_label((MsgType)t), &s->handle_ns[t], 10, 34, 1e9);
+    }
+    prom_header(w, "fanout_recipients", "histogram", "Destinatarios por entrega de difusión en un shard");
+    prom_histogram(w, "fanout_recipients", NULL, NULL, &s->fanout, 0, 20, 1.0);
+    prom_header(w, "lock_wait_seconds", "histogram", "Espera para tomar los locks globales");
+    for (int l = 0; l < METRIC_LOCK_COUNT; l++)
+        prom_histogram(w, "lock_wait_seconds", "lock", lock_names[l], &s->lock_wait_ns[l], 6, 30, 1e9);
+    prom_header(w, "lock_contended_total", "counter", "Veces que hubo que esperar un lock");
+    for (int l = 0; l < METRIC_LOCK_COUNT; l++)
+        prom_sample(w, "lock_contended_total", "lock", lock_names[l], s->lock_contended[l]);
+}
+
+// --- JSON ---
+
+// {"count":N,"p50":..,"p99":..,"p999":..,"max":..} en unidades de scale
+static void json_summary(JsonWriter *w, const HistogramSnapshot *h, double scale)
+{
+    jw_lit(w, "{\"count\":");
+    jw_u64(w, h->count);
+    jw_lit(w, ",\"mean\":");
+    jw_double(w, h->count ? (double)h->sum / (double)h->count / scale : 0);
+    jw_lit(w, ",\"p50\":");
+    jw_double(w, (double)hist_quantile(h, 0.50) / scale);
+    jw_lit(w, ",\"p99\":");
+    jw_double(w, (double)hist_quantile(h, 0.99) / scale);
+    jw_lit(w, ",\"p999\":");
+    jw_double(w, (double)hist_quantile(h, 0.999) / scale);
+    jw_lit(w, ",\"max\":");
+    jw_double(w, (double)h->max / scale);
+    jw_lit(w, "}");
+}
+
+static void render_json(JsonWriter *w, const MetricsSnapshot *s, int users)
+{
+    jw_lit(w, "{\"uptime_s\":");
+    jw_u64(w, (metrics_now_ns() - start_ns) / 1000000000ull);
+    jw_lit(w, ",\"connections\":");
+    jw_i64(w, (int64_t)(s->counters[METRIC_CONNECTIONS_OPENED] - s->counters[METRIC_CONNECTIONS_CLOSED]));
+    jw_lit(w, ",\"users\":");
+    jw_u64(w, (uint64_t)users);
+    jw_lit(w, ",\"counters\":{");
+    for (int i = 0; i < METRIC_COUNTER_COUNT; i++)
+    {
+        if (i > 0)
+            jw_lit(w, ",");
+        jw_str(w, counters[i].name);
+        jw_lit(w, ":");
+        jw_u64(w, s->counters[i]);
+    }
+    jw_lit(w, "},\"send_queue\":{\"frames\":");
+    jw_i64(w, atomic_load_explicit(&send_queue_totals.queued_frames, memory_order_relaxed));
+    jw_lit(w, ",\"bytes\":");
+    jw_i64(w, atomic_load_explicit(&send_queue_totals.queued_bytes, memory_order_relaxed));
+    jw_lit(w, ",\"dropped\":");
+    jw_u64(w, atomic_load_explicit(&send_queue_totals.dropped, memory_order_relaxed));
+    jw_lit(w, ",\"disconnects\":");
+    jw_u64(w, atomic_load_explicit(&send_queue_totals.disconnects, memory_order_relaxed));
+
+    // Latencias en microsegundos
+    jw_lit(w, "},\"handle_us\":{");
+    int first = 1;
+    for (int t = 0; t < MSG_TYPE_COUNT; t++)
+    {
+        if (!s->handle_ns[t].count)
+            continue;
+        if (!first)
+            jw_lit(w, ",");
+        first = 0;
+        jw_str(w, type_label((MsgType)t));
+        jw_lit(w, ":");
+        json_summary(w, &s->handle_ns[t], 1e3);
+    }
+    jw_lit(w, "},\"fanout\":");
+    json_summary(w, &s->fanout, 1.0);
+    jw_lit(w, ",\"locks\":{");
+    for (int l = 0; l < METRIC_LOCK_COUNT; l++)
+    {
+        if (l > 0)
+            jw_lit(w, ",");
+        jw_str(w, lock_names[l]);
+        jw_lit(w, ":{\"contended\":");
+        jw_u64(w, s->lock_contended[l]);
+        jw_lit(w, ",\"wait_us\":");
+        json_summary(w, &s->lock_wait_ns[l], 1e3);
+        jw_lit(w, "}");
+    }
+    jw_lit(w, "}}");
+}
+
+void metrics_render(JsonWriter *w, int json, int users)
+{
+    MetricsSnapshot *s = calloc(1, sizeof(MetricsSnapshot));
+    if (!s)
+    {
+        w->failed = 1;
+        return;
+    }
+    snapshot(s);
+    if (json)
+        render_json(w, s, users);
+    else
+        render_prometheus(w, s, users);
+    free(s);
+}
@@ -0,0 +1,125 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <time.h>
+#include "histogram.h"
+#include "msg_types.h"
+#include "response_writer.h"
+
+// Métricas del proceso, servidas por HTTP en el mismo puerto: /metrics en formato de texto
+// de Prometheus y /stats en JSON. Cada hilo escribe solo en su propio bloque (contadores e
+// histogramas de un único escritor, sin atómicos de lectura-modificación ni locks); quien
+// las lee suma los bloques de todos los hilos.
+
+#define METRICS_MAX_THREADS 64 // Igual que LOG_MAX_THREADS; los hilos de más no registran
+
+typedef enum
+{
+    METRIC_BYTES_IN = 0,   // Bytes WebSocket recibidos
+    METRIC_BYTES_OUT,      // Bytes de payload escritos con lws_write
+    METRIC_FRAMES_OUT,
+    METRIC_CONNECTIONS_OPENED,
+    METRIC_CONNECTIONS_CLOSED,
+    METRIC_RATE_LIMITED,   // Mensajes descartados por límite de tasa
+    METRIC_DEFLATE_RAW,    // Bytes antes de permessage-deflate
+    METRIC_DEFLATE_WIRE,   // Bytes después de permessage-deflate
+    METRIC_DEFLATE_MESSAGES,
+    METRIC_DEFLATE_COMPRESSED,
+    METRIC_COUNTER_COUNT
+} MetricCounter;
+
+// Locks globales cuya espera se mide
+typedef enum
+{
+    METRIC_LOCK_USER = 0,
+    METRIC_LOCK_BROADCAST,
+    METRIC_LOCK_COUNT
+} MetricLock;
+
+typedef struct
+{
+    atomic_int owned; // Lo está usando un hilo vivo
+    atomic_ulong counters[METRIC_COUNTER_COUNT];
+    atomic_ulong messages[MSG_TYPE_COUNT];
+    Histogram handle_ns[MSG_TYPE_COUNT]; // Duración de handle_message por tipo
+    Histogram fanout;                    // Destinatarios por entrega de difusión en un shard
+    Histogram lock_wait_ns[METRIC_LOCK_COUNT];
+    atomic_ulong lock_contended[METRIC_LOCK_COUNT];
+} MetricsThread;
+
+extern __thread MetricsThread *metrics_self;
+
+// Bloque del hilo actual, reservándolo la primera vez; NULL si ya no quedan
+MetricsThread *metrics_attach(void);
+
+static inline MetricsThread *metrics_thread(void)
+{
+    MetricsThread *t = metrics_self;
+    return t ? t : metrics_attach();
+}
+
+static inline uint64_t metrics_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static inline void metrics_add(MetricCounter c, uint64_t v)
+{
+    MetricsThread *t = metrics_thread();
+    if (t)
+        hist_add(&t->counters[c], (unsigned long)v);
+}
+
+// Un mensaje entrante de tipo type (MSG_UNKNOWN si no se pudo decodificar) que tardó ns
+static inline void metrics_message(MsgType type, uint64_t ns)
+{
+    MetricsThread *t = metrics_thread();
+    if (!t)
+        return;
+    hist_add(&t->messages[type], 1);
+    hist_record(&t->handle_ns[type], ns);
+}
+
+static inline void metrics_fanout(int recipients)
+{
+    MetricsThread *t = metrics_thread();
+    if (t)
+        hist_record(&t->fanout, (uint64_t)recipients);
+}
+
+// pthread_mutex_lock midiendo la espera. Sin contención cuesta un trylock: el reloj solo se
+// lee cuando hay que esperar.
+static inline void metrics_lock(pthread_mutex_t *m, MetricLock which)
+{
+    MetricsThread *t = metrics_thread();
+    if (pthread_mutex_trylock(m) == 0)
+    {
+        if (t)
+            hist_record(&t->lock_wait_ns[which], 0);
+        return;
+    }
+    uint64_t start = metrics_now_ns();
+    pthread_mutex_lock(m);
+    if (t)
+    {
+        hist_add(&t->lock_contended[which], 1);
+        hist_record(&t->lock_wait_ns[which], metrics_now_ns() - start);
+    }
+}
+
+// Para deflate_set_totals_hook
+void metrics_deflate(uint64_t raw_bytes, uint64_t wire_bytes, int compressed);
+
+// Marca el arranque (para el uptime); llamar una vez desde main
+void metrics_init(void);
+
+// Escribe todas las métricas en w: texto de Prometheus o, con json, el resumen de /stats
+// (percentiles en lugar de buckets). users es la cantidad de usuarios registrados.
+void metrics_render(JsonWriter *w, int json, int users);
+
+#endif
@@ -0,0 +1,507 @@
+#include "offline.h"
+#include "common.h"
+#include "log.h"
+#include "send_queue.h"
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+#define OFFLINE_MAX_MSGS 100
+#define OFFLINE_MAX_KB 128
+#define OFFLINE_MAX_AGE_S 86400
+#define OFFLINE_MEMORY_KB 8192
+#define OFFLINE_MAX_RECORD (64u << 20) // Un largo mayor en el archivo es basura
+
+// Registro en el archivo de una cola, seguido de len bytes
+typedef struct
+{
+    uint64_t time_ms;
+    uint32_t len;
+    uint32_t reserved;
+} SpillRecord;
+
+typedef struct OfflineQueue
+{
+    struct OfflineQueue *next; // Cadena del bucket
+    char username[50];
+    OfflineMessages mem;       // Lo más reciente; siempre posterior a lo que está en disco
+    int disk_count;
+    size_t disk_bytes;
+    uint64_t disk_newest_ms;   // Para borrar el archivo entero cuando todo venció
+} OfflineQueue;
+
+OfflineConfig offline_config = {"offline", OFFLINE_MAX_MSGS, (size_t)OFFLINE_MAX_KB << 10, OFFLINE_MAX_AGE_S,
+                                (size_t)OFFLINE_MEMORY_KB << 10};
+
+// 🔹 Un lock propio: el servidor guarda con user_lock tomado (para no cruzarse con un
+// registro) y la E/S de disco ocurre solo con este
+static pthread_mutex_t offline_lock = PTHREAD_MUTEX_INITIALIZER;
+static OfflineQueue *buckets[OFFLINE_BUCKETS];
+static int recipient_count = 0;
+static size_t memory_bytes = 0;
+
+static uint64_t expiry_cutoff(uint64_t now)
+{
+    uint64_t age = (uint64_t)offline_config.max_age_s * 1000ull;
+    return now > age ? now - age : 0;
+}
+
+void offline_config_load(void)
+{
+    const char *dir = getenv("CHAT_OFFLINE_DIR");
+    if (dir && *dir)
+        snprintf(offline_config.dir, sizeof(offline_config.dir), "%s", dir);
+    offline_config.max_messages = env_int("CHAT_OFFLINE_MAX_MSGS", OFFLINE_MAX_MSGS, 1, 10000);
+    offline_config.max_bytes = (size_t)env_int("CHAT_OFFLINE_MAX_KB", OFFLINE_MAX_KB, 1, 65536) << 10;
+    // La bandeja se entrega de una vez al registrarse: tiene que entrar en una cola de envío
+    // junto con la historia sin pasar high_water (que cerraría la conexión en cada registro)
+    size_t fit = send_queue_config.high_water / 2;
+    if (offline_config.max_bytes > fit)
+    {
+        fprintf(stderr, "CHAT_OFFLINE_MAX_KB excede la mitad de CHAT_SEND_HIGH_WATER, se usa %zu\n", fit >> 10);
+        offline_config.max_bytes = fit;
+    }
+    offline_config.max_age_s = env_int("CHAT_OFFLINE_MAX_AGE_S", OFFLINE_MAX_AGE_S, 1, 30 * 86400);
+    offline_config.memory_budget = (size_t)env_int("CHAT_OFFLINE_MEMORY_KB", OFFLINE_MEMORY_KB, 0, 4 << 20) << 10;
+}
+
+// El nombre va en hexadecimal: puede traer caracteres que no sirven en un archivo
+static void queue_path(char *buf, size_t size, const char *username)
+{
+    int n = snprintf(buf, size, "%s/", offline_config.dir);
+    for (const unsigned char *p = (const unsigned char *)username; *p && n + 3 < (int)size; p++)
+        n += snprintf(buf + n, size - (size_t)n, "%02x", *p);
+    snprintf(buf + n, size - (size_t)n, ".q");
+}
+
+static int name_from_file(const char *file, char *name, size_t size)
+{
+    size_t len = strlen(file);
+    if (len < 4 || strcmp(file + len - 2, ".q") != 0 || (len - 2) % 2 != 0 || (len - 2) / 2 >= size)
+        return -1;
+    size_t n = 0;
+    for (size_t i = 0; i + 2 < len; i += 2)
+    {
+        unsigned int c;
+        if (sscanf(file + i, "%2x", &c) != 1 || c == 0)
+            return -1;
+        name[n++] = (char)c;
+    }
+    name[n] = '\0';
+    return 0;
+}
+
+static OfflineQueue **find_slot(const char *username)
+{
+    OfflineQueue **slot = &buckets[fnv1a_str(username) & (OFFLINE_BUCKETS - 1)];
+    while (*slot && strcmp((*slot)->username, username) != 0)
+        slot = &(*slot)->next;
+    return slot;
+}
+
+static OfflineQueue *get_queue(const char *username)
+{
+    OfflineQueue **slot = find_slot(username);
+    if (*slot)
+        return *slot;
+    if (recipient_count >= OFFLINE_MAX_RECIPIENTS)
+        return NULL;
+    OfflineQueue *q = calloc(1, sizeof(OfflineQueue));
+    if (!q)
+        return NULL;
+    snprintf(q->username, sizeof(q->username), "%s", username);
+    *slot = q;
+    recipient_count++;
+    return q;
+}
+
+static void drop_queue(OfflineQueue **slot)
+{
+    OfflineQueue *q = *slot;
+    *slot = q->next;
+    recipient_count--;
+    free(q);
+}
+
+static void push_back(OfflineMessages *m, OfflineMsg *msg)
+{
+    msg->next = NULL;
+    if (m->tail)
+        m->tail->next = msg;
+    else
+        m->head = msg;
+    m->tail = msg;
+    m->count++;
+    m->bytes += msg->len;
+}
+
+static OfflineMsg *pop_front(OfflineMessages *m)
+{
+    OfflineMsg *msg = m->head;
+    if (!msg)
+        return NULL;
+    m->head = msg->next;
+    if (!m->head)
+        m->tail = NULL;
+    m->count--;
+    m->bytes -= msg->len;
+    return msg;
+}
+
+// Mensaje de len bytes con su hora; con data NULL el contenido se llena después
+static OfflineMsg *msg_new(uint64_t time_ms, const char *data, size_t len)
+{
+    OfflineMsg *msg = malloc(sizeof(OfflineMsg) + len + 1);
+    if (!msg)
+        return NULL;
+    msg->next = NULL;
+    msg->time_ms = time_ms;
+    msg->len = len;
+    if (data)
+        memcpy(msg->data, data, len);
+    msg->data[len] = '\0';
+    return msg;
+}
+
+// Lee el archivo de la cola, agrega sus mensajes vigentes a out y lo borra
+static int load_spill(OfflineQueue *q, OfflineMessages *out, uint64_t cutoff)
+{
+    if (q->disk_count == 0)
+        return 0;
+
+    char path[sizeof(offline_config.dir) + 2 * sizeof(q->username) + 4];
+    queue_path(path, sizeof(path), q->username);
+    FILE *f = fopen(path, "rb");
+    if (!f)
+    {
+        LOG_ERROR("No se pudo leer la bandeja de %s: %s", q->username, strerror(errno));
+        return -1;
+    }
+
+    OfflineMessages loaded = {0};
+    SpillRecord r;
+    int ok = 1;
+    while (fread(&r, sizeof(r), 1, f) == 1 && r.len <= OFFLINE_MAX_RECORD)
+    {
+        OfflineMsg *msg = msg_new(r.time_ms, NULL, r.len);
+        if (!msg)
+        {
+            ok = 0;
+            break;
+        }
+        if (fread(msg->data, 1, r.len, f) != r.len)
+        {
+            free(msg); // Registro cortado al final del archivo
+            break;
+        }
+        if (r.time_ms < cutoff)
+            free(msg);
+        else
+            push_back(&loaded, msg);
+    }
+    fclose(f);
+
+    if (!ok)
+    {
+        // Sin memoria para leerlo entero: el archivo queda como estaba
+        offline_release(&loaded);
+        return -1;
+    }
+
+    unlink(path);
+    q->disk_count = 0;
+    q->disk_bytes = 0;
+    q->disk_newest_ms = 0;
+    while (loaded.head)
+        push_back(out, pop_front(&loaded));
+    return 0;
+}
+
+// Agrega la parte en memoria de q al final de su archivo
+static int spill_queue(OfflineQueue *q)
+{
+    char path[sizeof(offline_config.dir) + 2 * sizeof(q->username) + 4];
+    queue_path(path, sizeof(path), q->username);
+    int fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0600);
+    if (fd < 0)
+        return -1;
+
+    off_t end = lseek(fd, 0, SEEK_END);
+    int written = 0;
+    for (OfflineMsg *msg = q->mem.head; msg; msg = msg->next)
+    {
+        SpillRecord r = {msg->time_ms, (uint32_t)msg->len, 0};
+        struct iovec iov[2] = {{&r, sizeof(r)}, {msg->data, msg->len}};
+        if (writev(fd, iov, 2) != (ssize_t)(sizeof(r) + msg->len))
+        {
+            // Un registro a medias desordenaría todo lo que se agregue después
+            if (ftruncate(fd, end) < 0)
+                LOG_ERROR("Bandeja de %s dañada: %s", q->username, strerror(errno));
+            break;
+        }
+        end += (off_t)(sizeof(r) + msg->len);
+        written++;
+    }
+    close(fd);
+
+    // Lo que entró al archivo deja de estar en memoria; si algo falló, el resto sigue en
+    // memoria y sigue siendo posterior a lo escrito
+    for (int i = 0; i < written; i++)
+    {
+        OfflineMsg *msg = pop_front(&q->mem);
+        memory_bytes -= msg->len;
+        q->disk_count++;
+        q->disk_bytes += msg->len;
+        if (msg->time_ms > q->disk_newest_ms)
+            q->disk_newest_ms = msg->time_ms;
+        free(msg);
+    }
+    return q->mem.count == 0 ? 0 : -1;
+}
+
+int offline_init(void)
+{
+    if (mkdir(offline_config.dir, 0700) < 0 && errno != EEXIST)
+    {
+        LOG_ERROR("No se pudo crear %s: %s", offline_config.dir, strerror(errno));
+        return -1;
+    }
+    DIR *d = opendir(offline_config.dir);
+    if (!d)
+        return -1;
+
+    uint64_t cutoff = expiry_cutoff(realtime_ms());
+    int recovered = 0;
+    struct dirent *e;
+    pthread_mutex_lock(&offline_lock);
+    while ((e = readdir(d)) != NULL)
+    {
+        char name[50];
+        char path[sizeof(offline_config.dir) + 256 + 2];
+        if (name_from_file(e->d_name, name, sizeof(name)) < 0)
+            continue;
+        snprintf(path, sizeof(path), "%s/%s", offline_config.dir, e->d_name);
+        FILE *f = fopen(path, "rb");
+        if (!f)
+            continue;
+
+        // Solo se cuentan; los mensajes se leen recién cuando el destinatario vuelve
+        int count = 0;
+        size_t bytes = 0;
+        uint64_t newest = 0;
+        SpillRecord r;
+        while (fread(&r, sizeof(r), 1, f) == 1 && r.len <= OFFLINE_MAX_RECORD && fseek(f, (long)r.len, SEEK_CUR) == 0)
+        {
+            count++;
+            bytes += r.len;
+            if (r.time_ms > newest)
+                newest = r.time_ms;
+        }
+        fclose(f);
+
+        OfflineQueue *q = count > 0 && newest >= cutoff ? get_queue(name) : NULL;
+        if (!q)
+        {
+            unlink(path); // Vacía, vencida o sin lugar
+            continue;
+        }
+        q->disk_count = count;
+        q->disk_bytes = bytes;
+        q->disk_newest_ms = newest;
+        recovered++;
+    }
+    pthread_mutex_unlock(&offline_lock);
+    closedir(d);
+
+    if (recovered)
+        LOG_INFO("Bandejas recuperadas de %s: %d destinatarios con mensajes pendientes", offline_config.dir, recovered);
+    return 0;
+}
+
+int offline_store(const char *target, const char *msg, size_t len)
+{
+    OfflineMsg *m = msg_new(realtime_ms(), msg, len);
+    if (!m)
+        return -1;
+
+    pthread_mutex_lock(&offline_lock);
+    OfflineQueue *q = get_queue(target);
+    if (!q)
+    {
+        pthread_mutex_unlock(&offline_lock);
+        free(m);
+        return -1;
+    }
+
+    // Lo vencido en memoria no cuenta para el límite
+    uint64_t cutoff = expiry_cutoff(m->time_ms);
+    while (q->mem.head && q->mem.head->time_ms < cutoff)
+    {
+        OfflineMsg *old = pop_front(&q->mem);
+        memory_bytes -= old->len;
+        free(old);
+    }
+
+    if (q->disk_count + q->mem.count >= offline_config.max_messages ||
+        q->disk_bytes + q->mem.bytes + len > offline_config.max_bytes)
+    {
+        pthread_mutex_unlock(&offline_lock);
+        free(m);
+        return 0;
+    }
+    push_back(&q->mem, m);
+    memory_bytes += len;
+    pthread_mutex_unlock(&offline_lock);
+    return 1;
+}
+
+void offline_spill(void)
+{
+    pthread_mutex_lock(&offline_lock);
+    if (memory_bytes <= offline_config.memory_budget)
+    {
+        pthread_mutex_unlock(&offline_lock);
+        return;
+    }
+
+    // Se baja hasta la mitad del presupuesto para no recorrer la tabla en cada mensaje
+    size_t target = offline_config.memory_budget / 2;
+    int spilled = 0;
+    for (int b = 0; b < OFFLINE_BUCKETS && memory_bytes > target; b++)
+    {
+        for (OfflineQueue *q = buckets[b]; q && memory_bytes > target; q = q->next)
+        {
+            if (q->mem.count == 0)
+                continue;
+            if (spill_queue(q) < 0)
+            {
+                LOG_WARN("No se pudo pasar a disco la bandeja de %s: %s", q->username, strerror(errno));
+                b = OFFLINE_BUCKETS; // Disco con problemas: se reintenta con el próximo mensaje
+                break;
+            }
+            spilled++;
+        }
+    }
+    size_t left = memory_bytes;
+    pthread_mutex_unlock(&offline_lock);
+    LOG_DEBUG("Bandejas: %d pasadas a disco, %zu bytes siguen en memoria", spilled, left);
+}
+
+int offline_pending(const char *username)
+{
+    pthread_mutex_lock(&offline_lock);
+    int pending = *find_slot(username) != NULL;
+    pthread_mutex_unlock(&offline_lock);
+    return pending;
+}
+
+int offline_take(const char *username, OfflineMessages *out)
+{
+    memset(out, 0, sizeof(*out));
+    pthread_mutex_lock(&offline_lock);
+    OfflineQueue **slot = find_slot(username);
+    OfflineQueue *q = *slot;
+    if (!q)
+    {
+        pthread_mutex_unlock(&offline_lock);
+        return 0;
+    }
+
+    uint64_t cutoff = expiry_cutoff(realtime_ms());
+    if (load_spill(q, out, cutoff) < 0)
+    {
+        // Sin el archivo no se puede entregar en orden: queda todo para la próxima vez
+        pthread_mutex_unlock(&offline_lock);
+        return 0;
+    }
+    OfflineMsg *msg;
+    while ((msg = pop_front(&q->mem)) != NULL)
+    {
+        memory_bytes -= msg->len;
+        if (msg->time_ms < cutoff)
+            free(msg);
+        else
+            push_back(out, msg);
+    }
+    drop_queue(slot);
+    pthread_mutex_unlock(&offline_lock);
+    return out->count;
+}
+
+void offline_restore(const char *username, OfflineMessages *msgs)
+{
+    if (!msgs->head)
+        return;
+    pthread_mutex_lock(&offline_lock);
+    OfflineQueue *q = get_queue(username);
+    if (!q || load_spill(q, msgs, 0) < 0)
+    {
+        pthread_mutex_unlock(&offline_lock);
+        LOG_ERROR("Se perdieron %d mensajes pendientes de %s", msgs->count, username);
+        offline_release(msgs);
+        return;
+    }
+
+    // Lo devuelto es anterior a lo que haya llegado mientras tanto
+    while (q->mem.head)
+        push_back(msgs, pop_front(&q->mem));
+    q->mem = *msgs;
+    memory_bytes += msgs->bytes;
+    memset(msgs, 0, sizeof(*msgs));
+    pthread_mutex_unlock(&offline_lock);
+}
+
+void offline_release(OfflineMessages *msgs)
+{
+    OfflineMsg *msg;
+    while ((msg = pop_front(msgs)) != NULL)
+        free(msg);
+}
+
+void offline_expire(void)
+{
+    static uint64_t last_pass = 0;
+    uint64_t now = realtime_ms();
+    if (now - last_pass < 1000)
+        return;
+    last_pass = now;
+
+    uint64_t cutoff = expiry_cutoff(now);
+    char path[sizeof(offline_config.dir) + 2 * 50 + 4];
+    pthread_mutex_lock(&offline_lock);
+    for (int b = 0; b < OFFLINE_BUCKETS; b++)
+    {
+        OfflineQueue **slot = &buckets[b];
+        while (*slot)
+        {
+            OfflineQueue *q = *slot;
+            while (q->mem.head && q->mem.head->time_ms < cutoff)
+            {
+                OfflineMsg *msg = pop_front(&q->mem);
+                memory_bytes -= msg->len;
+                free(msg);
+            }
+            // Del archivo solo se sabe la hora del más nuevo: se borra cuando vence todo
+            if (q->disk_count && q->disk_newest_ms < cutoff)
+            {
+                queue_path(path, sizeof(path), q->username);
+                unlink(path);
+                q->disk_count = 0;
+                q->disk_bytes = 0;
+            }
+            if (q->mem.count == 0 && q->disk_count == 0)
+                drop_queue(slot);
+            else
+                slot = &q->next;
+        }
+    }
+    pthread_mutex_unlock(&offline_lock);
+}
@@ -0,0 +1,70 @@
+#ifndef OFFLINE_H
+#define OFFLINE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Bandejas de mensajes privados para usuarios desconectados (store-and-forward).
+// Cada destinatario tiene una cola con límite de mensajes, de bytes y de antigüedad; al
+// registrarse se le entrega entera y se borra. Cuando la memoria de todas las colas supera
+// el presupuesto, las colas pasan a un archivo por destinatario (<dir>/<nombre en hex>.q):
+// lo del archivo siempre es anterior a lo que queda en memoria, así que el orden se mantiene.
+// Los archivos sobreviven a un reinicio y se recuperan en offline_init.
+#define OFFLINE_BUCKETS 1024           // Cadenas de la tabla de destinatarios (potencia de 2)
+#define OFFLINE_MAX_RECIPIENTS 10000   // Destinatarios con mensajes pendientes
+
+typedef struct
+{
+    char dir[256];
+    int max_messages;     // Mensajes pendientes por destinatario
+    size_t max_bytes;     // Bytes pendientes por destinatario
+    int max_age_s;        // Antigüedad máxima de un mensaje pendiente
+    size_t memory_budget; // Bytes en memoria de todas las colas antes de pasar a disco
+} OfflineConfig;
+
+extern OfflineConfig offline_config;
+
+// Lee CHAT_OFFLINE_DIR, CHAT_OFFLINE_MAX_MSGS, CHAT_OFFLINE_MAX_KB, CHAT_OFFLINE_MAX_AGE_S y
+// CHAT_OFFLINE_MEMORY_KB. Los bytes por destinatario se limitan a la mitad de high_water:
+// llamar después de send_queue_config_load.
+void offline_config_load(void);
+// Crea el directorio y recupera las colas que quedaron en disco. -1 si no se pudo crear.
+int offline_init(void);
+
+typedef struct OfflineMsg
+{
+    struct OfflineMsg *next;
+    uint64_t time_ms; // Hora en que se guardó (ms desde la época)
+    size_t len;
+    char data[]; // Frame JSON tal como se habría enviado
+} OfflineMsg;
+
+typedef struct
+{
+    OfflineMsg *head;
+    OfflineMsg *tail;
+    int count;
+    size_t bytes;
+} OfflineMessages;
+
+// Guarda msg para target. Devuelve 1 si se guardó, 0 si la cola de target está llena y -1
+// si no hay memoria o se alcanzó OFFLINE_MAX_RECIPIENTS. Solo toca memoria.
+int offline_store(const char *target, const char *msg, size_t len);
+
+// 1 si username tiene mensajes pendientes (en memoria o en disco, también de una ejecución anterior).
+int offline_pending(const char *username);
+
+// Pasa colas a disco hasta volver por debajo del presupuesto. Hace E/S: llamar sin otros locks.
+void offline_spill(void);
+
+// Saca todos los mensajes vigentes de username (memoria y disco) en el orden en que llegaron.
+// Devuelve la cantidad; lo devuelto ya no está en el almacén.
+int offline_take(const char *username, OfflineMessages *out);
+// Devuelve al frente de la cola de username lo que no se pudo entregar.
+void offline_restore(const char *username, OfflineMessages *msgs);
+void offline_release(OfflineMessages *msgs);
+
+// Descarta los mensajes vencidos; como mucho una pasada por segundo.
+void offline_expire(void);
+
+#endif
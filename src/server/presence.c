@@ -0,0 +1,83 @@
+#include "presence.h"
+#include "common.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static void unlink_sub(PresenceSub *s)
+{
+    *s->pprev = s->next;
+    if (s->next)
+        s->next->pprev = s->pprev;
+}
+
+int presence_subscribe(PresenceIndex *idx, PresenceList *list, void *subscriber, const char *target)
+{
+    for (PresenceSub *s = list->head; s; s = s->owner_next)
+    {
+        if (strcmp(s->target, target) == 0)
+            return 0;
+    }
+    if (list->count >= PRESENCE_MAX_SUBS)
+        return -1;
+
+    PresenceSub *s = malloc(sizeof(PresenceSub));
+    if (!s)
+        return -1;
+    s->subscriber = subscriber;
+    s->hash = fnv1a_str(target);
+    snprintf(s->target, sizeof(s->target), "%s", target);
+
+    PresenceSub **head = &idx->buckets[s->hash & (PRESENCE_BUCKETS - 1)];
+    s->next = *head;
+    s->pprev = head;
+    if (*head)
+        (*head)->pprev = &s->next;
+    *head = s;
+
+    s->owner_next = list->head;
+    list->head = s;
+    list->count++;
+    return 1;
+}
+
+int presence_unsubscribe(PresenceList *list, const char *target)
+{
+    for (PresenceSub **link = &list->head; *link; link = &(*link)->owner_next)
+    {
+        PresenceSub *s = *link;
+        if (strcmp(s->target, target) == 0)
+        {
+            *link = s->owner_next;
+            unlink_sub(s);
+            list->count--;
+            free(s);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+void presence_unsubscribe_all(PresenceList *list)
+{
+    PresenceSub *s = list->head;
+    while (s)
+    {
+        PresenceSub *next = s->owner_next;
+        unlink_sub(s);
+        free(s);
+        s = next;
+    }
+    list->head = NULL;
+    list->count = 0;
+}
+
+void presence_for_each(const PresenceIndex *idx, const char *target, presence_visit_fn fn, void *arg)
+{
+    uint32_t h = fnv1a_str(target);
+    for (PresenceSub *s = idx->buckets[h & (PRESENCE_BUCKETS - 1)]; s; s = s->next)
+    {
+        if (s->hash == h && strcmp(s->target, target) == 0)
+            fn(s->subscriber, arg);
+    }
+}
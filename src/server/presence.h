@@ -0,0 +1,47 @@
+#ifndef PRESENCE_H
+#define PRESENCE_H
+
+#include <stdint.h>
+
+// Suscripciones de presencia: índice inverso de usuario observado -> suscriptores, para que
+// un status_update llegue solo a quien lo pidió. Cada suscripción es un nodo intrusivo que
+// vive a la vez en la cadena de su usuario observado (doble enlace, baja O(1)) y en la lista
+// de su suscriptor (para soltarlas todas al desconectarse). El observado no necesita estar
+// conectado. No es thread-safe; el servidor lo usa bajo user_lock.
+#define PRESENCE_BUCKETS 4096  // Cadenas del índice inverso (potencia de 2)
+#define PRESENCE_MAX_SUBS 256  // Suscripciones máximas por suscriptor
+
+typedef struct PresenceSub
+{
+    struct PresenceSub *next;    // Siguiente en la cadena del bucket
+    struct PresenceSub **pprev;  // Enlace que apunta a este nodo en la cadena
+    struct PresenceSub *owner_next; // Siguiente suscripción del mismo suscriptor
+    void *subscriber;
+    uint32_t hash;
+    char target[50];
+} PresenceSub;
+
+// Suscripciones de un suscriptor
+typedef struct
+{
+    PresenceSub *head;
+    int count;
+} PresenceList;
+
+typedef struct
+{
+    PresenceSub *buckets[PRESENCE_BUCKETS];
+} PresenceIndex;
+
+// Devuelve 1 si se agregó, 0 si ya existía y -1 si se alcanzó PRESENCE_MAX_SUBS o no hay memoria.
+int presence_subscribe(PresenceIndex *idx, PresenceList *list, void *subscriber, const char *target);
+// Devuelve 1 si existía.
+int presence_unsubscribe(PresenceList *list, const char *target);
+void presence_unsubscribe_all(PresenceList *list);
+
+typedef void (*presence_visit_fn)(void *subscriber, void *arg);
+
+// Llama a fn por cada suscriptor de target. fn no debe modificar el índice.
+void presence_for_each(const PresenceIndex *idx, const char *target, presence_visit_fn fn, void *arg);
+
+#endif
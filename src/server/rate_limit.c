@@ -0,0 +1,209 @@
+#include "rate_limit.h"
+#include "common.h"
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define RATE_MSGS 20        // Mensajes por segundo por conexión
+#define RATE_BURST 40
+#define RATE_KBPS 64        // KB por segundo por conexión
+#define RATE_BURST_KB 256   // Debe admitir al menos un mensaje de RX_MAX_MESSAGE
+#define RATE_SNIFF_BYTES 128 // "type" suele ser la primera clave
+
+RateConfig rate_config = {
+    {RATE_MSGS, RATE_BURST},
+    {RATE_KBPS << 10, RATE_BURST_KB << 10},
+    {
+        // Los tipos caros (difusión, listados) tienen su propio límite por defecto
+        [MSG_REGISTER] = {2, 4},
+        [MSG_BROADCAST] = {5, 10},
+        [MSG_PRIVATE] = {10, 20},
+        [MSG_ROOM_MESSAGE] = {10, 20},
+        [MSG_LIST_USERS] = {2, 4},
+        [MSG_USER_INFO] = {5, 10},
+    },
+};
+
+// "tasa" o "tasa:ráfaga"; sin ráfaga se usa el doble de la tasa
+static void load_spec(const char *name, RateSpec *spec)
+{
+    const char *value = getenv(name);
+    if (!value || !*value)
+        return;
+    char *end;
+    long rate = strtol(value, &end, 10);
+    long burst = rate * 2;
+    if (*end == ':')
+        burst = strtol(end + 1, &end, 10);
+    if (*end != '\0' || rate < 0 || rate > 1000000 || burst < (rate > 0) || burst > 2000000)
+    {
+        fprintf(stderr, "%s inválido (tasa o tasa:ráfaga), se usa %u:%u\n", name, spec->rate, spec->burst);
+        return;
+    }
+    spec->rate = (uint32_t)rate;
+    spec->burst = (uint32_t)burst;
+}
+
+void rate_config_load(void)
+{
+    rate_config.messages.rate = (uint32_t)env_int("CHAT_RATE_MSGS", RATE_MSGS, 0, 100000);
+    rate_config.messages.burst = (uint32_t)env_int("CHAT_RATE_BURST", RATE_BURST, 1, 200000);
+    rate_config.bytes.rate = (uint32_t)env_int("CHAT_RATE_KBPS", RATE_KBPS, 0, 1 << 20) << 10;
+    rate_config.bytes.burst = (uint32_t)env_int("CHAT_RATE_BURST_KB", RATE_BURST_KB, 64, 1 << 20) << 10;
+
+    for (int t = MSG_REGISTER; t < MSG_REGISTER_SUCCESS; t++)
+    {
+        char name[64] = "CHAT_RATE_";
+        size_t n = strlen(name);
+        for (const char *p = msg_type_name((MsgType)t); *p && n + 1 < sizeof(name); p++)
+            name[n++] = (char)toupper((unsigned char)*p);
+        name[n] = '\0';
+        load_spec(name, &rate_config.per_type[t]);
+    }
+}
+
+// Recarga el bucket hasta now; con rate == 0 no hay límite
+static void refill(TokenBucket *b, const RateSpec *spec, uint64_t now_ms)
+{
+    int64_t cap = (int64_t)spec->burst * 1000;
+    if (b->last_ms == 0)
+    {
+        b->milli = cap;
+        b->last_ms = now_ms;
+        return;
+    }
+    if (now_ms <= b->last_ms)
+        return;
+    // Por segundo entran rate tokens: rate milésimas por milisegundo
+    b->milli += (int64_t)(now_ms - b->last_ms) * spec->rate;
+    if (b->milli > cap)
+        b->milli = cap;
+    b->last_ms = now_ms;
+}
+
+// Milisegundos hasta que el bucket llegue a need milésimas
+static int wait_for(const TokenBucket *b, const RateSpec *spec, int64_t need)
+{
+    int64_t missing = need - b->milli;
+    if (missing <= 0)
+        return 0;
+    int64_t ms = (missing + spec->rate - 1) / spec->rate;
+    return ms > 60000 ? 60000 : (int)ms;
+}
+
+int rate_charge_bytes(RateLimiter *r, size_t len, uint64_t now_ms)
+{
+    const RateSpec *spec = &rate_config.bytes;
+    if (spec->rate == 0)
+        return 0;
+    refill(&r->bytes, spec, now_ms);
+    r->bytes.milli -= (int64_t)len * 1000;
+    return wait_for(&r->bytes, spec, 0);
+}
+
+int rate_take_message(RateLimiter *r, MsgType type, uint64_t now_ms)
+{
+    const RateSpec *global = &rate_config.messages;
+    const RateSpec *typed = type > MSG_UNKNOWN && type < MSG_TYPE_COUNT ? &rate_config.per_type[type] : NULL;
+    if (typed && typed->rate == 0)
+        typed = NULL;
+
+    int wait = 0;
+    if (global->rate)
+    {
+        refill(&r->messages, global, now_ms);
+        wait = wait_for(&r->messages, global, 1000);
+    }
+    if (typed)
+    {
+        TokenBucket *b = &r->per_type[type];
+        refill(b, typed, now_ms);
+        int typed_wait = wait_for(b, typed, 1000);
+        if (typed_wait > wait)
+            wait = typed_wait;
+    }
+    if (wait > 0)
+    {
+        r->limited++;
+        return wait;
+    }
+
+    // Solo se descuenta si todos los buckets que aplican tienen lugar
+    if (global->rate)
+        r->messages.milli -= 1000;
+    if (typed)
+        r->per_type[type].milli -= 1000;
+    r->charged = type;
+    return 0;
+}
+
+int rate_take_decoded(RateLimiter *r, MsgType type, uint64_t now_ms)
+{
+    if (type == r->charged || type <= MSG_UNKNOWN || type >= MSG_TYPE_COUNT)
+        return 0;
+    const RateSpec *typed = &rate_config.per_type[type];
+    if (typed->rate == 0)
+        return 0;
+
+    TokenBucket *b = &r->per_type[type];
+    refill(b, typed, now_ms);
+    int wait = wait_for(b, typed, 1000);
+    if (wait > 0)
+    {
+        r->limited++;
+        return wait;
+    }
+    b->milli -= 1000;
+    r->charged = type;
+    return 0;
+}
+
+static const char *find_bytes(const char *hay, size_t len, const char *needle, size_t n)
+{
+    for (size_t i = 0; i + n <= len; i++)
+    {
+        if (hay[i] == needle[0] && memcmp(hay + i, needle, n) == 0)
+            return hay + i;
+    }
+    return NULL;
+}
+
+MsgType rate_sniff_type(const char *msg, size_t len, int binary)
+{
+    if (len > RATE_SNIFF_BYTES)
+        len = RATE_SNIFF_BYTES;
+    const char *end = msg + len;
+
+    if (binary)
+    {
+        // Clave fixstr "type" seguida de un fixstr o str8 con el valor
+        const char *p = find_bytes(msg, len, "\xa4type", 5);
+        if (!p || (p += 5) >= end)
+            return MSG_UNKNOWN;
+        size_t n;
+        unsigned char h = (unsigned char)*p++;
+        if ((h & 0xe0) == 0xa0)
+            n = h & 0x1f;
+        else if (h == 0xd9 && p < end)
+            n = (unsigned char)*p++;
+        else
+            return MSG_UNKNOWN;
+        return (size_t)(end - p) >= n ? msg_type_lookup(p, n) : MSG_UNKNOWN;
+    }
+
+    const char *p = find_bytes(msg, len, "\"type\"", 6);
+    if (!p)
+        return MSG_UNKNOWN;
+    p += 6;
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n'))
+        p++;
+    if (p >= end || *p++ != ':')
+        return MSG_UNKNOWN;
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n'))
+        p++;
+    if (p >= end || *p++ != '"')
+        return MSG_UNKNOWN;
+    const char *q = memchr(p, '"', (size_t)(end - p));
+    return q ? msg_type_lookup(p, (size_t)(q - p)) : MSG_UNKNOWN;
+}
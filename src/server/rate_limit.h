@@ -0,0 +1,70 @@
+#ifndef RATE_LIMIT_H
+#define RATE_LIMIT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "msg_types.h"
+
+// Límites por conexión con token buckets: uno de mensajes, uno de bytes y, opcionalmente,
+// uno por tipo de mensaje. Se consultan en LWS_CALLBACK_RECEIVE antes de decodificar nada:
+// los bytes con cada fragmento y los mensajes (y su tipo, leído con un vistazo al comienzo
+// del mensaje) cuando el mensaje está completo. Si el vistazo no acierta, el límite del tipo
+// se cobra después de decodificar (rate_take_decoded). Quien se pasa deja de ser leído
+// (lws_rx_flow_control) hasta que le alcancen los tokens.
+
+// Tasa por segundo y ráfaga máxima; rate == 0 = sin límite
+typedef struct
+{
+    uint32_t rate;
+    uint32_t burst;
+} RateSpec;
+
+typedef struct
+{
+    RateSpec messages;
+    RateSpec bytes;
+    RateSpec per_type[MSG_TYPE_COUNT];
+} RateConfig;
+
+extern RateConfig rate_config;
+
+// Lee CHAT_RATE_MSGS y CHAT_RATE_BURST (mensajes por segundo y ráfaga), CHAT_RATE_KBPS y
+// CHAT_RATE_BURST_KB (bytes) y CHAT_RATE_<TIPO> ("tasa" o "tasa:ráfaga", p. ej.
+// CHAT_RATE_BROADCAST=5:10) para cada tipo de mensaje de cliente.
+void rate_config_load(void);
+
+// Tokens en milésimas para no perder fracciones al recargar por milisegundo
+typedef struct
+{
+    int64_t milli;
+    uint64_t last_ms; // 0 = todavía sin usar (arranca lleno)
+} TokenBucket;
+
+typedef struct
+{
+    TokenBucket messages;
+    TokenBucket bytes;
+    TokenBucket per_type[MSG_TYPE_COUNT];
+    MsgType charged;       // Tipo que cobró el último rate_take_message
+    int paused;            // Lectura detenida esperando tokens
+    unsigned long limited; // Mensajes descartados por exceder el límite
+} RateLimiter;
+
+// Descuenta len bytes (el fragmento ya se leyó, así que puede quedar en deuda). Devuelve los
+// ms que hay que dejar de leer para saldar la deuda, o 0.
+int rate_charge_bytes(RateLimiter *r, size_t len, uint64_t now_ms);
+
+// Descuenta un mensaje de tipo type si hay tokens y devuelve 0; si no, no descuenta nada y
+// devuelve los ms hasta que haya uno.
+int rate_take_message(RateLimiter *r, MsgType type, uint64_t now_ms);
+
+// Ya decodificado el mensaje: si su tipo no es el que cobró rate_take_message (el vistazo no
+// encontró la clave o leyó otra), descuenta del bucket de type. Devuelve 0, o los ms hasta
+// que haya un token sin descontar nada.
+int rate_take_decoded(RateLimiter *r, MsgType type, uint64_t now_ms);
+
+// Tipo de un mensaje sin decodificarlo: busca la clave "type" en los primeros bytes
+// (JSON o MessagePack). MSG_UNKNOWN si no la encuentra.
+MsgType rate_sniff_type(const char *msg, size_t len, int binary);
+
+#endif
@@ -0,0 +1,272 @@
+#include "response_writer.h"
+#include "server.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define WRITER_INITIAL_CAP 4096
+
+static __thread JsonWriter thread_writer;
+
+JsonWriter *json_writer_begin(void)
+{
+    JsonWriter *w = &thread_writer;
+    w->len = 0;
+    w->failed = 0;
+    return w;
+}
+
+static int reserve(JsonWriter *w, size_t extra)
+{
+    if (w->failed)
+        return -1;
+    if (w->len + extra <= w->cap)
+        return 0;
+
+    size_t cap = w->cap ? w->cap : WRITER_INITIAL_CAP;
+    while (cap < w->len + extra)
+        cap *= 2;
+    unsigned char *buf = realloc(w->buf, LWS_PRE + cap);
+    if (!buf)
+    {
+        w->failed = 1;
+        return -1;
+    }
+    w->buf = buf;
+    w->cap = cap;
+    return 0;
+}
+
+void jw_raw(JsonWriter *w, const char *s, size_t n)
+{
+    if (n == 0 || reserve(w, n) < 0)
+        return;
+    memcpy(w->buf + LWS_PRE + w->len, s, n);
+    w->len += n;
+}
+
+void jw_str(JsonWriter *w, const char *s)
+{
+    jw_lit(w, "\"");
+    const char *run = s;
+    for (; *s; s++)
+    {
+        unsigned char c = (unsigned char)*s;
+        if (c >= 0x20 && c != '"' && c != '\\')
+            continue;
+
+        // 🔹 Se copia el tramo sin escapes de una vez y solo se traduce el carácter especial
+        jw_raw(w, run, (size_t)(s - run));
+        run = s + 1;
+        switch (c)
+        {
+        case '"': jw_lit(w, "\\\""); break;
+        case '\\': jw_lit(w, "\\\\"); break;
+        case '\b': jw_lit(w, "\\b"); break;
+        case '\f': jw_lit(w, "\\f"); break;
+        case '\n': jw_lit(w, "\\n"); break;
+        case '\r': jw_lit(w, "\\r"); break;
+        case '\t': jw_lit(w, "\\t"); break;
+        default:
+        {
+            char esc[8];
+            snprintf(esc, sizeof(esc), "\\u%04x", c);
+            jw_raw(w, esc, 6);
+        }
+        }
+    }
+    jw_raw(w, run, (size_t)(s - run));
+    jw_lit(w, "\"");
+}
+
+void jw_u64(JsonWriter *w, uint64_t v)
+{
+    char digits[20];
+    int n = 0;
+    do
+    {
+        digits[sizeof(digits) - 1 - n++] = (char)('0' + v % 10);
+        v /= 10;
+    } while (v);
+    jw_raw(w, digits + sizeof(digits) - n, (size_t)n);
+}
+
+int json_writer_send(JsonWriter *w, struct lws *wsi)
+{
+    // 🔹 Pasa por la cola como cualquier otro envío: lws_write solo se llama en WRITEABLE
+    Frame *frame = json_writer_frame(w);
+    if (!frame)
+        return -1;
+    int rc = send_frame(wsi, frame);
+    frame_unref(frame);
+    return rc;
+}
+
+Frame *json_writer_frame(JsonWriter *w)
+{
+    if (w->failed || w->len == 0)
+        return NULL;
+    return frame_new(jw_payload(w), w->len);
+}
+
+static void end_with_timestamp(JsonWriter *w, const char *timestamp)
+{
+    jw_lit(w, ",\"timestamp\":");
+    jw_str(w, timestamp);
+    jw_lit(w, "}");
+}
+
+void resp_error(JsonWriter *w, const char *desc, const char *timestamp)
+{
+    jw_lit(w, "{\"type\":\"error\",\"sender\":\"server\",\"content\":");
+    jw_str(w, desc);
+    end_with_timestamp(w, timestamp);
+}
+
+void resp_server(JsonWriter *w, const char *content, const char *timestamp)
+{
+    jw_lit(w, "{\"type\":\"server\",\"sender\":\"server\",\"content\":");
+    jw_str(w, content);
+    end_with_timestamp(w, timestamp);
+}
+
+void resp_broadcast(JsonWriter *w, const char *sender, const char *content, const char *timestamp)
+{
+    jw_lit(w, "{\"type\":\"broadcast\",\"sender\":");
+    jw_str(w, sender);
+    jw_lit(w, ",\"content\":");
+    jw_str(w, content);
+    end_with_timestamp(w, timestamp);
+}
+
+void resp_private(JsonWriter *w, const char *sender, const char *target, const char *content, const char *timestamp)
+{
+    jw_lit(w, "{\"type\":\"private\",\"sender\":");
+    jw_str(w, sender);
+    jw_lit(w, ",\"target\":");
+    jw_str(w, target);
+    jw_lit(w, ",\"content\":");
+    jw_str(w, content);
+    end_with_timestamp(w, timestamp);
+}
+
+void resp_room_message(JsonWriter *w, const char *sender, const char *room, const char *content, const char *timestamp)
+{
+    jw_lit(w, "{\"type\":\"room_message\",\"sender\":");
+    jw_str(w, sender);
+    jw_lit(w, ",\"target\":");
+    jw_str(w, room);
+    jw_lit(w, ",\"content\":");
+    jw_str(w, content);
+    end_with_timestamp(w, timestamp);
+}
+
+void resp_status_update(JsonWriter *w, const char *user, const char *status, const char *timestamp)
+{
+    jw_lit(w, "{\"type\":\"status_update\",\"sender\":\"server\",\"content\":{\"user\":");
+    jw_str(w, user);
+    jw_lit(w, ",\"status\":");
+    jw_str(w, status);
+    jw_lit(w, "}");
+    end_with_timestamp(w, timestamp);
+}
+
+void resp_user_disconnected(JsonWriter *w, const char *user, const char *timestamp)
+{
+    // content = "<user> ha salido": se escapa el nombre y se cierra la cadena a mano
+    jw_lit(w, "{\"type\":\"user_disconnected\",\"sender\":\"server\",\"content\":");
+    jw_str(w, user);
+    if (!w->failed)
+        w->len--; // Quita la comilla de cierre
+    jw_lit(w, " ha salido\"");
+    end_with_timestamp(w, timestamp);
+}
+
+void resp_user_info(JsonWriter *w, const char *target, const char *ip, const char *status, const char *timestamp)
+{
+    jw_lit(w, "{\"type\":\"user_info_response\",\"sender\":\"server\",\"target\":");
+    jw_str(w, target);
+    if (ip)
+    {
+        jw_lit(w, ",\"content\":{\"ip\":");
+        jw_str(w, ip);
+        jw_lit(w, ",\"status\":");
+        jw_str(w, status);
+        jw_lit(w, "}");
+    }
+    else
+    {
+        jw_lit(w, ",\"content\":{\"error\":\"Usuario no encontrado\"}");
+    }
+    end_with_timestamp(w, timestamp);
+}
+
+void resp_register_success_begin(JsonWriter *w)
+{
+    jw_lit(w, "{\"type\":\"register_success\",\"sender\":\"server\",\"content\":\"Registro exitoso\",\"userList\":[");
+}
+
+void resp_list_users_begin(JsonWriter *w)
+{
+    jw_lit(w, "{\"type\":\"list_users_response\",\"sender\":\"server\",\"content\":[");
+}
+
+void resp_user_list_item(JsonWriter *w, const char *username, int first)
+{
+    if (!first)
+        jw_lit(w, ",");
+    jw_str(w, username);
+}
+
+void resp_user_list_end(JsonWriter *w, uint64_t version, const char *timestamp)
+{
+    jw_lit(w, "],\"version\":");
+    jw_u64(w, version);
+    end_with_timestamp(w, timestamp);
+}
+
+void resp_list_users_delta_begin(JsonWriter *w)
+{
+    jw_lit(w, "{\"type\":\"list_users_delta\",\"sender\":\"server\",\"content\":[");
+}
+
+void resp_roster_change(JsonWriter *w, const char *op, const char *username, const char *status, int first)
+{
+    jw_raw(w, first ? "{\"op\":" : ",{\"op\":", first ? 6 : 7);
+    jw_str(w, op);
+    jw_lit(w, ",\"user\":");
+    jw_str(w, username);
+    if (status)
+    {
+        jw_lit(w, ",\"status\":");
+        jw_str(w, status);
+    }
+    jw_lit(w, "}");
+}
+
+void resp_list_users_delta_end(JsonWriter *w, uint64_t since, uint64_t version, const char *timestamp)
+{
+    jw_lit(w, "],\"since\":");
+    jw_u64(w, since);
+    jw_lit(w, ",\"version\":");
+    jw_u64(w, version);
+    end_with_timestamp(w, timestamp);
+}
+
+void resp_batch_begin(JsonWriter *w)
+{
+    jw_lit(w, "{\"type\":\"batch\",\"sender\":\"server\",\"content\":[");
+}
+
+void resp_batch_item(JsonWriter *w, const char *event, size_t len, int first)
+{
+    if (!first)
+        jw_lit(w, ",");
+    jw_raw(w, event, len);
+}
+
+void resp_batch_end(JsonWriter *w, const char *timestamp)
+{
+    jw_lit(w, "]");
+    end_with_timestamp(w, timestamp);
+}
@@ -0,0 +1,71 @@
+#ifndef RESPONSE_WRITER_H
+#define RESPONSE_WRITER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <libwebsockets.h>
+#include "send_queue.h"
+
+// Escritor de respuestas JSON del servidor. Cada hilo reutiliza un único buffer con
+// LWS_PRE bytes de cabecera, así que armar y enviar una respuesta no reserva memoria
+// (salvo cuando el buffer tiene que crecer). Las partes fijas de cada tipo de mensaje son
+// fragmentos constantes; solo se escapan los campos variables. La salida es idéntica a la
+// de cJSON_PrintUnformatted con el mismo orden de claves.
+typedef struct
+{
+    unsigned char *buf; // LWS_PRE + cap bytes
+    size_t cap;
+    size_t len;
+    int failed; // Sin memoria al crecer: la respuesta se descarta
+} JsonWriter;
+
+// Devuelve el escritor del hilo actual, vacío.
+JsonWriter *json_writer_begin(void);
+
+void jw_raw(JsonWriter *w, const char *s, size_t n);
+#define jw_lit(w, lit) jw_raw((w), (lit), sizeof(lit) - 1)
+// Cadena JSON entre comillas, escapando solo lo necesario.
+void jw_str(JsonWriter *w, const char *s);
+// Entero sin signo en decimal.
+void jw_u64(JsonWriter *w, uint64_t v);
+
+static inline char *jw_payload(JsonWriter *w)
+{
+    return (char *)w->buf + LWS_PRE;
+}
+
+// Encola el contenido en la cola de envío de wsi (una copia a un Frame; la versión binaria
+// se arma al escribir). Devuelve -1 si falló.
+int json_writer_send(JsonWriter *w, struct lws *wsi);
+// Copia el contenido a un Frame compartible (una sola reserva), o NULL si no hay memoria.
+Frame *json_writer_frame(JsonWriter *w);
+
+// Plantillas por tipo de mensaje
+void resp_error(JsonWriter *w, const char *desc, const char *timestamp);
+void resp_server(JsonWriter *w, const char *content, const char *timestamp);
+void resp_broadcast(JsonWriter *w, const char *sender, const char *content, const char *timestamp);
+void resp_private(JsonWriter *w, const char *sender, const char *target, const char *content, const char *timestamp);
+void resp_room_message(JsonWriter *w, const char *sender, const char *room, const char *content, const char *timestamp);
+void resp_status_update(JsonWriter *w, const char *user, const char *status, const char *timestamp);
+void resp_user_disconnected(JsonWriter *w, const char *user, const char *timestamp);
+// ip NULL indica que el usuario no existe
+void resp_user_info(JsonWriter *w, const char *target, const char *ip, const char *status, const char *timestamp);
+
+// Respuestas con lista de usuarios: begin, un item por usuario y end con la versión de la lista
+void resp_register_success_begin(JsonWriter *w);
+void resp_list_users_begin(JsonWriter *w);
+void resp_user_list_item(JsonWriter *w, const char *username, int first);
+void resp_user_list_end(JsonWriter *w, uint64_t version, const char *timestamp);
+
+// Cambios de la lista desde la versión since: begin, un item por cambio y end.
+// op es "join", "leave" o "status"; status solo se escribe para "status".
+void resp_list_users_delta_begin(JsonWriter *w);
+void resp_roster_change(JsonWriter *w, const char *op, const char *username, const char *status, int first);
+void resp_list_users_delta_end(JsonWriter *w, uint64_t since, uint64_t version, const char *timestamp);
+
+// Lote de eventos: begin, un item por evento (el JSON ya armado de cada uno) y end
+void resp_batch_begin(JsonWriter *w);
+void resp_batch_item(JsonWriter *w, const char *event, size_t len, int first);
+void resp_batch_end(JsonWriter *w, const char *timestamp);
+
+#endif
@@ -0,0 +1,174 @@
+#include "rooms.h"
+#include "common.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static Room *buckets[ROOM_BUCKETS];
+static pthread_mutex_t stripes[ROOM_LOCK_STRIPES];
+static pthread_once_t stripes_once = PTHREAD_ONCE_INIT;
+
+static void init_stripes(void)
+{
+    for (int i = 0; i < ROOM_LOCK_STRIPES; i++)
+        pthread_mutex_init(&stripes[i], NULL);
+}
+
+// Un bucket siempre cae en la misma franja porque ROOM_LOCK_STRIPES divide a ROOM_BUCKETS
+static pthread_mutex_t *stripe_for(uint32_t hash)
+{
+    return &stripes[hash & (ROOM_LOCK_STRIPES - 1)];
+}
+
+Room *room_ref(Room *room)
+{
+    atomic_fetch_add_explicit(&room->refs, 1, memory_order_relaxed);
+    return room;
+}
+
+void room_unref(Room *room)
+{
+    if (atomic_fetch_sub_explicit(&room->refs, 1, memory_order_acq_rel) != 1)
+        return;
+    for (int s = 0; s < MAX_SHARDS; s++)
+        free(room->shards[s].members);
+    free(room);
+}
+
+// Suma un miembro a la sala name (creándola) y la devuelve, o NULL si no hay memoria
+static Room *acquire_room(const char *name, int *members)
+{
+    pthread_once(&stripes_once, init_stripes);
+    uint32_t h = fnv1a_str(name);
+    pthread_mutex_t *lock = stripe_for(h);
+
+    pthread_mutex_lock(lock);
+    Room **slot = &buckets[h & (ROOM_BUCKETS - 1)];
+    Room *room = *slot;
+    while (room && (room->hash != h || strcmp(room->name, name) != 0))
+        room = room->next;
+    if (!room)
+    {
+        room = calloc(1, sizeof(Room));
+        if (!room)
+        {
+            pthread_mutex_unlock(lock);
+            return NULL;
+        }
+        room->hash = h;
+        atomic_init(&room->refs, 1);
+        snprintf(room->name, sizeof(room->name), "%s", name);
+        room->next = *slot;
+        *slot = room;
+    }
+    *members = ++room->members;
+    pthread_mutex_unlock(lock);
+    return room;
+}
+
+// Resta un miembro; al salir el último se saca de la tabla y se suelta su referencia
+static void release_room(Room *room)
+{
+    pthread_mutex_t *lock = stripe_for(room->hash);
+    int empty = 0;
+    pthread_mutex_lock(lock);
+    if (--room->members == 0)
+    {
+        Room **slot = &buckets[room->hash & (ROOM_BUCKETS - 1)];
+        while (*slot != room)
+            slot = &(*slot)->next;
+        *slot = room->next;
+        empty = 1;
+    }
+    pthread_mutex_unlock(lock);
+    if (empty)
+        room_unref(room);
+}
+
+Room *room_joined(const RoomSet *set, const char *name)
+{
+    for (int i = 0; i < set->count; i++)
+    {
+        if (strcmp(set->slots[i].room->name, name) == 0)
+            return set->slots[i].room;
+    }
+    return NULL;
+}
+
+int room_join(RoomSet *set, int shard, struct lws *wsi, const char *name, int *members)
+{
+    if (room_joined(set, name))
+        return 0;
+    if (set->count >= ROOM_MAX_JOINED)
+        return -1;
+
+    Room *room = acquire_room(name, members);
+    if (!room)
+        return -1;
+
+    RoomShard *rs = &room->shards[shard];
+    int count = atomic_load_explicit(&rs->count, memory_order_relaxed);
+    if (count == rs->cap)
+    {
+        int cap = rs->cap ? rs->cap * 2 : 16;
+        ShardConn *grown = realloc(rs->members, (size_t)cap * sizeof(ShardConn));
+        if (!grown)
+        {
+            release_room(room);
+            return -1;
+        }
+        rs->members = grown;
+        rs->cap = cap;
+    }
+
+    RoomSlot *slot = &set->slots[set->count++];
+    slot->room = room;
+    slot->pos = count;
+    rs->members[count].wsi = wsi;
+    rs->members[count].pos = &slot->pos;
+    atomic_store_explicit(&rs->count, count + 1, memory_order_relaxed);
+    return 1;
+}
+
+static void leave_slot(RoomSet *set, int shard, int i)
+{
+    Room *room = set->slots[i].room;
+    RoomShard *rs = &room->shards[shard];
+
+    // 🔹 Baja O(1): el último miembro del shard ocupa el lugar del que sale
+    int last = atomic_load_explicit(&rs->count, memory_order_relaxed) - 1;
+    int pos = set->slots[i].pos;
+    rs->members[pos] = rs->members[last];
+    *rs->members[pos].pos = pos;
+    atomic_store_explicit(&rs->count, last, memory_order_relaxed);
+
+    // Lo mismo en el conjunto de la conexión; la sala movida necesita su nuevo puntero
+    set->slots[i] = set->slots[--set->count];
+    if (i < set->count)
+    {
+        RoomSlot *moved = &set->slots[i];
+        moved->room->shards[shard].members[moved->pos].pos = &moved->pos;
+    }
+
+    release_room(room);
+}
+
+int room_leave(RoomSet *set, int shard, const char *name)
+{
+    for (int i = 0; i < set->count; i++)
+    {
+        if (strcmp(set->slots[i].room->name, name) == 0)
+        {
+            leave_slot(set, shard, i);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+void room_leave_all(RoomSet *set, int shard)
+{
+    while (set->count > 0)
+        leave_slot(set, shard, set->count - 1);
+}
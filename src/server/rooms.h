@@ -0,0 +1,68 @@
+#ifndef ROOMS_H
+#define ROOMS_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include "shard.h"
+
+// Salas con nombre. Cada sala guarda a sus miembros repartidos por shard: la lista de un
+// shard solo la modifica y la recorre su hilo dueño (las altas y bajas llegan por las
+// conexiones de ese hilo y el reparto se hace vaciando su buzón), así que un mensaje a la
+// sala cuesta O(miembros) y unirse o salir no toma ningún lock global. La tabla de salas
+// usa locks por franja solo para crear, encontrar y borrar salas.
+#define ROOM_BUCKETS 4096       // Cadenas de la tabla de salas (potencia de 2)
+#define ROOM_LOCK_STRIPES 64    // Locks de la tabla; divide a ROOM_BUCKETS
+#define ROOM_NAME_MAX 64        // Incluye el '\0'
+#define ROOM_MAX_JOINED 32      // Salas por conexión
+
+typedef struct
+{
+    ShardConn *members; // Conexiones de este shard; pos apunta a RoomSlot.pos
+    _Atomic int count;  // Lo escribe solo el dueño; los demás lo leen para saber si postear
+    int cap;
+} RoomShard;
+
+typedef struct Room
+{
+    struct Room *next; // Cadena del bucket
+    uint32_t hash;
+    atomic_int refs;   // Una de la tabla mientras tenga miembros, más una por entrada de buzón
+    int members;       // Total de miembros; con el lock de la franja
+    RoomShard shards[MAX_SHARDS];
+    char name[ROOM_NAME_MAX];
+} Room;
+
+// Salas de una conexión (en SessionData)
+typedef struct
+{
+    Room *room;
+    int pos; // Índice en room->shards[shard].members
+} RoomSlot;
+
+typedef struct
+{
+    RoomSlot slots[ROOM_MAX_JOINED];
+    int count;
+} RoomSet;
+
+// Une wsi (del shard del hilo actual) a la sala name, creándola si no existe. Devuelve 1 si
+// se unió, 0 si ya estaba y -1 si alcanzó ROOM_MAX_JOINED o no hay memoria. *members queda
+// con el total de miembros después de unirse.
+int room_join(RoomSet *set, int shard, struct lws *wsi, const char *name, int *members);
+// Devuelve 1 si era miembro. La sala se borra cuando sale el último.
+int room_leave(RoomSet *set, int shard, const char *name);
+void room_leave_all(RoomSet *set, int shard);
+
+// Sala name si la conexión es miembro (sigue viva mientras lo sea), o NULL.
+Room *room_joined(const RoomSet *set, const char *name);
+
+Room *room_ref(Room *room);
+void room_unref(Room *room);
+
+// Miembros de la sala en shard; exacto solo desde el hilo dueño.
+static inline int room_shard_count(Room *room, int shard)
+{
+    return atomic_load_explicit(&room->shards[shard].count, memory_order_relaxed);
+}
+
+#endif
@@ -0,0 +1,24 @@
+#include "roster.h"
+#include <stdio.h>
+
+void roster_log_init(RosterLog *log, uint64_t base)
+{
+    log->base = base;
+    log->version = base;
+}
+
+uint64_t roster_log_record(RosterLog *log, RosterOp op, const char *username, int status)
+{
+    RosterChange *c = &log->changes[++log->version & (ROSTER_LOG_LEN - 1)];
+    c->version = log->version;
+    c->op = op;
+    c->status = status;
+    snprintf(c->username, sizeof(c->username), "%s", username);
+    return log->version;
+}
+
+int roster_log_covers(const RosterLog *log, uint64_t since)
+{
+    // Una versión anterior a base o posterior a la actual es de otra ejecución del servidor
+    return since >= log->base && since <= log->version && log->version - since <= ROSTER_LOG_LEN;
+}
@@ -0,0 +1,50 @@
+#ifndef ROSTER_H
+#define ROSTER_H
+
+#include <stdint.h>
+
+// Registro acotado de cambios de la lista de usuarios. Cada alta, baja o cambio de estado
+// incrementa la versión; un cliente que conoce la versión v recibe solo los cambios
+// v+1..actual mientras sigan en el anillo, o la lista completa si ya no están.
+// No es thread-safe; el servidor lo usa bajo user_lock.
+#define ROSTER_LOG_LEN 1024 // Cambios recordados (potencia de 2)
+
+typedef enum
+{
+    ROSTER_JOIN,
+    ROSTER_LEAVE,
+    ROSTER_STATUS,
+} RosterOp;
+
+typedef struct
+{
+    uint64_t version;
+    RosterOp op;
+    int status; // Solo para ROSTER_STATUS: 0 = ACTIVO, 1 = OCUPADO, 2 = INACTIVO
+    char username[50];
+} RosterChange;
+
+typedef struct
+{
+    RosterChange changes[ROSTER_LOG_LEN]; // changes[v % ROSTER_LOG_LEN] guarda la versión v
+    uint64_t base;                        // Versión inicial (sin cambios)
+    uint64_t version;                     // Último cambio registrado
+} RosterLog;
+
+// base conviene que crezca entre ejecuciones (p. ej. la hora en ms) para que las versiones
+// que un cliente trae de un servidor anterior no caigan dentro del anillo nuevo.
+void roster_log_init(RosterLog *log, uint64_t base);
+
+// Registra un cambio y devuelve la nueva versión.
+uint64_t roster_log_record(RosterLog *log, RosterOp op, const char *username, int status);
+
+// 1 si todos los cambios posteriores a since siguen en el anillo (o no hubo ninguno).
+int roster_log_covers(const RosterLog *log, uint64_t since);
+
+// Cambio de la versión v; solo válido si roster_log_covers(log, v - 1).
+static inline const RosterChange *roster_log_get(const RosterLog *log, uint64_t v)
+{
+    return &log->changes[v & (ROSTER_LOG_LEN - 1)];
+}
+
+#endif
@@ -0,0 +1,282 @@
+#include "send_queue.h"
+#include "common.h"
+#include "log.h"
+#include "metrics.h"
+#include "msgpack.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+SendQueueConfig send_queue_config = {
+    .policy = SEND_POLICY_DROP_OLDEST,
+    .high_water = 256 * 1024,
+    .low_water = 64 * 1024,
+};
+
+SendQueueTotals send_queue_totals;
+
+void send_queue_config_load(void)
+{
+    const char *policy = getenv("CHAT_SEND_POLICY");
+    if (policy && strcmp(policy, "drop-oldest") == 0)
+        send_queue_config.policy = SEND_POLICY_DROP_OLDEST;
+    else if (policy && strcmp(policy, "drop-status") == 0)
+        send_queue_config.policy = SEND_POLICY_DROP_STATUS;
+    else if (policy && strcmp(policy, "disconnect") == 0)
+        send_queue_config.policy = SEND_POLICY_DISCONNECT;
+    else if (policy && *policy)
+        fprintf(stderr, "CHAT_SEND_POLICY inválido (drop-oldest, drop-status, disconnect), se usa drop-oldest\n");
+
+    send_queue_config.high_water =
+        (size_t)env_int("CHAT_SEND_HIGH_WATER", (int)send_queue_config.high_water, 1024, 1 << 30);
+    send_queue_config.low_water =
+        (size_t)env_int("CHAT_SEND_LOW_WATER", (int)send_queue_config.low_water, 0, (int)send_queue_config.high_water);
+}
+
+Frame *frame_new(const char *msg, size_t len)
+{
+    Frame *f = malloc(sizeof(Frame) + LWS_PRE + len + 1);
+    if (!f)
+        return NULL;
+    atomic_init(&f->refs, 1);
+    atomic_init(&f->binary, NULL);
+    f->len = len;
+    f->kind = FRAME_CRITICAL;
+    memcpy(f->buf + LWS_PRE, msg, len);
+    f->buf[LWS_PRE + len] = '\0';
+    return f;
+}
+
+Frame *frame_ref(Frame *f)
+{
+    atomic_fetch_add_explicit(&f->refs, 1, memory_order_relaxed);
+    return f;
+}
+
+void frame_unref(Frame *f)
+{
+    if (f && atomic_fetch_sub_explicit(&f->refs, 1, memory_order_acq_rel) == 1)
+    {
+        frame_unref(atomic_load_explicit(&f->binary, memory_order_relaxed));
+        free(f);
+    }
+}
+
+long wire_to_binary(const char *json, size_t len, unsigned char **payload)
+{
+    static __thread unsigned char *scratch = NULL;
+    static __thread size_t scratch_cap = 0;
+
+    size_t need = MSGPACK_MAX_SIZE(len);
+    if (need > scratch_cap)
+    {
+        unsigned char *buf = realloc(scratch, LWS_PRE + need);
+        if (!buf)
+            return -1;
+        scratch = buf;
+        scratch_cap = need;
+    }
+    *payload = scratch + LWS_PRE;
+    return json_to_msgpack(json, len, *payload, scratch_cap);
+}
+
+Frame *frame_binary(Frame *f)
+{
+    Frame *bin = atomic_load_explicit(&f->binary, memory_order_acquire);
+    if (bin)
+        return bin;
+
+    unsigned char *payload;
+    long n = wire_to_binary((const char *)frame_payload(f), f->len, &payload);
+    if (n < 0)
+        return NULL;
+    bin = frame_new((const char *)payload, (size_t)n);
+    if (!bin)
+        return NULL;
+
+    // Si otro hilo se adelantó, se usa la suya
+    Frame *expected = NULL;
+    if (!atomic_compare_exchange_strong_explicit(&f->binary, &expected, bin, memory_order_acq_rel,
+                                                 memory_order_acquire))
+    {
+        frame_unref(bin);
+        return expected;
+    }
+    return bin;
+}
+
+void send_queue_init(SendQueue *q)
+{
+    memset(q->frames, 0, sizeof(q->frames));
+    q->head = 0;
+    q->count = 0;
+    q->bytes = 0;
+    q->congested = 0;
+    q->closing = 0;
+    q->dropped = 0;
+    pthread_mutex_init(&q->lock, NULL);
+}
+
+// Saca el frame en la posición pos (0 = el más antiguo) corriendo los anteriores. Con lock.
+static Frame *remove_at(SendQueue *q, int pos)
+{
+    Frame *f = q->frames[(q->head + pos) % SEND_QUEUE_LEN];
+    for (int i = pos; i > 0; i--)
+        q->frames[(q->head + i) % SEND_QUEUE_LEN] = q->frames[(q->head + i - 1) % SEND_QUEUE_LEN];
+    q->frames[q->head] = NULL;
+    q->head = (q->head + 1) % SEND_QUEUE_LEN;
+    q->count--;
+    q->bytes -= f->len;
+    atomic_fetch_sub_explicit(&send_queue_totals.queued_frames, 1, memory_order_relaxed);
+    atomic_fetch_sub_explicit(&send_queue_totals.queued_bytes, (long)f->len, memory_order_relaxed);
+    return f;
+}
+
+void send_queue_destroy(SendQueue *q)
+{
+    pthread_mutex_lock(&q->lock);
+    while (q->count > 0)
+        frame_unref(remove_at(q, 0));
+    pthread_mutex_unlock(&q->lock);
+    pthread_mutex_destroy(&q->lock);
+}
+
+// Posición del frame descartable más antiguo según la política, o -1. Con lock.
+static int find_victim(SendQueue *q)
+{
+    int fallback = -1;
+    for (int i = 0; i < q->count; i++)
+    {
+        FrameKind kind = q->frames[(q->head + i) % SEND_QUEUE_LEN]->kind;
+        if (kind == FRAME_CRITICAL)
+            continue;
+        // drop-status sacrifica primero los status_update y recién después los broadcasts
+        if (send_queue_config.policy != SEND_POLICY_DROP_STATUS || kind == FRAME_STATUS)
+            return i;
+        if (fallback < 0)
+            fallback = i;
+    }
+    return fallback;
+}
+
+// Una cola vacía siempre acepta, aunque el frame solo supere high_water
+static int over_limit(const SendQueue *q, size_t extra)
+{
+    return q->count > 0 && (q->count == SEND_QUEUE_LEN || q->bytes + extra > send_queue_config.high_water);
+}
+
+SendResult send_queue_push(SendQueue *q, Frame *f)
+{
+    Frame *dropped[SEND_QUEUE_LEN];
+    int ndropped = 0;
+    SendResult result = SEND_QUEUED;
+    int became_congested = 0;
+
+    pthread_mutex_lock(&q->lock);
+    if (q->closing)
+    {
+        pthread_mutex_unlock(&q->lock);
+        return SEND_DROPPED; // Ya se pidió el cierre
+    }
+
+    if (q->congested && f->kind == FRAME_STATUS && send_queue_config.policy == SEND_POLICY_DROP_STATUS)
+    {
+        q->dropped++;
+        pthread_mutex_unlock(&q->lock);
+        atomic_fetch_add_explicit(&send_queue_totals.dropped, 1, memory_order_relaxed);
+        return SEND_DROPPED;
+    }
+
+    while (over_limit(q, f->len))
+    {
+        became_congested |= !q->congested;
+        q->congested = 1;
+        int victim = send_queue_config.policy == SEND_POLICY_DISCONNECT ? -1 : find_victim(q);
+        if (victim >= 0)
+        {
+            dropped[ndropped++] = remove_at(q, victim);
+            continue;
+        }
+        if (f->kind != FRAME_CRITICAL && send_queue_config.policy != SEND_POLICY_DISCONNECT)
+        {
+            result = SEND_DROPPED; // No hay nada más viejo que sacrificar: se pierde el nuevo
+        }
+        else
+        {
+            // 🔹 Un cliente que no lee no puede hacer crecer la memoria del servidor
+            q->closing = 1;
+            result = SEND_OVERFLOW;
+        }
+        break;
+    }
+
+    unsigned long lost = (unsigned long)ndropped;
+    if (result == SEND_QUEUED)
+    {
+        q->frames[(q->head + q->count) % SEND_QUEUE_LEN] = frame_ref(f);
+        q->count++;
+        q->bytes += f->len;
+        atomic_fetch_add_explicit(&send_queue_totals.queued_frames, 1, memory_order_relaxed);
+        atomic_fetch_add_explicit(&send_queue_totals.queued_bytes, (long)f->len, memory_order_relaxed);
+        if (ndropped > 0)
+            result = SEND_DROPPED;
+    }
+    else if (result == SEND_DROPPED)
+    {
+        lost++; // El frame nuevo, que nunca entró a la cola
+    }
+    q->dropped += lost;
+    int depth = q->count;
+    pthread_mutex_unlock(&q->lock);
+
+    for (int i = 0; i < ndropped; i++)
+        frame_unref(dropped[i]);
+    if (lost > 0)
+        atomic_fetch_add_explicit(&send_queue_totals.dropped, lost, memory_order_relaxed);
+    if (result == SEND_OVERFLOW)
+        atomic_fetch_add_explicit(&send_queue_totals.disconnects, 1, memory_order_relaxed);
+    if (became_congested)
+        LOG_SAMPLED(LOG_LEVEL_WARN, 100, "Cola de envío congestionada (%d frames); se aplica la política", depth);
+    return result;
+}
+
+int send_queue_write_next(SendQueue *q, struct lws *wsi)
+{
+    pthread_mutex_lock(&q->lock);
+    if (q->count == 0)
+    {
+        pthread_mutex_unlock(&q->lock);
+        return 0;
+    }
+    Frame *f = remove_at(q, 0);
+    if (q->congested && q->bytes <= send_queue_config.low_water)
+        q->congested = 0;
+    int pending = q->count;
+    pthread_mutex_unlock(&q->lock);
+
+    int failed = 0;
+    Frame *out = wsi_is_binary(wsi) ? frame_binary(f) : f;
+    if (out)
+    {
+        int n = lws_write(wsi, frame_payload(out), out->len,
+                          out == f ? LWS_WRITE_TEXT : LWS_WRITE_BINARY);
+        failed = n < (int)out->len;
+        if (!failed)
+        {
+            metrics_add(METRIC_BYTES_OUT, out->len);
+            metrics_add(METRIC_FRAMES_OUT, 1);
+        }
+    }
+    else
+    {
+        LOG_ERROR("No se pudo transcodificar un frame a binario; se descarta");
+    }
+    frame_unref(f);
+    if (failed)
+        return -1;
+
+    // 🔹 Un frame por callback: si quedan pendientes se vuelve a armar WRITEABLE
+    if (pending > 0)
+        lws_callback_on_writable(wsi);
+    return 0;
+}
@@ -0,0 +1,125 @@
+#ifndef SEND_QUEUE_H
+#define SEND_QUEUE_H
+
+#include <stddef.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <libwebsockets.h>
+#include "msg_types.h"
+
+#define SEND_QUEUE_LEN 64 // Frames pendientes máximos por conexión
+
+// Qué se puede sacrificar cuando un cliente no lee: las respuestas propias, los privados y
+// los errores nunca se descartan; broadcasts y status_update sí.
+typedef enum
+{
+    FRAME_CRITICAL = 0,
+    FRAME_BROADCAST,
+    FRAME_STATUS,
+} FrameKind;
+
+// Frame saliente serializado una sola vez y compartido por todas las colas que lo referencian.
+// El payload es inmutable; los LWS_PRE bytes previos son el espacio que lws_write usa para
+// la cabecera WebSocket. Se libera cuando el último destinatario lo suelta.
+typedef struct Frame
+{
+    atomic_int refs;
+    size_t len;
+    FrameKind kind;                 // FRAME_CRITICAL salvo que el creador diga otra cosa
+    _Atomic(struct Frame *) binary; // Versión MessagePack, creada al primer envío binario
+    unsigned char buf[];            // LWS_PRE + len + '\0'
+} Frame;
+
+// Crea un frame con una referencia a partir de len bytes de msg.
+Frame *frame_new(const char *msg, size_t len);
+Frame *frame_ref(Frame *f);
+void frame_unref(Frame *f);
+
+static inline unsigned char *frame_payload(Frame *f)
+{
+    return f->buf + LWS_PRE;
+}
+
+// 🔹 Traducción en el borde: el servidor arma todo en JSON y las conexiones
+// "chat-protocol-bin" reciben la misma respuesta transcodificada a MessagePack.
+static inline int wsi_is_binary(struct lws *wsi)
+{
+    const struct lws_protocols *p = lws_get_protocol(wsi);
+    return p && p->id == CHAT_PROTOCOL_ID_BIN;
+}
+
+// Transcodifica json a MessagePack en un buffer del hilo con LWS_PRE bytes libres al frente.
+// Deja en *payload el inicio del resultado (válido hasta la próxima llamada en el hilo) y
+// devuelve su largo, o -1 si falló.
+long wire_to_binary(const char *json, size_t len, unsigned char **payload);
+
+// Versión binaria del frame; se transcodifica una sola vez y queda asociada al frame.
+// No suma referencias: vive mientras viva f. NULL si no hay memoria.
+Frame *frame_binary(Frame *f);
+
+// 🔹 Contrapresión: cuando una cola supera high_water bytes (o SEND_QUEUE_LEN frames) la
+// conexión queda congestionada hasta bajar de low_water, y se aplica la política.
+typedef enum
+{
+    SEND_POLICY_DROP_OLDEST, // Descarta los broadcast/status_update más antiguos de la cola
+    SEND_POLICY_DROP_STATUS, // Además ignora status_update nuevos mientras esté congestionada
+    SEND_POLICY_DISCONNECT,  // Cierra la conexión
+} SendPolicy;
+
+typedef struct
+{
+    SendPolicy policy;
+    size_t high_water; // Bytes encolados a partir de los cuales se aplica la política
+    size_t low_water;  // Bytes por debajo de los cuales deja de estar congestionada
+} SendQueueConfig;
+
+extern SendQueueConfig send_queue_config;
+
+// Lee CHAT_SEND_POLICY (drop-oldest, drop-status, disconnect), CHAT_SEND_HIGH_WATER y
+// CHAT_SEND_LOW_WATER. Llamar antes de aceptar conexiones.
+void send_queue_config_load(void);
+
+// Totales de todas las colas, para monitoreo
+typedef struct
+{
+    atomic_long queued_frames; // Profundidad actual sumada
+    atomic_long queued_bytes;
+    atomic_ulong dropped;      // Frames descartados por la política
+    atomic_ulong disconnects;  // Conexiones cerradas por no leer
+} SendQueueTotals;
+
+extern SendQueueTotals send_queue_totals;
+
+// Cola FIFO acotada de frames salientes de una conexión.
+typedef struct
+{
+    Frame *frames[SEND_QUEUE_LEN];
+    int head;          // Índice del frame más antiguo
+    int count;         // Cantidad de frames en cola
+    size_t bytes;      // Suma de f->len de los frames en cola
+    int congested;     // Superó high_water y todavía no bajó de low_water
+    int closing;       // Desbordó con SEND_POLICY_DISCONNECT (o sin nada descartable)
+    unsigned long dropped;
+    pthread_mutex_t lock;
+} SendQueue;
+
+typedef enum
+{
+    SEND_QUEUED = 0,
+    SEND_DROPPED,  // Se descartó algún frame (el nuevo o uno viejo), la cola sigue sana
+    SEND_OVERFLOW, // La conexión debe cerrarse: no lee y no queda nada que descartar.
+                   // Se devuelve una sola vez; después la cola descarta todo.
+} SendResult;
+
+void send_queue_init(SendQueue *q);
+void send_queue_destroy(SendQueue *q);
+
+// Agrega una referencia al frame al final de la cola aplicando la política de contrapresión.
+SendResult send_queue_push(SendQueue *q, Frame *f);
+
+// Escribe el siguiente frame pendiente en wsi (en la codificación de su subprotocolo) y
+// vuelve a pedir WRITEABLE si quedan más.
+// Debe llamarse solo desde LWS_CALLBACK_SERVER_WRITEABLE. Devuelve -1 si lws_write falló.
+int send_queue_write_next(SendQueue *q, struct lws *wsi);
+
+#endif
@@ -6,31 +6,103 @@
 #include <string.h>
 #include <pthread.h>
 #include <libwebsockets.h>
+#include "common.h"
+#include "compression.h"
+#include "log.h"
+#include "msg_types.h"
+#include "rx_buffer.h"
+#include "send_queue.h"
+#include "timer_wheel.h"
+#include "shard.h"
+#include "user_pool.h"
+#include "json_decode.h"
+#include "response_writer.h"
+#include "roster.h"
+#include "presence.h"
+#include "journal.h"
+#include "offline.h"
+#include "rooms.h"
+#include "rate_limit.h"
+#include "metrics.h"
 
-#define MAX_USERS 100
+#define IDLE_TICK_MS 100      // Resolución de la rueda de inactividad
+#define IDLE_TIMEOUT_MS 10000 // Tiempo sin mensajes para pasar a INACTIVO
+#define RAW_LOG_SAMPLE 64      // Volcados de mensajes crudos: uno de cada N
+#define BATCH_WINDOW_MS 10     // Ventana por defecto de los lotes (CHAT_BATCH_MS)
 
 typedef struct {
     char username[50];
     struct lws *wsi;
     int status; // 0 = ACTIVO, 1 = OCUPADO, 2 = INACTIVO
     char ip[48]; // NUEVO: para almacenar la dirección IP del cliente
-    pthread_t thread_id; // 🔹 ID del hilo asociado al usuario
-    time_t last_activity;
+    TimerNode idle_timer; // ⏱️ Se re-arma con cada mensaje; al vencer pasa a INACTIVO
+    int shard;            // Hilo de servicio dueño de la conexión
+    int slot;             // Posición en users[]
+    PresenceList presence; // Usuarios cuya presencia sigue (subscribe)
 } User;
 
-extern User users[MAX_USERS];
+// Datos por conexión que libwebsockets reserva (per_session_data_size)
+typedef struct
+{
+    SendQueue queue; // Frames pendientes de enviar a este cliente
+    int shard;       // Hilo de servicio que atiende la conexión
+    int shard_pos;   // Índice en shards[shard].conns, -1 si no está registrada
+    DeflateStats deflate; // Bytes antes/después de permessage-deflate
+    RxBuffer rx;          // Mensaje entrante a medias (fragmentado o mayor que rx_buffer_size)
+    int batching;         // Pidió recibir los broadcasts y status_update en lotes ("batch")
+    int presence_filtered; // Se suscribió: solo recibe status_update de los usuarios que sigue
+    RoomSet rooms;         // Salas a las que se unió; solo las toca el hilo del shard
+    RateLimiter rate;      // Token buckets de mensajes y bytes entrantes
+    Frame *http_body;      // Respuesta de /metrics o /stats a medio enviar (conexiones HTTP)
+    size_t http_sent;
+} SessionData;
+
+// Usuarios registrados: arreglo denso de punteros a registros de direcciones estables
+extern User **users;
 extern int user_count;
 extern pthread_mutex_t user_lock;
 
-// Variables globales para broadcast
-extern char *g_broadcast_msg;
+// Serializa el reparto de broadcasts para que todos los clientes los reciban en el mismo orden
 extern pthread_mutex_t broadcast_lock;
 
 // Funciones
-// Ahora add_user devuelve 1 si se registró correctamente, 0 si ya existe.
+// add_user devuelve 1 si se registró correctamente, 0 si ya existe y -1 si no hay memoria.
 int add_user(const char *username, struct lws *wsi);
 void remove_user(struct lws *wsi);
+// Encola los frames, en orden, en la cola de cada usuario registrado y pide WRITEABLE.
+void broadcast_frames(Frame **frames, int count);
+void broadcast_frame(Frame *frame);
+// Serializa el mensaje una sola vez en un Frame compartido y lo reparte con broadcast_frame.
 void broadcast_message(const char *message);
-void handle_message(const char *msg, struct lws *wsi);
+// Procesa un mensaje completo de len bytes. msg puede modificarse (se decodifica en el lugar).
+void handle_message(char *msg, size_t len, struct lws *wsi);
+// Encola frame en la cola de wsi y pide WRITEABLE; todo lo que sale pasa por acá.
+// Llamar desde el hilo de servicio de wsi. Devuelve -1 si la conexión se está cerrando
+// por no leer (ver send_queue_push).
+int send_frame(struct lws *wsi, Frame *frame);
+// Encola una respuesta {"type":"ERROR"} para wsi.
+void send_error(struct lws *wsi, const char *error_desc);
+
+// Entrega lo que otros hilos dejaron en el buzón del shard actual (LWS_CALLBACK_EVENT_WAIT_CANCELLED).
+void drain_shard_mailbox(void);
+
+// ⏱️ Lotes: los eventos de difusión para conexiones con batching se juntan durante
+// batch_window_ms y salen en un único frame {"type":"batch","content":[...]} por shard.
+extern int batch_window_ms;
+// Cuánto puede bloquear el bucle de servicio del shard actual sin pasarse de la ventana del lote.
+int batch_wait_ms(int max_ms);
+// Envía el lote del shard actual si su ventana venció.
+void flush_due_batch(void);
+
+// Métricas por HTTP en el mismo puerto: GET /metrics (Prometheus) y GET /stats (JSON).
+// begin responde LWS_CALLBACK_HTTP, write cada LWS_CALLBACK_HTTP_WRITEABLE y release suelta
+// el cuerpo si la conexión se cierra antes. Devuelven -1 para cerrar la conexión.
+int stats_http_begin(struct lws *wsi, SessionData *pss, const char *uri);
+int stats_http_write(struct lws *wsi, SessionData *pss);
+void stats_http_release(SessionData *pss);
+
+// Detección de inactividad, llamada desde el bucle de servicio de main_server.c
+void idle_timers_init(void);
+void check_inactive_users(void);
 
 #endif
\ No newline at end of file
@@ -1,635 +1,1508 @@
 #include "server.h"
 #include <cjson/cJSON.h>
-#include <unistd.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
 
-// Definiciones de variables globales y mutex (igual que antes)
-User users[MAX_USERS];
+// Definiciones de variables globales y mutex
+User **users = NULL; // Vista densa de los usuarios registrados; los registros viven en user_pool
 int user_count = 0;
+static int user_cap = 0;
+static UserPool user_pool;
+static int user_pool_ready = 0;
 pthread_mutex_t user_lock = PTHREAD_MUTEX_INITIALIZER;
-char *g_broadcast_msg = NULL;
+
+// Versiones de la lista de usuarios (ver roster.h); protegido por user_lock
+static RosterLog roster;
+static int roster_ready = 0;
+
+static const char *const status_names[] = {"ACTIVO", "OCUPADO", "INACTIVO"};
+
+// Suscripciones de presencia (ver presence.h); protegido por user_lock
+static PresenceIndex presence_index;
+
+// Registra un cambio de la lista; con user_lock tomado
+static void roster_record(RosterOp op, const char *username, int status)
+{
+    if (!roster_ready)
+    {
+        // La hora en ms como base: las versiones de una ejecución anterior quedan fuera del anillo
+        roster_log_init(&roster, (uint64_t)time(NULL) * 1000);
+        roster_ready = 1;
+    }
+    roster_log_record(&roster, op, username, status);
+}
 pthread_mutex_t broadcast_lock = PTHREAD_MUTEX_INITIALIZER;
 
-void *user_thread(void *arg)
+#define USERS_PER_SLAB 256
+
+// Índices hash de direccionamiento abierto (sondeo lineal) sobre los usuarios registrados.
+// Cada celda guarda el puntero al registro (NULL = vacía) y la clave se lee del propio
+// registro; como los registros no se mueven, compactar users[] no toca los índices.
+// Se duplican al superar la mitad de ocupación. Todas las operaciones requieren user_lock.
+#define INDEX_MIN_SIZE 256
+
+typedef struct
+{
+    User **table;
+    uint32_t mask;                      // Tamaño - 1 (potencia de 2)
+    uint32_t (*hash_of)(const User *u); // Hash de la clave guardada en el registro
+} UserIndex;
+
+static uint32_t hash_wsi(const struct lws *wsi)
+{
+    uint64_t x = (uint64_t)(uintptr_t)wsi;
+    x = (x ^ (x >> 33)) * 0xff51afd7ed558ccdULL;
+    return (uint32_t)(x ^ (x >> 29));
+}
+
+static uint32_t hash_user_name(const User *u) { return fnv1a_str(u->username); }
+static uint32_t hash_user_wsi(const User *u) { return hash_wsi(u->wsi); }
+
+static UserIndex name_index = {NULL, 0, hash_user_name};
+static UserIndex wsi_index = {NULL, 0, hash_user_wsi};
+
+static void index_place(UserIndex *idx, User *u)
+{
+    uint32_t i = idx->hash_of(u) & idx->mask;
+    while (idx->table[i])
+        i = (i + 1) & idx->mask;
+    idx->table[i] = u;
+}
+
+static int index_resize(UserIndex *idx, uint32_t size)
+{
+    User **old = idx->table;
+    uint32_t old_size = old ? idx->mask + 1 : 0;
+
+    User **table = calloc(size, sizeof(User *));
+    if (!table)
+        return -1;
+    idx->table = table;
+    idx->mask = size - 1;
+    for (uint32_t i = 0; i < old_size; i++)
+        if (old[i])
+            index_place(idx, old[i]);
+    free(old);
+    return 0;
+}
+
+// Se llama antes de insertar, con user_count ya contando al nuevo usuario
+static int index_reserve(UserIndex *idx, int count)
+{
+    uint32_t size = idx->table ? idx->mask + 1 : 0;
+    if (size >= INDEX_MIN_SIZE && (uint32_t)count * 2 <= size)
+        return 0;
+    uint32_t target = size ? size * 2 : INDEX_MIN_SIZE;
+    while ((uint32_t)count * 2 > target)
+        target *= 2;
+    return index_resize(idx, target);
+}
+
+static void index_remove(UserIndex *idx, User *u)
+{
+    uint32_t hole = idx->hash_of(u) & idx->mask;
+    while (idx->table[hole] != u)
+        hole = (hole + 1) & idx->mask;
+    idx->table[hole] = NULL;
+
+    // 🔹 Borrado con desplazamiento hacia atrás: no deja lápidas que alarguen las búsquedas
+    for (uint32_t i = (hole + 1) & idx->mask; idx->table[i]; i = (i + 1) & idx->mask)
+    {
+        uint32_t home = idx->hash_of(idx->table[i]) & idx->mask;
+        if (((i - home) & idx->mask) >= ((i - hole) & idx->mask))
+        {
+            idx->table[hole] = idx->table[i];
+            idx->table[i] = NULL;
+            hole = i;
+        }
+    }
+}
+
+static User *find_user_by_name(const char *name)
+{
+    if (!name_index.table)
+        return NULL;
+    for (uint32_t i = fnv1a_str(name) & name_index.mask; name_index.table[i]; i = (i + 1) & name_index.mask)
+    {
+        if (strcmp(name_index.table[i]->username, name) == 0)
+            return name_index.table[i];
+    }
+    return NULL;
+}
+
+static User *find_user_by_wsi(const struct lws *wsi)
+{
+    if (!wsi_index.table)
+        return NULL;
+    for (uint32_t i = hash_wsi(wsi) & wsi_index.mask; wsi_index.table[i]; i = (i + 1) & wsi_index.mask)
+    {
+        if (wsi_index.table[i]->wsi == wsi)
+            return wsi_index.table[i];
+    }
+    return NULL;
+}
+
+// 🔹 Nombres que se registraron alguna vez desde que arrancó el servidor: solo a ellos se les
+// guardan mensajes privados mientras están desconectados. Protegido por user_lock; no se achica.
+#define KNOWN_BUCKETS 4096 // Cadenas de la tabla (potencia de 2)
+
+typedef struct KnownName
+{
+    struct KnownName *next;
+    char username[50];
+} KnownName;
+
+static KnownName *known_names[KNOWN_BUCKETS];
+
+static KnownName **known_slot(const char *name)
+{
+    KnownName **slot = &known_names[fnv1a_str(name) & (KNOWN_BUCKETS - 1)];
+    while (*slot && strcmp((*slot)->username, name) != 0)
+        slot = &(*slot)->next;
+    return slot;
+}
+
+// Agrega name si no estaba. -1 si no hay memoria.
+static int remember_name(const char *name)
+{
+    KnownName **slot = known_slot(name);
+    if (*slot)
+        return 0;
+    KnownName *k = calloc(1, sizeof(KnownName));
+    if (!k)
+        return -1;
+    snprintf(k->username, sizeof(k->username), "%s", name);
+    *slot = k;
+    return 0;
+}
+
+// Rueda de inactividad: cada usuario registrado tiene un TimerNode que se re-arma con
+// cada mensaje. La avanza check_inactive_users desde el bucle de servicio; protegida por user_lock.
+static TimerWheel idle_wheel;
+
+static void arm_idle_timer(User *user)
+{
+    timer_wheel_schedule(&idle_wheel, &user->idle_timer, idle_wheel.now + IDLE_TIMEOUT_MS / IDLE_TICK_MS);
+}
+
+// Lote de status_update generados en un mismo tick
+typedef struct
+{
+    Frame **frames;
+    int count;
+    int cap;
+} FrameBatch;
+
+static Frame *build_status_frame(const char *username, const char *status)
+{
+    char timestamp[TIMESTAMP_SIZE];
+    timestamp_now(timestamp);
+
+    JsonWriter *w = json_writer_begin();
+    resp_status_update(w, username, status, timestamp);
+    Frame *frame = json_writer_frame(w);
+    if (frame)
+        frame->kind = FRAME_STATUS; // Se puede descartar si el destinatario no da abasto
+    return frame;
+}
+
+// Copias por shard de un frame: lws_write escribe la cabecera dentro del frame, así que cada
+// hilo de servicio necesita la suya. El shard 0 usa el original, como en broadcast_frames.
+typedef struct
+{
+    Frame *original;
+    Frame *copies[MAX_SHARDS];
+} ShardCopies;
+
+static Frame *frame_for_shard(ShardCopies *c, int shard)
+{
+    if (shard == 0)
+        return c->original;
+    if (!c->copies[shard])
+    {
+        c->copies[shard] = frame_new((const char *)frame_payload(c->original), c->original->len);
+        if (c->copies[shard])
+            c->copies[shard]->kind = c->original->kind;
+    }
+    return c->copies[shard];
+}
+
+static void post_to_subscriber(void *subscriber, void *arg)
+{
+    User *sub = (User *)subscriber;
+    Frame *frame = frame_for_shard((ShardCopies *)arg, sub->shard);
+    if (!frame || shard_post(sub->shard, frame, sub->username) < 0)
+        LOG_ERROR("Sin memoria para avisar presencia a %s", sub->username);
+}
+
+// 🔹 Encola el status_update de username solo para quienes siguen su presencia (las conexiones
+// sin suscripciones lo reciben por el broadcast de siempre). Con user_lock tomado; el llamador
+// despierta a los shards después (broadcast_frames lo hace).
+static void notify_subscribers(const char *username, Frame *frame)
+{
+    ShardCopies c = {.original = frame};
+    presence_for_each(&presence_index, username, post_to_subscriber, &c);
+    for (int s = 1; s < MAX_SHARDS; s++)
+        frame_unref(c.copies[s]);
+}
+
+static void on_idle_timeout(TimerNode *node, void *arg)
+{
+    FrameBatch *batch = (FrameBatch *)arg;
+    User *user = (User *)((char *)node - offsetof(User, idle_timer));
+
+    if (user->status == 2)
+        return;
+    user->status = 2;
+    roster_record(ROSTER_STATUS, user->username, 2);
+    LOG_INFO("Usuario %s pasó a INACTIVO", user->username);
+
+    if (batch->count == batch->cap)
+    {
+        int cap = batch->cap ? batch->cap * 2 : 16;
+        Frame **frames = realloc(batch->frames, cap * sizeof(Frame *));
+        if (!frames)
+            return;
+        batch->frames = frames;
+        batch->cap = cap;
+    }
+    Frame *frame = build_status_frame(user->username, "INACTIVO");
+    if (frame)
+    {
+        notify_subscribers(user->username, frame);
+        batch->frames[batch->count++] = frame;
+    }
+}
+
+void idle_timers_init(void)
+{
+    timer_wheel_init(&idle_wheel, monotonic_ms() / IDLE_TICK_MS);
+}
+
+void check_inactive_users(void)
+{
+    FrameBatch batch = {0};
+
+    metrics_lock(&user_lock, METRIC_LOCK_USER);
+    timer_wheel_advance(&idle_wheel, monotonic_ms() / IDLE_TICK_MS, on_idle_timeout, &batch);
+    pthread_mutex_unlock(&user_lock);
+
+    // 🔹 Todas las transiciones del mismo tick salen en un único reparto
+    if (batch.count > 0)
+        broadcast_frames(batch.frames, batch.count);
+    for (int i = 0; i < batch.count; i++)
+        frame_unref(batch.frames[i]);
+    free(batch.frames);
+}
+
+int add_user(const char *username, struct lws *wsi)
+{
+    SessionData *pss = (SessionData *)lws_wsi_user(wsi);
+    char client_ip[48] = {0};
+    lws_get_peer_simple(wsi, client_ip, sizeof(client_ip));
+
+    metrics_lock(&user_lock, METRIC_LOCK_USER);
+    if (find_user_by_name(username))
+    {
+        pthread_mutex_unlock(&user_lock);
+        LOG_WARN("Usuario %s ya existe", username);
+        return 0;
+    }
+
+    if (!user_pool_ready)
+    {
+        user_pool_init(&user_pool, sizeof(User), USERS_PER_SLAB);
+        user_pool_ready = 1;
+    }
+
+    // 🔹 Se reserva todo antes de tocar el registro para no dejarlo a medias
+    if (user_count == user_cap)
+    {
+        int cap = user_cap ? user_cap * 2 : USERS_PER_SLAB;
+        User **grown = realloc(users, cap * sizeof(User *));
+        if (!grown)
+            goto sin_memoria;
+        users = grown;
+        user_cap = cap;
+    }
+    if (index_reserve(&name_index, user_count + 1) < 0 || index_reserve(&wsi_index, user_count + 1) < 0 ||
+        shard_reserve(pss->shard, shards[pss->shard].count + 1) < 0 || remember_name(username) < 0)
+        goto sin_memoria;
+
+    User *user = user_pool_alloc(&user_pool);
+    if (!user)
+        goto sin_memoria;
+
+    snprintf(user->username, sizeof(user->username), "%s", username);
+    user->wsi = wsi;
+    user->status = 0;
+    snprintf(user->ip, sizeof(user->ip), "%s", client_ip);
+
+    // ⏱️ Temporizador de inactividad en lugar de un hilo por usuario
+    timer_node_init(&user->idle_timer);
+    arm_idle_timer(user);
+
+    // 🔹 La conexión pasa a recibir los broadcasts de su shard
+    user->shard = pss->shard;
+    shard_attach(pss->shard, wsi, &pss->shard_pos);
+
+    index_place(&name_index, user);
+    index_place(&wsi_index, user);
+    user->slot = user_count;
+    users[user_count++] = user;
+    user->presence.head = NULL;
+    user->presence.count = 0;
+    roster_record(ROSTER_JOIN, user->username, 0);
+
+    pthread_mutex_unlock(&user_lock);
+    return 1;
+
+sin_memoria:
+    pthread_mutex_unlock(&user_lock);
+    LOG_ERROR("Sin memoria para registrar a %s", username);
+    return -1;
+}
+
+void remove_user(struct lws *wsi)
+{
+    metrics_lock(&user_lock, METRIC_LOCK_USER);
+
+    User *user = find_user_by_wsi(wsi);
+    int found = user != NULL;
+    if (user)
+    {
+        LOG_INFO("Eliminando usuario: %s", user->username);
+        timer_wheel_cancel(&user->idle_timer);
+        roster_record(ROSTER_LEAVE, user->username, 0);
+        presence_unsubscribe_all(&user->presence);
+
+        SessionData *pss = (SessionData *)lws_wsi_user(wsi);
+        shard_detach(pss->shard, &pss->shard_pos);
+        // La conexión puede seguir abierta y registrarse de nuevo: vuelve a las opciones por defecto
+        pss->batching = 0;
+        pss->presence_filtered = 0;
+
+        index_remove(&name_index, user);
+        index_remove(&wsi_index, user);
+
+        // 🔹 Liberar posición moviendo el último usuario al actual
+        User *last = users[--user_count];
+        users[user->slot] = last;
+        last->slot = user->slot;
+
+        user_pool_free(&user_pool, user);
+    }
+
+    pthread_mutex_unlock(&user_lock);
+
+    // Las salas no dependen de user_lock; se dejan desde el hilo de la conexión
+    if (found)
+    {
+        SessionData *pss = (SessionData *)lws_wsi_user(wsi);
+        room_leave_all(&pss->rooms, pss->shard);
+    }
+}
+
+int batch_window_ms = BATCH_WINDOW_MS;
+
+// Arma un frame de lote con los eventos; skip_status deja afuera los FRAME_STATUS.
+// Devuelve NULL si no queda ningún evento o no hay memoria.
+static Frame *batch_frame(Frame **events, int count, int skip_status, const char *timestamp)
+{
+    int items = 0;
+    for (int i = 0; i < count; i++)
+        if (!skip_status || events[i]->kind != FRAME_STATUS)
+            items++;
+    if (items == 0)
+        return NULL;
+
+    // El lote es tan descartable como su evento más importante
+    FrameKind kind = FRAME_STATUS;
+    int first = 1;
+    JsonWriter *w = json_writer_begin();
+    resp_batch_begin(w);
+    for (int i = 0; i < count; i++)
+    {
+        Frame *event = events[i];
+        if (skip_status && event->kind == FRAME_STATUS)
+            continue;
+        resp_batch_item(w, (const char *)frame_payload(event), event->len, first);
+        first = 0;
+        if (event->kind < kind)
+            kind = event->kind;
+    }
+    resp_batch_end(w, timestamp);
+
+    Frame *frame = json_writer_frame(w);
+    if (!frame)
+    {
+        LOG_ERROR("Sin memoria para armar un lote de %d eventos", items);
+        return NULL;
+    }
+    frame->kind = kind;
+    return frame;
+}
+
+// Arma el lote pendiente del shard y lo encola en cada conexión con batching. Las que
+// filtran presencia reciben un lote aparte sin status_update: esos les llegan solo por
+// sus suscripciones.
+static void flush_shard_batch(int shard)
+{
+    Shard *sh = &shards[shard];
+    int count = sh->batch_count;
+    if (count == 0)
+        return;
+    sh->batch_count = 0;
+
+    char timestamp[TIMESTAMP_SIZE];
+    timestamp_now(timestamp);
+
+    int want_all = 0, want_filtered = 0;
+    for (int i = 0; i < sh->count; i++)
+    {
+        SessionData *pss = (SessionData *)lws_wsi_user(sh->conns[i].wsi);
+        if (pss->batching && pss->presence_filtered)
+            want_filtered = 1;
+        else if (pss->batching)
+            want_all = 1;
+    }
+    Frame *all = want_all ? batch_frame(sh->batch, count, 0, timestamp) : NULL;
+    Frame *filtered = want_filtered ? batch_frame(sh->batch, count, 1, timestamp) : NULL;
+    for (int i = 0; i < count; i++)
+        frame_unref(sh->batch[i]);
+
+    for (int i = 0; i < sh->count; i++)
+    {
+        SessionData *pss = (SessionData *)lws_wsi_user(sh->conns[i].wsi);
+        Frame *frame = pss->presence_filtered ? filtered : all;
+        if (pss->batching && frame)
+            send_frame(sh->conns[i].wsi, frame);
+    }
+    if (all)
+        frame_unref(all);
+    if (filtered)
+        frame_unref(filtered);
+}
+
+static void batch_add(int shard, Frame *frame)
+{
+    Shard *sh = &shards[shard];
+    if (sh->batch_count == 0)
+        sh->batch_deadline = monotonic_ms() + (uint64_t)batch_window_ms;
+    sh->batch[sh->batch_count++] = frame_ref(frame);
+    if (sh->batch_count == SHARD_BATCH_MAX)
+        flush_shard_batch(shard);
+}
+
+int batch_wait_ms(int max_ms)
+{
+    int me = shard_current();
+    if (me < 0 || shards[me].batch_count == 0)
+        return max_ms;
+    uint64_t now = monotonic_ms();
+    if (shards[me].batch_deadline <= now)
+        return 0;
+    uint64_t left = shards[me].batch_deadline - now;
+    return left < (uint64_t)max_ms ? (int)left : max_ms;
+}
+
+void flush_due_batch(void)
+{
+    int me = shard_current();
+    if (me >= 0 && shards[me].batch_count > 0 && shards[me].batch_deadline <= monotonic_ms())
+        flush_shard_batch(me);
+}
+
+int send_frame(struct lws *wsi, Frame *frame)
+{
+    SessionData *pss = (SessionData *)lws_wsi_user(wsi);
+
+    // Lo que va directo a una conexión con batching no puede adelantarse a los eventos
+    // que ya esperan en el lote
+    if (pss->batching && shards[pss->shard].batch_count > 0)
+        flush_shard_batch(pss->shard);
+
+    switch (send_queue_push(&pss->queue, frame))
+    {
+    case SEND_OVERFLOW:
+        LOG_WARN("Cliente lento desconectado (%lu frames descartados)", pss->queue.dropped);
+        lws_set_timeout(wsi, PENDING_TIMEOUT_CLOSE_SEND, LWS_TO_KILL_ASYNC);
+        return -1;
+    case SEND_DROPPED:
+    case SEND_QUEUED:
+        break;
+    }
+    lws_callback_on_writable(wsi);
+    return 0;
+}
+
+void drain_shard_mailbox(void)
+{
+    int me = shard_current();
+    if (me < 0)
+        return;
+
+    MailboxNode *node;
+    while ((node = shard_take(me)) != NULL)
+    {
+        if (node->room)
+        {
+            // Miembros de la sala en este shard: la lista solo la toca este hilo
+            RoomShard *rs = &node->room->shards[me];
+            int count = room_shard_count(node->room, me);
+            for (int i = 0; i < count; i++)
+                send_frame(rs->members[i].wsi, node->frame);
+            metrics_fanout(count);
+            room_unref(node->room);
+        }
+        else if (node->target[0] == '\0')
+        {
+            // 🔹 Cada destinatario solo guarda una referencia al mismo frame; las conexiones
+            // con batching lo reciben después, dentro del lote del shard
+            int batched = 0, recipients = 0;
+            for (int i = 0; i < shards[me].count; i++)
+            {
+                struct lws *wsi = shards[me].conns[i].wsi;
+                SessionData *pss = (SessionData *)lws_wsi_user(wsi);
+                if (pss->presence_filtered && node->frame->kind == FRAME_STATUS)
+                    continue; // Le llega por su suscripción, si sigue a ese usuario
+                recipients++;
+                if (pss->batching)
+                    batched = 1;
+                else
+                    send_frame(wsi, node->frame);
+            }
+            if (batched)
+                batch_add(me, node->frame);
+            metrics_fanout(recipients);
+        }
+        else
+        {
+            // El destinatario pudo desconectarse desde que se encoló: se vuelve a buscar
+            metrics_lock(&user_lock, METRIC_LOCK_USER);
+            User *user = find_user_by_name(node->target);
+            struct lws *target = (user && user->shard == me) ? user->wsi : NULL;
+            pthread_mutex_unlock(&user_lock);
+            if (target)
+                send_frame(target, node->frame);
+        }
+        frame_unref(node->frame);
+        free(node);
+    }
+}
+
+// Vacía el buzón propio (si es un hilo de servicio) y despierta a los demás shards
+static void deliver_pending(void)
+{
+    drain_shard_mailbox();
+    shard_wake();
+}
+
+void broadcast_frames(Frame **frames, int count)
+{
+    metrics_lock(&broadcast_lock, METRIC_LOCK_BROADCAST);
+    for (int s = 0; s < shard_count; s++)
+    {
+        for (int f = 0; f < count; f++)
+        {
+            // Con varios hilos, cada shard escribe su propia copia: lws_write rellena la cabecera
+            // en los LWS_PRE bytes del frame y dos hilos no pueden hacerlo sobre la misma memoria.
+            Frame *frame = s == 0 ? frames[f] : frame_new((const char *)frame_payload(frames[f]), frames[f]->len);
+            if (frame && s != 0)
+                frame->kind = frames[f]->kind;
+            if (!frame || shard_post(s, frame, NULL) < 0)
+                LOG_ERROR("Sin memoria para repartir broadcast al shard %d", s);
+            if (frame && s != 0)
+                frame_unref(frame);
+        }
+    }
+    pthread_mutex_unlock(&broadcast_lock);
+    deliver_pending();
+}
+
+void broadcast_frame(Frame *frame)
+{
+    broadcast_frames(&frame, 1);
+}
+
+void broadcast_message(const char *message)
+{
+    Frame *frame = frame_new(message, strlen(message));
+    if (!frame)
+    {
+        LOG_ERROR("Sin memoria para crear frame de broadcast");
+        return;
+    }
+    frame->kind = FRAME_BROADCAST;
+    broadcast_frame(frame);
+    frame_unref(frame);
+}
+
+// Función auxiliar para enviar mensajes de error en el formato estándar
+void send_error(struct lws *wsi, const char *error_desc)
+{
+    char timestamp[TIMESTAMP_SIZE];
+    timestamp_now(timestamp);
+
+    JsonWriter *w = json_writer_begin();
+    resp_error(w, error_desc, timestamp);
+    json_writer_send(w, wsi);
+}
+
+// Agrega los nombres de todos los usuarios registrados a una respuesta con lista y la cierra
+// con la versión correspondiente; con user_lock tomado
+static void write_user_list(JsonWriter *w, const char *timestamp)
+{
+    for (int i = 0; i < user_count; i++)
+    {
+        resp_user_list_item(w, users[i]->username, i == 0);
+    }
+    resp_user_list_end(w, roster_ready ? roster.version : 0, timestamp);
+}
+
+// Cambios posteriores a since tal como quedaron en el registro; con user_lock tomado
+static void write_user_delta(JsonWriter *w, uint64_t since, const char *timestamp)
+{
+    static const char *const op_names[] = {"join", "leave", "status"};
+
+    resp_list_users_delta_begin(w);
+    for (uint64_t v = since + 1; v <= roster.version; v++)
+    {
+        const RosterChange *c = roster_log_get(&roster, v);
+        resp_roster_change(w, op_names[c->op], c->username,
+                           c->op == ROSTER_STATUS ? status_names[c->status] : NULL, v == since + 1);
+    }
+    resp_list_users_delta_end(w, since, roster.version, timestamp);
+}
+
+// Copia un campo del árbol cJSON al formato del decodificador rápido
+static void field_from_cjson(const cJSON *json, const char *key, JsonField *field)
+{
+    cJSON *item = cJSON_GetObjectItem(json, key);
+    if (!item)
+        return;
+    if (!cJSON_IsString(item))
+    {
+        field->kind = JSON_FIELD_OTHER;
+        return;
+    }
+    field->kind = JSON_FIELD_STRING;
+    field->str = item->valuestring;
+    field->len = strlen(item->valuestring);
+}
+
+// 🔹 Manejadores por tipo de mensaje. Reciben el mensaje ya decodificado (los campos apuntan
+// al buffer recibido o al árbol cJSON) con "type" y "sender" validados.
+typedef void (*MessageHandler)(const ChatMessage *m, struct lws *wsi);
+
+// Verifica que el remitente esté registrado; si no, responde con error y devuelve 0
+static int require_registered(const char *sender, struct lws *wsi)
+{
+    metrics_lock(&user_lock, METRIC_LOCK_USER);
+    int sender_found = find_user_by_name(sender) != NULL;
+    pthread_mutex_unlock(&user_lock);
+    if (!sender_found)
+        send_error(wsi, "Usuario no registrado. Por favor, regístrese primero.");
+    return sender_found;
+}
+
+// 🔹 Los lotes que se mandan de una vez (historia, bandeja) se cortan antes de RX_MAX_MESSAGE:
+// el cliente descarta los mensajes más grandes. El margen cubre el cierre y el timestamp.
+#define BATCH_FRAME_MAX (RX_MAX_MESSAGE - 128)
+
+// Entra un evento más de len bytes en el lote que se está armando en w
+static int batch_fits(const JsonWriter *w, size_t len)
+{
+    return w->len + 1 + len <= BATCH_FRAME_MAX;
+}
+
+// Historia del diario para el usuario recién registrado: todos los broadcast y los privados
+// que envió o recibió, en lotes
+typedef struct
+{
+    struct lws *wsi;
+    const char *username;
+    size_t username_len;
+    JsonWriter *w;
+    int items; // Eventos en el lote que se está armando
+    char timestamp[TIMESTAMP_SIZE];
+} ReplayTarget;
+
+static int journal_name_is(const char *name, size_t len, const ReplayTarget *t)
+{
+    return len == t->username_len && memcmp(name, t->username, len) == 0;
+}
+
+static void replay_flush(ReplayTarget *t)
+{
+    if (t->items == 0)
+        return;
+    resp_batch_end(t->w, t->timestamp);
+    Frame *frame = json_writer_frame(t->w);
+    t->items = 0;
+    if (!frame)
+        return;
+    frame->kind = FRAME_BROADCAST; // Historia: se puede descartar si el cliente no lee
+    send_frame(t->wsi, frame);
+    frame_unref(frame);
+}
+
+static void replay_entry(const JournalEntry *e, void *arg)
+{
+    ReplayTarget *t = arg;
+    if (e->kind == JOURNAL_PRIVATE && !journal_name_is(e->sender, e->sender_len, t) &&
+        !journal_name_is(e->target, e->target_len, t))
+        return;
+    if (t->items > 0 && !batch_fits(t->w, e->payload_len))
+        replay_flush(t);
+    // send_frame puede usar el escritor del hilo: cada lote empieza con uno vacío
+    if (t->items == 0)
+    {
+        t->w = json_writer_begin();
+        resp_batch_begin(t->w);
+    }
+    resp_batch_item(t->w, e->payload, e->payload_len, t->items == 0);
+    t->items++;
+}
+
+// Pasa el primer mensaje de from al final de to
+static void move_front(OfflineMessages *from, OfflineMessages *to)
+{
+    OfflineMsg *msg = from->head;
+    from->head = msg->next;
+    if (!from->head)
+        from->tail = NULL;
+    from->count--;
+    from->bytes -= msg->len;
+
+    msg->next = NULL;
+    if (to->tail)
+        to->tail->next = msg;
+    else
+        to->head = msg;
+    to->tail = msg;
+    to->count++;
+    to->bytes += msg->len;
+}
+
+// 🔹 Entrega en lotes los privados que recibió mientras estaba desconectado. Cada lote se
+// borra de la bandeja solo si entró a la cola de envío; el que no entra y los que siguen
+// vuelven a la bandeja, en orden, y se entregan en el próximo registro.
+static void flush_offline(struct lws *wsi, const char *username)
+{
+    OfflineMessages pending;
+    if (offline_take(username, &pending) == 0)
+        return;
+
+    char timestamp[TIMESTAMP_SIZE];
+    timestamp_now(timestamp);
+    SessionData *pss = (SessionData *)lws_wsi_user(wsi);
+    int total = pending.count, delivered = 0;
+    while (pending.head)
+    {
+        OfflineMessages chunk = {0};
+        JsonWriter *w = json_writer_begin();
+        resp_batch_begin(w);
+        while (pending.head && (chunk.count == 0 || batch_fits(w, pending.head->len)))
+        {
+            resp_batch_item(w, pending.head->data, pending.head->len, chunk.count == 0);
+            move_front(&pending, &chunk);
+        }
+        resp_batch_end(w, timestamp);
+
+        Frame *frame = json_writer_frame(w);
+        if (!frame || pss->queue.closing || send_frame(wsi, frame) < 0)
+        {
+            while (pending.head)
+                move_front(&pending, &chunk);
+            LOG_WARN("No se pudieron entregar %d mensajes pendientes a %s; siguen en su bandeja", chunk.count,
+                     username);
+            offline_restore(username, &chunk);
+            if (frame)
+                frame_unref(frame);
+            break;
+        }
+        frame_unref(frame);
+        delivered += chunk.count;
+        offline_release(&chunk);
+    }
+    if (delivered > 0)
+        LOG_INFO("Entregados %d de %d mensajes pendientes a %s", delivered, total, username);
+}
+
+// --- CASO: Registro de usuario ---
+static void handle_register(const ChatMessage *m, struct lws *wsi)
+{
+    // Una conexión registrada ya ocupa su lugar en el shard: un segundo nombre lo duplicaría
+    SessionData *pss = (SessionData *)lws_wsi_user(wsi);
+    if (pss->shard_pos >= 0)
+    {
+        send_error(wsi, "Esta conexión ya está registrada");
+        return;
+    }
+
+    // add_user recorta al tamaño de User.username: dos nombres largos con el mismo comienzo
+    // quedarían con la misma clave
+    if (strlen(m->sender.str) >= sizeof(((User *)0)->username))
+    {
+        send_error(wsi, "Nombre de usuario demasiado largo");
+        return;
+    }
+
+    // Lo que se guarde en el diario desde acá puede llegarle también en vivo: la historia
+    // llega hasta el último mensaje anterior al registro
+    uint64_t history_upto = journal_last_seq();
+    int success = add_user(m->sender.str, wsi);
+    if (success != 1)
+    {
+        send_error(wsi, success == 0 ? "Usuario ya existe" : "Servidor sin capacidad para más usuarios");
+        return;
+    }
+
+    // "content": "batch" pide recibir los eventos de difusión en lotes (ver batch_window_ms)
+    if (m->content.kind == JSON_FIELD_STRING && strcmp(m->content.str, "batch") == 0)
+    {
+        pss->batching = 1;
+        LOG_INFO("Usuario %s recibe eventos en lotes de %d ms", m->sender.str, batch_window_ms);
+    }
+
+    // Respuesta con la lista de usuarios conectados
+    char timestamp[TIMESTAMP_SIZE];
+    timestamp_now(timestamp);
+    JsonWriter *w = json_writer_begin();
+    resp_register_success_begin(w);
+    metrics_lock(&user_lock, METRIC_LOCK_USER);
+    write_user_list(w, timestamp);
+    pthread_mutex_unlock(&user_lock);
+    json_writer_send(w, wsi);
+
+    // 🔹 Historia reciente: lectura secuencial de los segmentos mapeados del diario
+    if (journal_config.replay > 0 && history_upto > 0)
+    {
+        ReplayTarget t = {wsi, m->sender.str, strlen(m->sender.str), NULL, 0, ""};
+        timestamp_now(t.timestamp);
+        journal_replay(history_upto, (uint64_t)journal_config.replay, 0, replay_entry, &t);
+        replay_flush(&t);
+    }
+    flush_offline(wsi, m->sender.str);
+}
+
+// --- CASO: Broadcast ---
+static void handle_broadcast(const ChatMessage *m, struct lws *wsi)
+{
+    const char *sender = m->sender.str;
+    if (!require_registered(sender, wsi))
+        return;
+    if (m->content.kind != JSON_FIELD_STRING)
+    {
+        send_error(wsi, "Campo 'content' inválido para broadcast");
+        return;
+    }
+    // Obtener timestamp actual
+    char timestamp[TIMESTAMP_SIZE];
+    timestamp_now(timestamp);
+
+    // Construir respuesta y repartirla como un único frame compartido
+    JsonWriter *w = json_writer_begin();
+    resp_broadcast(w, sender, m->content.str, timestamp);
+    Frame *frame = json_writer_frame(w);
+    if (frame)
+    {
+        frame->kind = FRAME_BROADCAST;
+        journal_append(JOURNAL_BROADCAST, sender, NULL, (const char *)frame_payload(frame), frame->len);
+        broadcast_frame(frame);
+        frame_unref(frame);
+    }
+}
+
+// --- CASO: Mensaje privado ---
+static void handle_private(const ChatMessage *m, struct lws *wsi)
+{
+    const char *sender = m->sender.str;
+    if (!require_registered(sender, wsi))
+        return;
+    if (m->target.kind != JSON_FIELD_STRING || m->content.kind != JSON_FIELD_STRING)
+    {
+        send_error(wsi, "Campos 'target' o 'content' inválidos para mensaje privado");
+        return;
+    }
+    const char *target = m->target.str;
+    const char *message_content = m->content.str;
+    int found = 0, known = 0;
+    int stored = -1;
+
+    // Obtener timestamp actual
+    char timestamp[TIMESTAMP_SIZE];
+    timestamp_now(timestamp);
+    JsonWriter *w = json_writer_begin();
+    resp_private(w, sender, target, message_content, timestamp);
+    Frame *frame = json_writer_frame(w);
+    if (!frame)
+    {
+        send_error(wsi, "Sin memoria para el mensaje privado");
+        return;
+    }
+
+    metrics_lock(&user_lock, METRIC_LOCK_USER);
+    User *target_user = find_user_by_name(target);
+    if (target_user)
+    {
+        found = 1;
+        // 🔹 El destinatario puede pertenecer a otro hilo: se entrega por el buzón de su shard
+        journal_append(JOURNAL_PRIVATE, sender, target_user->username, (const char *)frame_payload(frame), frame->len);
+        shard_post(target_user->shard, frame, target_user->username);
+    }
+    else if (*known_slot(target) || offline_pending(target))
+    {
+        // Desconectado: queda en su bandeja. Se guarda con user_lock tomado para que un
+        // registro simultáneo lo encuentre al vaciarla (ver flush_offline). Un nombre que
+        // nunca se registró no recibe bandeja: se responde como usuario inexistente.
+        known = 1;
+        stored = offline_store(target, (const char *)frame_payload(frame), frame->len);
+    }
+    pthread_mutex_unlock(&user_lock);
+    frame_unref(frame);
+
+    if (found)
+    {
+        deliver_pending();
+    }
+    else if (stored == 1)
+    {
+        offline_spill();
+        char notice[128];
+        snprintf(notice, sizeof(notice), "%s no está conectado: recibirá el mensaje al volver", target);
+        JsonWriter *reply = json_writer_begin();
+        resp_server(reply, notice, timestamp);
+        json_writer_send(reply, wsi);
+    }
+    else if (stored == 0)
+    {
+        send_error(wsi, "La bandeja del destinatario está llena");
+    }
+    else if (known)
+    {
+        send_error(wsi, "No hay lugar para guardar mensajes a usuarios desconectados");
+    }
+    else
+    {
+        send_error(wsi, "Usuario no encontrado para mensaje privado");
+    }
+}
+
+// --- CASO: Listado de usuarios ---
+static void handle_list_users(const ChatMessage *m, struct lws *wsi)
 {
-    User *user = (User *)arg;
-    printf("Hilo creado para %s (ID: %p)\n", user->username, (void *)pthread_self());
+    if (!require_registered(m->sender.str, wsi))
+        return;
+    char timestamp[TIMESTAMP_SIZE];
+    timestamp_now(timestamp);
 
-    while (1)
+    // "content" con la última versión que vio el cliente: solo se mandan los cambios
+    uint64_t since = 0;
+    int has_since = 0;
+    if (m->content.kind == JSON_FIELD_STRING && m->content.len > 0 && m->content.len < 20)
     {
-        sleep(1);
+        char *end;
+        since = strtoull(m->content.str, &end, 10);
+        has_since = *end == '\0' && m->content.str[0] >= '0' && m->content.str[0] <= '9';
+    }
 
-        time_t now = time(NULL);
-        int debe_cambiar = 0;
+    JsonWriter *w = json_writer_begin();
+    metrics_lock(&user_lock, METRIC_LOCK_USER);
+    // Si hubo más cambios que usuarios, la lista completa es más corta que el delta
+    if (has_since && roster_ready && roster_log_covers(&roster, since) &&
+        roster.version - since <= (uint64_t)user_count)
+    {
+        write_user_delta(w, since, timestamp);
+    }
+    else
+    {
+        // Sin versión, de otra ejecución, fuera del anillo o con demasiados cambios: la lista completa
+        resp_list_users_begin(w);
+        write_user_list(w, timestamp);
+    }
+    pthread_mutex_unlock(&user_lock);
+    json_writer_send(w, wsi);
+}
 
-        pthread_mutex_lock(&user_lock);
-        if (user->status != 2 && difftime(now, user->last_activity) >= 10)
-        {
-            user->status = 2;
-            debe_cambiar = 1;
-        }
-        pthread_mutex_unlock(&user_lock);
+// --- CASO: Cambio de estado ---
+static void handle_change_status(const ChatMessage *m, struct lws *wsi)
+{
+    const char *sender = m->sender.str;
+    if (!require_registered(sender, wsi))
+        return;
+    if (m->content.kind != JSON_FIELD_STRING)
+    {
+        send_error(wsi, "Campo 'content' inválido para cambio de estado");
+        return;
+    }
+    const char *new_status = m->content.str;
 
-        if (debe_cambiar)
-        {
-            printf("Usuario %s pasó a INACTIVO\n", user->username);
-
-            cJSON *response = cJSON_CreateObject();
-            cJSON_AddStringToObject(response, "type", "status_update");
-            cJSON_AddStringToObject(response, "sender", "server");
-
-            cJSON *status_obj = cJSON_CreateObject();
-            cJSON_AddStringToObject(status_obj, "user", user->username);
-            cJSON_AddStringToObject(status_obj, "status", "INACTIVO");
-            cJSON_AddItemToObject(response, "content", status_obj);
-
-            char timestamp[32];
-            strftime(timestamp, sizeof(timestamp), "%Y-%m-%dT%H:%M:%S", localtime(&now));
-            cJSON_AddStringToObject(response, "timestamp", timestamp);
-
-            char *msg = cJSON_PrintUnformatted(response);
-            pthread_mutex_lock(&broadcast_lock);
-            if (g_broadcast_msg)
-                free(g_broadcast_msg);
-            g_broadcast_msg = strdup(msg);
-            pthread_mutex_unlock(&broadcast_lock);
-            broadcast_message(msg);
-
-            free(msg);
-            cJSON_Delete(response);
-        }
+    // Validar que el estado sea uno de los permitidos
+    if (strcmp(new_status, "ACTIVO") != 0 &&
+        strcmp(new_status, "OCUPADO") != 0 &&
+        strcmp(new_status, "INACTIVO") != 0)
+    {
+        send_error(wsi, "Estado inválido. Los estados permitidos son: ACTIVO, OCUPADO, INACTIVO");
+        return;
     }
 
-    return NULL;
+    // Construir respuesta de actualización de estado
+    Frame *frame = build_status_frame(sender, new_status);
+
+    // Actualizar el estado en el registro del usuario
+    metrics_lock(&user_lock, METRIC_LOCK_USER);
+    User *user = find_user_by_name(sender);
+    if (user)
+    {
+        if (strcmp(new_status, "OCUPADO") == 0)
+            user->status = 1;
+        else if (strcmp(new_status, "INACTIVO") == 0)
+            user->status = 2;
+        else
+            user->status = 0; // ACTIVO
+        roster_record(ROSTER_STATUS, user->username, user->status);
+        if (frame)
+            notify_subscribers(user->username, frame);
+    }
+    pthread_mutex_unlock(&user_lock);
+
+    if (frame)
+    {
+        broadcast_frame(frame);
+        frame_unref(frame);
+    }
 }
 
-int add_user(const char *username, struct lws *wsi)
+// --- CASO: Desconexión ---
+static void handle_disconnect(const ChatMessage *m, struct lws *wsi)
 {
-    char client_ip[48] = {0};
-    lws_get_peer_simple(wsi, client_ip, sizeof(client_ip));
-    users[user_count].last_activity = time(NULL);
-
-    pthread_mutex_lock(&user_lock);
-    for (int i = 0; i < user_count; i++)
+    const char *sender = m->sender.str;
+    if (!require_registered(sender, wsi))
+        return;
+    char timestamp[TIMESTAMP_SIZE];
+    timestamp_now(timestamp);
+    JsonWriter *w = json_writer_begin();
+    resp_user_disconnected(w, sender, timestamp);
+    Frame *frame = json_writer_frame(w);
+    if (frame)
     {
-        if (strcmp(users[i].username, username) == 0)
-        {
-            pthread_mutex_unlock(&user_lock);
-            printf("Error: Usuario %s ya existe.\n", username);
-            return 0;
-        }
+        broadcast_frame(frame);
+        frame_unref(frame);
     }
+    remove_user(wsi);
+}
 
-    if (user_count < MAX_USERS)
+// Llama a fn por cada nombre de una lista separada por comas (sin espacios alrededor).
+// Los nombres vacíos o más largos que un username se ignoran.
+static void for_each_name(const char *list, void (*fn)(const char *name, void *arg), void *arg)
+{
+    while (*list)
     {
-        strcpy(users[user_count].username, username);
-        users[user_count].wsi = wsi;
-        users[user_count].status = 0;
-        strcpy(users[user_count].ip, client_ip);
+        const char *end = strchr(list, ',');
+        size_t len = end ? (size_t)(end - list) : strlen(list);
+        const char *start = list;
+        list += len + (end ? 1 : 0);
 
-        // 🔹 Lanzar hilo para este usuario
-        if (pthread_create(&users[user_count].thread_id, NULL, user_thread, &users[user_count]) != 0)
+        while (len > 0 && (*start == ' ' || *start == '\t'))
         {
-            printf("No se pudo crear hilo para %s\n", username);
-            pthread_mutex_unlock(&user_lock);
-            return 0;
+            start++;
+            len--;
         }
-        printf("Hilo creado para %s con ID %p\n", username, (void *)users[user_count].thread_id);
-
-        user_count++;
+        while (len > 0 && (start[len - 1] == ' ' || start[len - 1] == '\t'))
+            len--;
+        char name[sizeof(((User *)0)->username)];
+        if (len == 0 || len >= sizeof(name))
+            continue;
+        memcpy(name, start, len);
+        name[len] = '\0';
+        fn(name, arg);
     }
-    pthread_mutex_unlock(&user_lock);
-    return 1;
 }
 
-void remove_user(struct lws *wsi)
+typedef struct
 {
-    pthread_mutex_lock(&user_lock);
+    User *self;
+    struct lws *wsi;
+    const char *timestamp;
+    int added;
+    int full;
+} SubscribeCtx;
 
-    for (int i = 0; i < user_count; i++)
+static void subscribe_one(const char *name, void *arg)
+{
+    SubscribeCtx *ctx = (SubscribeCtx *)arg;
+    if (ctx->full || strcmp(name, ctx->self->username) == 0)
+        return;
+    int rc = presence_subscribe(&presence_index, &ctx->self->presence, ctx->self, name);
+    if (rc < 0)
     {
-        if (users[i].wsi == wsi)
-        {
-            printf("Eliminando usuario: %s (hilo: %p)\n", users[i].username, (void *)users[i].thread_id);
+        ctx->full = 1;
+        return;
+    }
+    if (rc == 0)
+        return;
+    ctx->added++;
 
-            // 🔹 Cancelar y unir el hilo del usuario
-            pthread_cancel(users[i].thread_id);
-            pthread_join(users[i].thread_id, NULL);
+    // Estado actual del usuario recién seguido, para que el cliente no espere al próximo cambio
+    User *target = find_user_by_name(name);
+    if (target)
+    {
+        JsonWriter *w = json_writer_begin();
+        resp_status_update(w, target->username, status_names[target->status], ctx->timestamp);
+        json_writer_send(w, ctx->wsi);
+    }
+}
 
-            // 🔹 Liberar posición moviendo el último usuario al actual
-            users[i] = users[user_count - 1];
-            user_count--;
+static void unsubscribe_one(const char *name, void *arg)
+{
+    presence_unsubscribe(&((User *)arg)->presence, name);
+}
 
-            break;
-        }
+// Confirma con la cantidad de usuarios que se siguen
+static void send_presence_summary(struct lws *wsi, int following, const char *timestamp)
+{
+    char content[64];
+    if (following < 0)
+        snprintf(content, sizeof(content), "Presencia de todos los usuarios");
+    else
+        snprintf(content, sizeof(content), "Presencia de %d usuarios", following);
+    JsonWriter *w = json_writer_begin();
+    resp_server(w, content, timestamp);
+    json_writer_send(w, wsi);
+}
+
+// --- CASO: Suscripción a presencia ---
+static void handle_subscribe(const ChatMessage *m, struct lws *wsi)
+{
+    if (!require_registered(m->sender.str, wsi))
+        return;
+    if (m->content.kind != JSON_FIELD_STRING)
+    {
+        send_error(wsi, "Campo 'content' inválido para suscripción");
+        return;
     }
+    char timestamp[TIMESTAMP_SIZE];
+    timestamp_now(timestamp);
 
+    SessionData *pss = (SessionData *)lws_wsi_user(wsi);
+    metrics_lock(&user_lock, METRIC_LOCK_USER);
+    User *self = find_user_by_wsi(wsi);
+    SubscribeCtx ctx = {self, wsi, timestamp, 0, 0};
+    if (self)
+    {
+        for_each_name(m->content.str, subscribe_one, &ctx);
+        pss->presence_filtered = 1;
+    }
+    int following = self ? self->presence.count : 0;
     pthread_mutex_unlock(&user_lock);
+
+    if (ctx.full)
+        send_error(wsi, "Límite de suscripciones de presencia alcanzado");
+    send_presence_summary(wsi, following, timestamp);
 }
 
-void broadcast_message(const char *message)
+// --- CASO: Baja de suscripciones ---
+static void handle_unsubscribe(const ChatMessage *m, struct lws *wsi)
 {
-    pthread_mutex_lock(&user_lock);
-    for (int i = 0; i < user_count; i++)
+    if (!require_registered(m->sender.str, wsi))
+        return;
+    char timestamp[TIMESTAMP_SIZE];
+    timestamp_now(timestamp);
+
+    SessionData *pss = (SessionData *)lws_wsi_user(wsi);
+    metrics_lock(&user_lock, METRIC_LOCK_USER);
+    User *self = find_user_by_wsi(wsi);
+    int following = -1;
+    if (self && m->content.kind == JSON_FIELD_STRING)
+    {
+        for_each_name(m->content.str, unsubscribe_one, self);
+        following = self->presence.count;
+    }
+    else if (self)
     {
-        lws_callback_on_writable(users[i].wsi);
+        // Sin lista: se sueltan todas y vuelve a recibir la presencia de todos
+        presence_unsubscribe_all(&self->presence);
+        pss->presence_filtered = 0;
     }
     pthread_mutex_unlock(&user_lock);
+
+    send_presence_summary(wsi, following, timestamp);
 }
 
-// Función auxiliar para enviar mensajes de error en el formato estándar
-void send_error(struct lws *wsi, const char *error_desc)
+// Conexión registrada (el registro la asocia a su shard); no toma user_lock
+static int require_registered_conn(struct lws *wsi)
 {
-    cJSON *error_response = cJSON_CreateObject();
-    cJSON_AddStringToObject(error_response, "type", "error");
-    cJSON_AddStringToObject(error_response, "sender", "server");
-    cJSON_AddStringToObject(error_response, "content", error_desc);
-    // Agregar timestamp
-    time_t now = time(NULL);
-    struct tm *t = localtime(&now);
-    char timestamp[32];
-    strftime(timestamp, sizeof(timestamp), "%Y-%m-%dT%H:%M:%S", t);
-    cJSON_AddStringToObject(error_response, "timestamp", timestamp);
+    SessionData *pss = (SessionData *)lws_wsi_user(wsi);
+    if (pss->shard_pos >= 0)
+        return 1;
+    send_error(wsi, "Usuario no registrado. Por favor, regístrese primero.");
+    return 0;
+}
 
-    char *err_str = cJSON_PrintUnformatted(error_response);
-    size_t err_len = strlen(err_str);
-    unsigned char *buf = malloc(LWS_PRE + err_len);
-    if (buf)
-    {
-        memcpy(buf + LWS_PRE, err_str, err_len);
-        lws_write(wsi, buf + LWS_PRE, err_len, LWS_WRITE_TEXT);
-        free(buf);
-    }
-    free(err_str);
-    cJSON_Delete(error_response);
+static int valid_room_name(const JsonField *f)
+{
+    return f->kind == JSON_FIELD_STRING && f->len > 0 && f->len < ROOM_NAME_MAX;
 }
 
-void handle_message(const char *msg, struct lws *wsi)
+static void send_server_notice(struct lws *wsi, const char *text)
 {
-    // Imprime el mensaje crudo para depuración
-    printf("Mensaje recibido (crudo, len=%zu): [%s]\n", strlen(msg), msg);
+    char timestamp[TIMESTAMP_SIZE];
+    timestamp_now(timestamp);
+    JsonWriter *w = json_writer_begin();
+    resp_server(w, text, timestamp);
+    json_writer_send(w, wsi);
+}
 
-    cJSON *json = cJSON_Parse(msg);
-    if (json == NULL)
+// --- CASO: Unirse a una sala ---
+static void handle_join(const ChatMessage *m, struct lws *wsi)
+{
+    if (!require_registered_conn(wsi))
+        return;
+    if (!valid_room_name(&m->content))
     {
-        send_error(wsi, "Mensaje JSON inválido");
+        send_error(wsi, "Nombre de sala inválido");
         return;
     }
 
-    pthread_mutex_lock(&user_lock);
-    for (int i = 0; i < user_count; i++)
+    SessionData *pss = (SessionData *)lws_wsi_user(wsi);
+    int members = 0;
+    int joined = room_join(&pss->rooms, pss->shard, wsi, m->content.str, &members);
+    if (joined < 0)
     {
-        if (users[i].wsi == wsi)
-        {
-            users[i].last_activity = time(NULL); // ⏱️ Marca la actividad
-            break;
-        }
+        send_error(wsi, "No se pudo unir a la sala (máximo de salas alcanzado)");
+        return;
     }
-    pthread_mutex_unlock(&user_lock);
 
-    // Validar campo "type"
-    cJSON *type_item = cJSON_GetObjectItem(json, "type");
-    if (!type_item || !cJSON_IsString(type_item))
+    char notice[ROOM_NAME_MAX + 64];
+    if (joined == 0)
+        snprintf(notice, sizeof(notice), "Ya es miembro de la sala %s", m->content.str);
+    else
+        snprintf(notice, sizeof(notice), "Se unió a la sala %s (%d miembros)", m->content.str, members);
+    send_server_notice(wsi, notice);
+}
+
+// --- CASO: Salir de una sala ---
+static void handle_leave(const ChatMessage *m, struct lws *wsi)
+{
+    if (!require_registered_conn(wsi))
+        return;
+    if (!valid_room_name(&m->content))
     {
-        send_error(wsi, "Campo 'type' no encontrado o inválido");
-        cJSON_Delete(json);
+        send_error(wsi, "Nombre de sala inválido");
         return;
     }
-    const char *type = type_item->valuestring;
 
-    // Validar campo "sender"
-    cJSON *sender_item = cJSON_GetObjectItem(json, "sender");
-    if (!sender_item || !cJSON_IsString(sender_item))
+    SessionData *pss = (SessionData *)lws_wsi_user(wsi);
+    if (!room_leave(&pss->rooms, pss->shard, m->content.str))
     {
-        send_error(wsi, "Campo 'sender' no encontrado o inválido");
-        cJSON_Delete(json);
+        send_error(wsi, "No es miembro de esa sala");
         return;
     }
-    const char *sender = sender_item->valuestring;
+    char notice[ROOM_NAME_MAX + 32];
+    snprintf(notice, sizeof(notice), "Salió de la sala %s", m->content.str);
+    send_server_notice(wsi, notice);
+}
 
-    // --- CASO: Registro de usuario ---
-    if (strcmp(type, "register") == 0)
+// --- CASO: Mensaje a una sala ---
+static void handle_room_message(const ChatMessage *m, struct lws *wsi)
+{
+    if (!require_registered_conn(wsi))
+        return;
+    if (!valid_room_name(&m->target) || m->content.kind != JSON_FIELD_STRING)
     {
-
-        // Opcional: validar que no falte algún campo (por ejemplo, "content" se ignora en register)
-        int success = add_user(sender, wsi);
-        cJSON *response = cJSON_CreateObject();
-        if (success)
-        {
-            cJSON_AddStringToObject(response, "type", "register_success");
-            cJSON_AddStringToObject(response, "sender", "server");
-            cJSON_AddStringToObject(response, "content", "Registro exitoso");
-            // Crear lista de usuarios
-            cJSON *userList = cJSON_CreateArray();
-            pthread_mutex_lock(&user_lock);
-            for (int i = 0; i < user_count; i++)
-            {
-                cJSON_AddItemToArray(userList, cJSON_CreateString(users[i].username));
-            }
-            pthread_mutex_unlock(&user_lock);
-            cJSON_AddItemToObject(response, "userList", userList);
-            // Agregar timestamp
-            time_t now = time(NULL);
-            struct tm *t = localtime(&now);
-            char timestamp[32];
-            strftime(timestamp, sizeof(timestamp), "%Y-%m-%dT%H:%M:%S", t);
-            cJSON_AddStringToObject(response, "timestamp", timestamp);
-        }
-        else
-        {
-            send_error(wsi, "Usuario ya existe");
-            cJSON_Delete(json);
-            return;
-        }
-        char *response_str = cJSON_PrintUnformatted(response);
-        size_t resp_len = strlen(response_str);
-        unsigned char *buf = malloc(LWS_PRE + resp_len);
-        if (buf)
-        {
-            memcpy(buf + LWS_PRE, response_str, resp_len);
-            lws_write(wsi, buf + LWS_PRE, resp_len, LWS_WRITE_TEXT);
-            free(buf);
-        }
-        free(response_str);
-        cJSON_Delete(response);
+        send_error(wsi, "Campos 'target' o 'content' inválidos para mensaje a sala");
+        return;
     }
-    // --- CASO: Broadcast ---
-    else if (strcmp(type, "broadcast") == 0)
+    SessionData *pss = (SessionData *)lws_wsi_user(wsi);
+    Room *room = room_joined(&pss->rooms, m->target.str);
+    if (!room)
     {
-        int sender_found = 0;
-        pthread_mutex_lock(&user_lock);
-        for (int i = 0; i < user_count; i++)
-        {
-            if (strcmp(users[i].username, sender) == 0)
-            {
-                sender_found = 1;
-                break;
-            }
-        }
-        pthread_mutex_unlock(&user_lock);
-        if (!sender_found)
-        {
-            send_error(wsi, "Usuario no registrado. Por favor, regístrese primero.");
-            cJSON_Delete(json);
-            return;
-        }
-        cJSON *content_item = cJSON_GetObjectItem(json, "content");
-        if (!content_item || !cJSON_IsString(content_item))
-        {
-            send_error(wsi, "Campo 'content' inválido para broadcast");
-            cJSON_Delete(json);
-            return;
-        }
-        // Obtener timestamp actual
-        time_t now = time(NULL);
-        struct tm *t = localtime(&now);
-        char timestamp[32];
-        strftime(timestamp, sizeof(timestamp), "%Y-%m-%dT%H:%M:%S", t);
-
-        // Construir respuesta
-        cJSON *response = cJSON_CreateObject();
-        cJSON_AddStringToObject(response, "type", "broadcast");
-        cJSON_AddStringToObject(response, "sender", sender);
-        cJSON_AddStringToObject(response, "content", content_item->valuestring);
-        cJSON_AddStringToObject(response, "timestamp", timestamp);
-
-        char *response_str = cJSON_PrintUnformatted(response);
-        pthread_mutex_lock(&broadcast_lock);
-        if (g_broadcast_msg)
-            free(g_broadcast_msg);
-        g_broadcast_msg = strdup(response_str);
-        pthread_mutex_unlock(&broadcast_lock);
-        broadcast_message(response_str);
-        free(response_str);
-        cJSON_Delete(response);
-    }
-    // --- CASO: Mensaje privado ---
-    else if (strcmp(type, "private") == 0)
-    {
-        int sender_found = 0;
-        pthread_mutex_lock(&user_lock);
-        for (int i = 0; i < user_count; i++)
-        {
-            if (strcmp(users[i].username, sender) == 0)
-            {
-                sender_found = 1;
-                break;
-            }
-        }
-        pthread_mutex_unlock(&user_lock);
-        if (!sender_found)
-        {
-            send_error(wsi, "Usuario no registrado. Por favor, regístrese primero.");
-            cJSON_Delete(json);
-            return;
-        }
-        cJSON *target_item = cJSON_GetObjectItem(json, "target");
-        cJSON *content_item = cJSON_GetObjectItem(json, "content");
-        if (!target_item || !cJSON_IsString(target_item) ||
-            !content_item || !cJSON_IsString(content_item))
-        {
-            send_error(wsi, "Campos 'target' o 'content' inválidos para mensaje privado");
-            cJSON_Delete(json);
-            return;
-        }
-        const char *target = target_item->valuestring;
-        const char *message_content = content_item->valuestring;
-        int found = 0;
-        pthread_mutex_lock(&user_lock);
-        for (int i = 0; i < user_count; i++)
-        {
-            if (strcmp(users[i].username, target) == 0)
-            {
-                found = 1;
-                // Obtener timestamp actual
-                time_t now = time(NULL);
-                struct tm *t = localtime(&now);
-                char timestamp[32];
-                strftime(timestamp, sizeof(timestamp), "%Y-%m-%dT%H:%M:%S", t);
-
-                cJSON *response = cJSON_CreateObject();
-                cJSON_AddStringToObject(response, "type", "private");
-                cJSON_AddStringToObject(response, "sender", sender);
-                cJSON_AddStringToObject(response, "target", target);
-                cJSON_AddStringToObject(response, "content", message_content);
-                cJSON_AddStringToObject(response, "timestamp", timestamp);
-
-                char *response_str = cJSON_PrintUnformatted(response);
-                size_t msg_len = strlen(response_str);
-                unsigned char *buf = malloc(LWS_PRE + msg_len);
-                if (buf)
-                {
-                    memcpy(buf + LWS_PRE, response_str, msg_len);
-                    lws_write(users[i].wsi, buf + LWS_PRE, msg_len, LWS_WRITE_TEXT);
-                    free(buf);
-                }
-                free(response_str);
-                cJSON_Delete(response);
-                break;
-            }
-        }
-        pthread_mutex_unlock(&user_lock);
-        if (!found)
-        {
-            send_error(wsi, "Usuario no encontrado para mensaje privado");
-        }
+        send_error(wsi, "No es miembro de esa sala");
+        return;
     }
-    // --- CASO: Listado de usuarios ---
-    else if (strcmp(type, "list_users") == 0)
+
+    // El remitente es el nombre con que se registró la conexión, no el 'sender' que manda el cliente
+    char sender[50] = "";
+    metrics_lock(&user_lock, METRIC_LOCK_USER);
+    User *user = find_user_by_wsi(wsi);
+    if (user)
+        snprintf(sender, sizeof(sender), "%s", user->username);
+    pthread_mutex_unlock(&user_lock);
+    if (!sender[0])
     {
-        int sender_found = 0;
-        pthread_mutex_lock(&user_lock);
-        for (int i = 0; i < user_count; i++)
-        {
-            if (strcmp(users[i].username, sender) == 0)
-            {
-                sender_found = 1;
-                break;
-            }
-        }
-        pthread_mutex_unlock(&user_lock);
-        if (!sender_found)
-        {
-            send_error(wsi, "Usuario no registrado. Por favor, regístrese primero.");
-            cJSON_Delete(json);
-            return;
-        }
-        cJSON *response = cJSON_CreateObject();
-        cJSON_AddStringToObject(response, "type", "list_users_response");
-        cJSON_AddStringToObject(response, "sender", "server");
+        send_error(wsi, "Usuario no registrado. Por favor, regístrese primero.");
+        return;
+    }
 
-        cJSON *userList = cJSON_CreateArray();
-        pthread_mutex_lock(&user_lock);
-        for (int i = 0; i < user_count; i++)
-        {
-            cJSON_AddItemToArray(userList, cJSON_CreateString(users[i].username));
-        }
-        pthread_mutex_unlock(&user_lock);
-        cJSON_AddItemToObject(response, "content", userList);
-
-        time_t now = time(NULL);
-        struct tm *t = localtime(&now);
-        char timestamp[32];
-        strftime(timestamp, sizeof(timestamp), "%Y-%m-%dT%H:%M:%S", t);
-        cJSON_AddStringToObject(response, "timestamp", timestamp);
-
-        char *response_str = cJSON_PrintUnformatted(response);
-        size_t resp_len = strlen(response_str);
-        unsigned char *buf = malloc(LWS_PRE + resp_len);
-        if (buf)
+    char timestamp[TIMESTAMP_SIZE];
+    timestamp_now(timestamp);
+    JsonWriter *w = json_writer_begin();
+    resp_room_message(w, sender, room->name, m->content.str, timestamp);
+    Frame *frame = json_writer_frame(w);
+    if (!frame)
+        return;
+    frame->kind = FRAME_BROADCAST;
+
+    // 🔹 Solo los shards con miembros de la sala reciben una entrada en el buzón, y cada uno
+    // recorre únicamente sus miembros: O(miembros), sin tocar users[]
+    ShardCopies c = {.original = frame};
+    for (int s = 0; s < shard_count; s++)
+    {
+        if (room_shard_count(room, s) == 0)
+            continue;
+        Frame *copy = frame_for_shard(&c, s);
+        if (!copy || shard_post_room(s, copy, room_ref(room)) < 0)
         {
-            memcpy(buf + LWS_PRE, response_str, resp_len);
-            lws_write(wsi, buf + LWS_PRE, resp_len, LWS_WRITE_TEXT);
-            free(buf);
+            if (copy)
+                room_unref(room);
+            LOG_ERROR("Sin memoria para repartir mensaje de la sala %s al shard %d", room->name, s);
         }
-        free(response_str);
-        cJSON_Delete(response);
     }
-    // --- CASO: Cambio de estado ---
-    else if (strcmp(type, "change_status") == 0)
+    for (int s = 1; s < MAX_SHARDS; s++)
+        frame_unref(c.copies[s]);
+    frame_unref(frame);
+    deliver_pending();
+}
+
+// --- CASO: Solicitud de información de usuario ---
+static void handle_user_info(const ChatMessage *m, struct lws *wsi)
+{
+    if (!require_registered(m->sender.str, wsi))
+        return;
+    if (m->target.kind != JSON_FIELD_STRING)
+        return;
+
+    const char *target = m->target.str;
+    char timestamp[TIMESTAMP_SIZE];
+    timestamp_now(timestamp);
+
+    JsonWriter *w = json_writer_begin();
+    metrics_lock(&user_lock, METRIC_LOCK_USER);
+    User *user = find_user_by_name(target);
+    if (user)
+    {
+        const char *status_str = status_names[user->status];
+        resp_user_info(w, target, user->ip, status_str, timestamp);
+    }
+    else
     {
-        int sender_found = 0;
-        pthread_mutex_lock(&user_lock);
-        for (int i = 0; i < user_count; i++)
-        {
-            if (strcmp(users[i].username, sender) == 0)
-            {
-                sender_found = 1;
-                break;
-            }
-        }
-        pthread_mutex_unlock(&user_lock);
-        if (!sender_found)
-        {
-            send_error(wsi, "Usuario no registrado. Por favor, regístrese primero.");
-            cJSON_Delete(json);
-            return;
-        }
-        cJSON *content_item = cJSON_GetObjectItem(json, "content");
-        if (!content_item || !cJSON_IsString(content_item))
-        {
-            send_error(wsi, "Campo 'content' inválido para cambio de estado");
-            cJSON_Delete(json);
-            return;
-        }
-        const char *new_status = content_item->valuestring;
+        resp_user_info(w, target, NULL, NULL, timestamp);
+    }
+    pthread_mutex_unlock(&user_lock);
+    json_writer_send(w, wsi);
+}
 
-        // Validar que el estado sea uno de los permitidos
-        if (strcmp(new_status, "ACTIVO") != 0 &&
-            strcmp(new_status, "OCUPADO") != 0 &&
-            strcmp(new_status, "INACTIVO") != 0)
-        {
-            send_error(wsi, "Estado inválido. Los estados permitidos son: ACTIVO, OCUPADO, INACTIVO");
-            cJSON_Delete(json);
-            return;
-        }
+// Tabla de despacho: los tipos que el servidor no acepta quedan en NULL
+static const MessageHandler message_handlers[MSG_TYPE_COUNT] = {
+    [MSG_REGISTER] = handle_register,
+    [MSG_BROADCAST] = handle_broadcast,
+    [MSG_PRIVATE] = handle_private,
+    [MSG_JOIN] = handle_join,
+    [MSG_LEAVE] = handle_leave,
+    [MSG_ROOM_MESSAGE] = handle_room_message,
+    [MSG_LIST_USERS] = handle_list_users,
+    [MSG_CHANGE_STATUS] = handle_change_status,
+    [MSG_DISCONNECT] = handle_disconnect,
+    [MSG_SUBSCRIBE] = handle_subscribe,
+    [MSG_UNSUBSCRIBE] = handle_unsubscribe,
+    [MSG_USER_INFO] = handle_user_info,
+};
 
-        // Actualizar el estado en el registro del usuario
-        pthread_mutex_lock(&user_lock);
-        for (int i = 0; i < user_count; i++)
-        {
-            if (strcmp(users[i].username, sender) == 0)
-            {
-                if (strcmp(new_status, "OCUPADO") == 0)
-                    users[i].status = 1;
-                else if (strcmp(new_status, "INACTIVO") == 0)
-                    users[i].status = 2;
-                else
-                    users[i].status = 0; // ACTIVO
-                break;
-            }
-        }
-        pthread_mutex_unlock(&user_lock);
+// Valida los campos comunes y despacha con un hash y una llamada indirecta.
+// Devuelve el tipo atendido (MSG_UNKNOWN si no llegó a un manejador).
+static MsgType dispatch_message(const ChatMessage *m, struct lws *wsi)
+{
+    // Validar campo "type"
+    if (m->type.kind != JSON_FIELD_STRING)
+    {
+        send_error(wsi, "Campo 'type' no encontrado o inválido");
+        return MSG_UNKNOWN;
+    }
 
-        // Construir respuesta de actualización de estado con cJSON
-        cJSON *response = cJSON_CreateObject();
-        cJSON_AddStringToObject(response, "type", "status_update");
-        cJSON_AddStringToObject(response, "sender", "server");
-
-        cJSON *status_obj = cJSON_CreateObject();
-        cJSON_AddStringToObject(status_obj, "user", sender);
-        cJSON_AddStringToObject(status_obj, "status", new_status);
-        cJSON_AddItemToObject(response, "content", status_obj);
-
-        // Agregar timestamp al mismo nivel que "content"
-        time_t now = time(NULL);
-        struct tm *t = localtime(&now);
-        char timestamp[32];
-        strftime(timestamp, sizeof(timestamp), "%Y-%m-%dT%H:%M:%S", t);
-        cJSON_AddStringToObject(response, "timestamp", timestamp);
-
-        char *response_str = cJSON_PrintUnformatted(response);
-        pthread_mutex_lock(&broadcast_lock);
-        if (g_broadcast_msg)
-            free(g_broadcast_msg);
-        g_broadcast_msg = strdup(response_str);
-        pthread_mutex_unlock(&broadcast_lock);
-        broadcast_message(response_str);
-
-        free(response_str);
-        cJSON_Delete(response);
-    }
-    // --- CASO: Desconexión ---
-    else if (strcmp(type, "disconnect") == 0)
-    {
-        int sender_found = 0;
-        pthread_mutex_lock(&user_lock);
-        for (int i = 0; i < user_count; i++)
-        {
-            if (strcmp(users[i].username, sender) == 0)
-            {
-                sender_found = 1;
-                break;
-            }
-        }
-        pthread_mutex_unlock(&user_lock);
-        if (!sender_found)
-        {
-            send_error(wsi, "Usuario no registrado. Por favor, regístrese primero.");
-            cJSON_Delete(json);
-            return;
-        }
-        cJSON *response = cJSON_CreateObject();
-        cJSON_AddStringToObject(response, "type", "user_disconnected");
-        cJSON_AddStringToObject(response, "sender", "server");
-
-        char content_msg[100];
-        snprintf(content_msg, sizeof(content_msg), "%s ha salido", sender);
-        cJSON_AddStringToObject(response, "content", content_msg);
-
-        time_t now = time(NULL);
-        struct tm *t = localtime(&now);
-        char timestamp[32];
-        strftime(timestamp, sizeof(timestamp), "%Y-%m-%dT%H:%M:%S", t);
-        cJSON_AddStringToObject(response, "timestamp", timestamp);
-
-        char *response_str = cJSON_PrintUnformatted(response);
-        pthread_mutex_lock(&broadcast_lock);
-        if (g_broadcast_msg)
-            free(g_broadcast_msg);
-        g_broadcast_msg = strdup(response_str);
-        pthread_mutex_unlock(&broadcast_lock);
-        broadcast_message(response_str);
-        remove_user(wsi);
-        free(response_str);
-        cJSON_Delete(response);
-    }
-    // --- CASO: Solicitud de información de usuario ---
-    else if (strcmp(type, "user_info") == 0)
-    {
-        int sender_found = 0;
-        pthread_mutex_lock(&user_lock);
-        for (int i = 0; i < user_count; i++)
-        {
-            if (strcmp(users[i].username, sender) == 0)
-            {
-                sender_found = 1;
-                break;
-            }
-        }
-        pthread_mutex_unlock(&user_lock);
-        if (!sender_found)
-        {
-            send_error(wsi, "Usuario no registrado. Por favor, regístrese primero.");
-            cJSON_Delete(json);
-            return;
-        }
-        cJSON *target_item = cJSON_GetObjectItem(json, "target");
-        if (target_item && cJSON_IsString(target_item))
-        {
-            const char *target = target_item->valuestring;
-            cJSON *response = cJSON_CreateObject();
-            cJSON_AddStringToObject(response, "type", "user_info_response");
-            cJSON_AddStringToObject(response, "sender", "server");
-            cJSON_AddStringToObject(response, "target", target);
-
-            cJSON *content = cJSON_CreateObject();
-            int found = 0;
-            pthread_mutex_lock(&user_lock);
-            for (int i = 0; i < user_count; i++)
-            {
-                if (strcmp(users[i].username, target) == 0)
-                {
-                    found = 1;
-                    cJSON_AddStringToObject(content, "ip", users[i].ip);
-                    const char *status_str = (users[i].status == 0) ? "ACTIVO" : (users[i].status == 1) ? "OCUPADO"
-                                                                                                        : "INACTIVO";
-                    cJSON_AddStringToObject(content, "status", status_str);
-                    break;
-                }
-            }
-            pthread_mutex_unlock(&user_lock);
+    // Validar campo "sender"
+    if (m->sender.kind != JSON_FIELD_STRING)
+    {
+        send_error(wsi, "Campo 'sender' no encontrado o inválido");
+        return MSG_UNKNOWN;
+    }
 
-            if (!found)
-            {
-                cJSON_AddStringToObject(content, "error", "Usuario no encontrado");
-            }
+    MsgType type = msg_type_lookup(m->type.str, m->type.len);
+    MessageHandler handler = message_handlers[type];
+    if (!handler)
+    {
+        // --- CASO: Tipo desconocido ---
+        send_error(wsi, "Tipo de mensaje no válido");
+        return MSG_UNKNOWN;
+    }
 
-            cJSON_AddItemToObject(response, "content", content);
+    // 🔹 rate_sniff_type solo mira el comienzo y la clave "type" exacta; si el tipo
+    // decodificado es otro, su límite se cobra acá para que no se pueda esquivar
+    SessionData *pss = (SessionData *)lws_wsi_user(wsi);
+    if (rate_take_decoded(&pss->rate, type, monotonic_ms()) > 0)
+    {
+        metrics_add(METRIC_RATE_LIMITED, 1);
+        send_error(wsi, "Demasiados mensajes; espere antes de enviar más");
+        return MSG_UNKNOWN;
+    }
+    handler(m, wsi);
+    return type;
+}
 
-            time_t now = time(NULL);
-            struct tm *t = localtime(&now);
-            char timestamp[32];
-            strftime(timestamp, sizeof(timestamp), "%Y-%m-%dT%H:%M:%S", t);
-            cJSON_AddStringToObject(response, "timestamp", timestamp);
+static MsgType process_message(char *msg, size_t len, struct lws *wsi)
+{
+    ChatMessage m;
+    cJSON *json = NULL;
 
-            char *response_str = cJSON_PrintUnformatted(response);
-            size_t resp_len = strlen(response_str);
-            unsigned char *buf = malloc(LWS_PRE + resp_len);
-            if (buf)
-            {
-                memcpy(buf + LWS_PRE, response_str, resp_len);
-                lws_write(wsi, buf + LWS_PRE, resp_len, LWS_WRITE_TEXT);
-                free(buf);
-            }
-            free(response_str);
-            cJSON_Delete(response);
+    if (wsi_is_binary(wsi))
+    {
+        // 🔹 "chat-protocol-bin": los mismos campos en MessagePack, también sin reservas
+        LOG_SAMPLED(LOG_LEVEL_DEBUG, RAW_LOG_SAMPLE, "Mensaje binario recibido (len=%zu)", len);
+        if (chat_message_decode_msgpack((unsigned char *)msg, len, &m) < 0)
+        {
+            send_error(wsi, "Mensaje binario inválido");
+            return MSG_UNKNOWN;
         }
     }
-    // --- CASO: Tipo desconocido ---
     else
     {
-        send_error(wsi, "Tipo de mensaje no válido");
+        // Mensaje crudo para depuración (muestreado: en carga solo una de cada RAW_LOG_SAMPLE)
+        LOG_SAMPLED(LOG_LEVEL_DEBUG, RAW_LOG_SAMPLE, "Mensaje recibido (crudo, len=%zu): [%.*s]", len, (int)len, msg);
+
+        // 🔹 Camino rápido sin reservas de memoria; cJSON solo para entradas inusuales o inválidas
+        if (chat_message_decode(msg, len, &m) < 0)
+        {
+            json = cJSON_ParseWithLength(msg, len);
+            if (json == NULL)
+            {
+                send_error(wsi, "Mensaje JSON inválido");
+                return MSG_UNKNOWN;
+            }
+            memset(&m, 0, sizeof(m));
+            field_from_cjson(json, "type", &m.type);
+            field_from_cjson(json, "sender", &m.sender);
+            field_from_cjson(json, "target", &m.target);
+            field_from_cjson(json, "content", &m.content);
+        }
     }
 
+    metrics_lock(&user_lock, METRIC_LOCK_USER);
+    User *self = find_user_by_wsi(wsi);
+    if (self)
+        arm_idle_timer(self); // ⏱️ Marca la actividad
+    pthread_mutex_unlock(&user_lock);
+
+    MsgType type = dispatch_message(&m, wsi);
     cJSON_Delete(json);
+    return type;
+}
+
+void handle_message(char *msg, size_t len, struct lws *wsi)
+{
+    // ⏱️ Latencia por tipo: decodificación, validación y manejador (incluido el reparto)
+    uint64_t start = metrics_now_ns();
+    MsgType type = process_message(msg, len, wsi);
+    metrics_message(type, metrics_now_ns() - start);
 }
\ No newline at end of file
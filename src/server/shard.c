@@ -0,0 +1,156 @@
+#include "shard.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+Shard shards[MAX_SHARDS];
+int shard_count = 1;
+
+static struct lws_context *service_context = NULL;
+static __thread int current_shard = -1;
+
+static void mailbox_init(Mailbox *mb)
+{
+    atomic_init(&mb->stub.next, NULL);
+    atomic_init(&mb->head, &mb->stub);
+    mb->tail = &mb->stub;
+}
+
+static void mailbox_push(Mailbox *mb, MailboxNode *node)
+{
+    atomic_store_explicit(&node->next, NULL, memory_order_relaxed);
+    MailboxNode *prev = atomic_exchange_explicit(&mb->head, node, memory_order_acq_rel);
+    atomic_store_explicit(&prev->next, node, memory_order_release);
+}
+
+static MailboxNode *mailbox_pop(Mailbox *mb)
+{
+    MailboxNode *tail = mb->tail;
+    MailboxNode *next = atomic_load_explicit(&tail->next, memory_order_acquire);
+
+    if (tail == &mb->stub)
+    {
+        if (!next)
+            return NULL;
+        mb->tail = next;
+        tail = next;
+        next = atomic_load_explicit(&next->next, memory_order_acquire);
+    }
+    if (next)
+    {
+        mb->tail = next;
+        return tail;
+    }
+    // 🔹 Un productor está a mitad de push: se reintenta en el próximo despertar
+    if (tail != atomic_load_explicit(&mb->head, memory_order_acquire))
+        return NULL;
+    mailbox_push(mb, &mb->stub);
+    next = atomic_load_explicit(&tail->next, memory_order_acquire);
+    if (next)
+    {
+        mb->tail = next;
+        return tail;
+    }
+    return NULL;
+}
+
+void shards_init(struct lws_context *context, int count)
+{
+    service_context = context;
+    shard_count = count;
+    for (int i = 0; i < count; i++)
+    {
+        mailbox_init(&shards[i].mailbox);
+        shards[i].conns = NULL;
+        shards[i].count = 0;
+        shards[i].cap = 0;
+        shards[i].batch_count = 0;
+    }
+}
+
+void shard_bind_thread(int shard)
+{
+    current_shard = shard;
+}
+
+int shard_current(void)
+{
+    return current_shard;
+}
+
+int shard_reserve(int shard, int count)
+{
+    Shard *s = &shards[shard];
+    if (count <= s->cap)
+        return 0;
+    int cap = s->cap ? s->cap * 2 : 64;
+    while (cap < count)
+        cap *= 2;
+    ShardConn *conns = realloc(s->conns, cap * sizeof(*conns));
+    if (!conns)
+        return -1;
+    s->conns = conns;
+    s->cap = cap;
+    return 0;
+}
+
+int shard_attach(int shard, struct lws *wsi, int *pos)
+{
+    Shard *s = &shards[shard];
+    if (shard_reserve(shard, s->count + 1) < 0)
+        return -1;
+    s->conns[s->count].wsi = wsi;
+    s->conns[s->count].pos = pos;
+    *pos = s->count++;
+    return 0;
+}
+
+void shard_detach(int shard, int *pos)
+{
+    Shard *s = &shards[shard];
+    int i = *pos;
+    if (i < 0 || i >= s->count || s->conns[i].pos != pos)
+        return;
+
+    s->conns[i] = s->conns[--s->count];
+    *s->conns[i].pos = i;
+    *pos = -1;
+}
+
+int shard_post(int shard, Frame *frame, const char *target)
+{
+    MailboxNode *node = malloc(sizeof(MailboxNode));
+    if (!node)
+        return -1;
+    node->frame = frame_ref(frame);
+    node->room = NULL;
+    if (target)
+        snprintf(node->target, sizeof(node->target), "%s", target);
+    else
+        node->target[0] = '\0';
+    mailbox_push(&shards[shard].mailbox, node);
+    return 0;
+}
+
+int shard_post_room(int shard, Frame *frame, struct Room *room)
+{
+    MailboxNode *node = malloc(sizeof(MailboxNode));
+    if (!node)
+        return -1;
+    node->frame = frame_ref(frame);
+    node->room = room;
+    node->target[0] = '\0';
+    mailbox_push(&shards[shard].mailbox, node);
+    return 0;
+}
+
+MailboxNode *shard_take(int shard)
+{
+    return mailbox_pop(&shards[shard].mailbox);
+}
+
+void shard_wake(void)
+{
+    if (service_context && shard_count > 1)
+        lws_cancel_service(service_context);
+}
@@ -0,0 +1,84 @@
+#ifndef SHARD_H
+#define SHARD_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <libwebsockets.h>
+#include "send_queue.h"
+
+#define MAX_SHARDS 16 // Hilos de servicio máximos (requiere lws compilado con LWS_MAX_SMP >= MAX_SHARDS)
+#define SHARD_BATCH_MAX 64 // Eventos por lote antes de enviarlo sin esperar la ventana
+
+// Cada hilo de servicio de lws es dueño de un shard: solo ese hilo escribe en sus conexiones
+// y pide WRITEABLE sobre ellas. Los demás hilos le dejan trabajo en un buzón MPSC sin locks
+// y lo despiertan con lws_cancel_service.
+
+struct Room;
+
+// Entrada del buzón: un frame para todo el shard (target vacío), para un usuario concreto
+// o para los miembros de una sala en el shard
+typedef struct MailboxNode
+{
+    _Atomic(struct MailboxNode *) next;
+    Frame *frame;
+    struct Room *room; // Con una referencia que suelta quien vacía el buzón
+    char target[50];
+} MailboxNode;
+
+// Cola MPSC intrusiva (algoritmo de Vyukov): push sin locks desde cualquier hilo,
+// pop solo desde el hilo dueño.
+typedef struct
+{
+    _Atomic(MailboxNode *) head;
+    MailboxNode *tail;
+    MailboxNode stub;
+} Mailbox;
+
+// Conexión registrada en un shard; pos apunta al campo de la sesión que guarda su índice
+typedef struct
+{
+    struct lws *wsi;
+    int *pos;
+} ShardConn;
+
+typedef struct
+{
+    Mailbox mailbox;
+    ShardConn *conns; // Conexiones registradas del shard; solo las toca el hilo dueño
+    int count;
+    int cap;
+    // Eventos de difusión pendientes para las conexiones que pidieron lotes (solo el hilo dueño)
+    Frame *batch[SHARD_BATCH_MAX];
+    int batch_count;
+    uint64_t batch_deadline; // monotonic_ms() en que vence la ventana del lote
+} Shard;
+
+extern Shard shards[MAX_SHARDS];
+extern int shard_count;
+
+void shards_init(struct lws_context *context, int count);
+
+// Asocia el hilo actual a un shard; cada hilo de servicio lo llama antes de su bucle.
+void shard_bind_thread(int shard);
+// Shard del hilo actual, o -1 si no es un hilo de servicio.
+int shard_current(void);
+
+// Altas y bajas O(1) de conexiones registradas; solo desde el hilo dueño del shard.
+// *pos guarda el índice de la conexión y se actualiza si otra ocupa su lugar.
+// shard_reserve deja lugar para count conexiones (-1 si no hay memoria); tras reservar,
+// shard_attach no falla.
+int shard_reserve(int shard, int count);
+int shard_attach(int shard, struct lws *wsi, int *pos);
+void shard_detach(int shard, int *pos);
+
+// Deja una referencia al frame en el buzón del shard. target NULL = todo el shard.
+int shard_post(int shard, Frame *frame, const char *target);
+// Igual, para los miembros de room en el shard. El nodo se queda con la referencia a room
+// que el llamador ya tomó.
+int shard_post_room(int shard, Frame *frame, struct Room *room);
+// Saca la siguiente entrada del buzón del shard (solo el hilo dueño), o NULL si está vacío.
+MailboxNode *shard_take(int shard);
+// Despierta a los hilos de servicio para que vacíen sus buzones.
+void shard_wake(void);
+
+#endif
@@ -0,0 +1,64 @@
+#include "server.h"
+
+#define STATS_HTTP_CHUNK 4096 // Bytes del cuerpo por HTTP_WRITEABLE
+
+// 🔹 Arma el cuerpo completo de una vez (una foto de las métricas) y lo manda en pedazos
+int stats_http_begin(struct lws *wsi, SessionData *pss, const char *uri)
+{
+    int json = strcmp(uri, "/stats") == 0;
+    if (!json && strcmp(uri, "/metrics") != 0)
+    {
+        lws_return_http_status(wsi, HTTP_STATUS_NOT_FOUND, NULL);
+        return lws_http_transaction_completed(wsi) ? -1 : 0;
+    }
+
+    metrics_lock(&user_lock, METRIC_LOCK_USER);
+    int users = user_count;
+    pthread_mutex_unlock(&user_lock);
+
+    JsonWriter *w = json_writer_begin();
+    metrics_render(w, json, users);
+    frame_unref(pss->http_body);
+    pss->http_body = json_writer_frame(w);
+    pss->http_sent = 0;
+    if (!pss->http_body)
+        return -1;
+
+    unsigned char headers[LWS_PRE + 256];
+    unsigned char *start = headers + LWS_PRE, *p = start, *end = headers + sizeof(headers) - 1;
+    const char *type = json ? "application/json" : "text/plain; version=0.0.4; charset=utf-8";
+    if (lws_add_http_common_headers(wsi, HTTP_STATUS_OK, type, (long)pss->http_body->len, &p, end) ||
+        lws_finalize_write_http_header(wsi, start, &p, end))
+        return -1;
+    lws_callback_on_writable(wsi);
+    return 0;
+}
+
+int stats_http_write(struct lws *wsi, SessionData *pss)
+{
+    Frame *body = pss->http_body;
+    if (!body)
+        return 0;
+
+    size_t left = body->len - pss->http_sent;
+    size_t n = left > STATS_HTTP_CHUNK ? STATS_HTTP_CHUNK : left;
+    int final = n == left;
+    // Lo ya enviado hace de LWS_PRE para los pedazos siguientes
+    if (lws_write(wsi, frame_payload(body) + pss->http_sent, n, final ? LWS_WRITE_HTTP_FINAL : LWS_WRITE_HTTP) < (int)n)
+        return -1;
+    pss->http_sent += n;
+    if (!final)
+    {
+        lws_callback_on_writable(wsi);
+        return 0;
+    }
+    stats_http_release(pss);
+    return lws_http_transaction_completed(wsi) ? -1 : 0;
+}
+
+void stats_http_release(SessionData *pss)
+{
+    frame_unref(pss->http_body);
+    pss->http_body = NULL;
+    pss->http_sent = 0;
+}
@@ -0,0 +1,89 @@
+#include "timer_wheel.h"
+
+static void list_init(TimerNode *head)
+{
+    head->prev = head->next = head;
+}
+
+static void list_append(TimerNode *head, TimerNode *node)
+{
+    node->prev = head->prev;
+    node->next = head;
+    head->prev->next = node;
+    head->prev = node;
+}
+
+// Ubica el nodo en el nivel cuya resolución cubre la distancia hasta su vencimiento
+static void place(TimerWheel *tw, TimerNode *node)
+{
+    uint64_t delta = node->expires - tw->now;
+    int level = 0;
+    while (level < TW_LEVELS - 1 && delta >= ((uint64_t)1 << (TW_BITS * (level + 1))))
+        level++;
+    int slot = (int)((node->expires >> (TW_BITS * level)) & TW_MASK);
+    list_append(&tw->slots[level][slot], node);
+}
+
+void timer_wheel_init(TimerWheel *tw, uint64_t now)
+{
+    for (int l = 0; l < TW_LEVELS; l++)
+        for (int s = 0; s < TW_SLOTS; s++)
+            list_init(&tw->slots[l][s]);
+    tw->now = now;
+}
+
+void timer_wheel_cancel(TimerNode *node)
+{
+    if (!timer_node_armed(node))
+        return;
+    node->prev->next = node->next;
+    node->next->prev = node->prev;
+    node->prev = node->next = NULL;
+}
+
+void timer_wheel_schedule(TimerWheel *tw, TimerNode *node, uint64_t expires)
+{
+    timer_wheel_cancel(node);
+    if (expires <= tw->now)
+        expires = tw->now + 1;
+    if (expires - tw->now >= TW_MAX_DELTA)
+        expires = tw->now + TW_MAX_DELTA - 1;
+    node->expires = expires;
+    place(tw, node);
+}
+
+// Baja los nodos de una ranura de nivel superior a niveles más finos
+static void cascade(TimerWheel *tw, int level)
+{
+    TimerNode *head = &tw->slots[level][(tw->now >> (TW_BITS * level)) & TW_MASK];
+    TimerNode *node = head->next;
+    list_init(head);
+    while (node != head)
+    {
+        TimerNode *next = node->next;
+        place(tw, node);
+        node = next;
+    }
+}
+
+void timer_wheel_advance(TimerWheel *tw, uint64_t now, timer_fire_fn fire, void *arg)
+{
+    while (tw->now < now)
+    {
+        tw->now++;
+        for (int level = 1; level < TW_LEVELS; level++)
+        {
+            if (tw->now & (((uint64_t)1 << (TW_BITS * level)) - 1))
+                break;
+            cascade(tw, level);
+        }
+
+        TimerNode *head = &tw->slots[0][tw->now & TW_MASK];
+        while (head->next != head)
+        {
+            TimerNode *node = head->next;
+            timer_wheel_cancel(node);
+            fire(node, arg);
+        }
+    }
+}
@@ -0,0 +1,50 @@
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Rueda de temporizadores jerárquica (3 niveles de 64 ranuras) para detectar inactividad
+// sin un hilo por usuario. Los nodos son intrusivos: viven dentro del registro que temporizan,
+// así que programar, re-armar y cancelar es O(1). No es thread-safe; el llamador sincroniza.
+#define TW_BITS 6
+#define TW_SLOTS (1 << TW_BITS)
+#define TW_MASK (TW_SLOTS - 1)
+#define TW_LEVELS 3
+#define TW_MAX_DELTA ((uint64_t)1 << (TW_BITS * TW_LEVELS)) // Ticks máximos hacia el futuro
+
+typedef struct TimerNode
+{
+    struct TimerNode *prev;
+    struct TimerNode *next;
+    uint64_t expires; // Tick absoluto en el que vence
+} TimerNode;
+
+typedef struct
+{
+    TimerNode slots[TW_LEVELS][TW_SLOTS]; // Centinelas de listas circulares
+    uint64_t now;                         // Último tick procesado
+} TimerWheel;
+
+typedef void (*timer_fire_fn)(TimerNode *node, void *arg);
+
+void timer_wheel_init(TimerWheel *tw, uint64_t now);
+
+// Programa (o re-programa) el nodo para el tick expires. Si ya vencía se dispara en el próximo tick.
+void timer_wheel_schedule(TimerWheel *tw, TimerNode *node, uint64_t expires);
+void timer_wheel_cancel(TimerNode *node);
+
+// Procesa todos los ticks hasta now, llamando a fire por cada nodo vencido (ya desenlazado).
+void timer_wheel_advance(TimerWheel *tw, uint64_t now, timer_fire_fn fire, void *arg);
+
+static inline void timer_node_init(TimerNode *node)
+{
+    node->prev = node->next = NULL;
+}
+
+static inline int timer_node_armed(const TimerNode *node)
+{
+    return node->next != NULL;
+}
+
+#endif
@@ -0,0 +1,149 @@
+#include "user_pool.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Cabecera de cada registro: mientras está libre enlaza la lista libre del slab,
+// mientras está en uso solo recuerda a qué slab pertenece.
+typedef struct PoolItem
+{
+    PoolSlab *slab;
+    struct PoolItem *next_free;
+} PoolItem;
+
+struct PoolSlab
+{
+    PoolSlab *prev; // Enlaces en la lista de slabs parciales
+    PoolSlab *next;
+    PoolItem *free_list;
+    int live;
+    int in_partial;
+    _Alignas(max_align_t) unsigned char items[];
+};
+
+// Espacio reservado por registro: cabecera + dato, alineado
+static size_t stride(const UserPool *pool)
+{
+    size_t s = sizeof(PoolItem) + pool->item_size;
+    size_t a = _Alignof(max_align_t);
+    return (s + a - 1) / a * a;
+}
+
+static void *item_data(PoolItem *item)
+{
+    return (unsigned char *)item + sizeof(PoolItem);
+}
+
+static PoolItem *item_header(void *data)
+{
+    return (PoolItem *)((unsigned char *)data - sizeof(PoolItem));
+}
+
+static void partial_push(UserPool *pool, PoolSlab *slab)
+{
+    slab->prev = NULL;
+    slab->next = pool->partial;
+    if (pool->partial)
+        pool->partial->prev = slab;
+    pool->partial = slab;
+    slab->in_partial = 1;
+}
+
+static void partial_unlink(UserPool *pool, PoolSlab *slab)
+{
+    if (slab->prev)
+        slab->prev->next = slab->next;
+    else
+        pool->partial = slab->next;
+    if (slab->next)
+        slab->next->prev = slab->prev;
+    slab->prev = slab->next = NULL;
+    slab->in_partial = 0;
+}
+
+static PoolSlab *slab_new(UserPool *pool)
+{
+    size_t st = stride(pool);
+    PoolSlab *slab = malloc(sizeof(PoolSlab) + st * (size_t)pool->items_per_slab);
+    if (!slab)
+        return NULL;
+    slab->prev = slab->next = NULL;
+    slab->live = 0;
+    slab->in_partial = 0;
+    slab->free_list = NULL;
+    for (int i = pool->items_per_slab - 1; i >= 0; i--)
+    {
+        PoolItem *item = (PoolItem *)(slab->items + st * (size_t)i);
+        item->slab = slab;
+        item->next_free = slab->free_list;
+        slab->free_list = item;
+    }
+    pool->slabs++;
+    return slab;
+}
+
+void user_pool_init(UserPool *pool, size_t item_size, int items_per_slab)
+{
+    pool->item_size = item_size;
+    pool->items_per_slab = items_per_slab;
+    pool->partial = NULL;
+    pool->spare = NULL;
+    pool->slabs = 0;
+    pool->live = 0;
+}
+
+void *user_pool_alloc(UserPool *pool)
+{
+    PoolSlab *slab = pool->partial;
+    if (!slab)
+    {
+        slab = pool->spare ? pool->spare : slab_new(pool);
+        pool->spare = NULL;
+        if (!slab)
+            return NULL;
+        partial_push(pool, slab);
+    }
+
+    PoolItem *item = slab->free_list;
+    slab->free_list = item->next_free;
+    slab->live++;
+    if (!slab->free_list)
+        partial_unlink(pool, slab);
+    pool->live++;
+
+    void *data = item_data(item);
+    memset(data, 0, pool->item_size);
+    return data;
+}
+
+void user_pool_free(UserPool *pool, void *data)
+{
+    if (!data)
+        return;
+    PoolItem *item = item_header(data);
+    PoolSlab *slab = item->slab;
+
+    item->next_free = slab->free_list;
+    slab->free_list = item;
+    slab->live--;
+    pool->live--;
+
+    if (slab->live == 0)
+    {
+        // 🔹 Slab vacío: se conserva uno de reserva y el resto vuelve al sistema
+        if (slab->in_partial)
+            partial_unlink(pool, slab);
+        if (pool->spare)
+        {
+            free(slab);
+            pool->slabs--;
+        }
+        else
+        {
+            pool->spare = slab;
+        }
+    }
+    else if (!slab->in_partial)
+    {
+        partial_push(pool, slab);
+    }
+}
@@ -0,0 +1,30 @@
+#ifndef USER_POOL_H
+#define USER_POOL_H
+
+#include <stddef.h>
+
+// Asignador por slabs para registros de tamaño fijo (los User del servidor).
+// Los registros nunca se mueven mientras están vivos, así que los punteros a ellos
+// (temporizadores, índices) siguen siendo válidos aunque el registro crezca.
+// Cada slab lleva su propia lista libre; un slab que queda vacío se devuelve al
+// sistema (salvo uno de reserva), de modo que la memoria sigue a los usuarios vivos.
+// No es thread-safe; el llamador sincroniza.
+
+typedef struct PoolSlab PoolSlab;
+
+typedef struct
+{
+    size_t item_size;     // Tamaño de cada registro, incluida la cabecera interna
+    int items_per_slab;
+    PoolSlab *partial;    // Slabs con al menos un registro libre
+    PoolSlab *spare;      // Slab vacío guardado para absorber el churn
+    size_t slabs;         // Slabs reservados actualmente
+    size_t live;          // Registros en uso
+} UserPool;
+
+void user_pool_init(UserPool *pool, size_t item_size, int items_per_slab);
+// Devuelve un registro en cero, o NULL si no hay memoria.
+void *user_pool_alloc(UserPool *pool);
+void user_pool_free(UserPool *pool, void *item);
+
+#endif